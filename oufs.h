@@ -18,6 +18,7 @@
 
 // Implementation of min operator
 #define MIN(a, b) (((a) > (b)) ? (b) : (a))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
 /**********************************************************************/
 /*
@@ -42,6 +43,14 @@ typedef unsigned short INODE_REFERENCE;
 #define UNALLOCATED_BLOCK USHRT_MAX
 #define UNALLOCATED_BLOCK USHRT_MAX
 
+// Value used as a block reference inside a sparse file where no block is allocated.
+//  The range it covers reads as zeroes
+#define HOLE_BLOCK (USHRT_MAX-1)
+
+// Flag set in an inode's block reference when the block has been reserved
+//  (oufs_fallocate) but no data has been written to it yet.  Such blocks read as zeroes
+#define UNWRITTEN_BLOCK_FLAG 0x8000
+
 // Number of inode blocks on the virtual disk
 #define N_INODE_BLOCKS 8
 
@@ -67,6 +76,9 @@ typedef struct data_block_s {
 #define IT_NONE 'N'
 #define IT_DIRECTORY 'D'
 #define IT_FILE 'F'
+// File whose blocks hold its contents as one compressed stream: a 2-byte little endian
+//  stream length followed by an LZ4 block.  size is the uncompressed size
+#define IT_COMPRESSED_FILE 'C'
 
 // Single inode
 typedef struct inode_s {
@@ -107,8 +119,28 @@ typedef struct master_block_s {
     // 8 data blocks per byte: One block per bit: 1 = allocated, 0 = free
     // Block 0 (the master block) is byte 0, bit 0
     unsigned char block_allocated_flag[N_BLOCKS_IN_DISK >> 3];
+
+    // Number of inodes sharing each allocated block beyond its first owner
+    //  (oufs_clone).  0 = block has a single owner and may be written in place
+    unsigned char block_share_count[N_BLOCKS_IN_DISK];
+
+    // MASTER_SHARE_MAGIC once block_share_count is maintained.  Older images left
+    //  these bytes uninitialized; oufs_read_master_r() reads their counts as 0
+    unsigned int share_magic;
 } MASTER_BLOCK;
 
+#define MASTER_SHARE_MAGIC 0x53484152
+
+// Allocation groups: the inode and block tables are split into equal slices, group g
+//  holding inode blocks 2g+1 and 2g+2 and the data blocks that follow the previous
+//  group's.  Group 0 also holds the master block, the inode blocks and the root directory
+#define N_ALLOCATION_GROUPS 4
+#define INODES_PER_GROUP (N_INODES / N_ALLOCATION_GROUPS)
+#define BLOCKS_PER_GROUP (N_BLOCKS_IN_DISK / N_ALLOCATION_GROUPS)
+#define INODE_GROUP(i) ((i) / INODES_PER_GROUP)
+#define BLOCK_GROUP(b) ((b) / BLOCKS_PER_GROUP)
+#define GROUP_FIRST_BLOCK(g) ((BLOCK_REFERENCE) ((g) * BLOCKS_PER_GROUP))
+
 /**********************************************************************/
 // Single directory element
 typedef struct directory_entry_s {
@@ -140,14 +172,85 @@ typedef union block_u {
 } BLOCK;
 
 
+/**********************************************************************/
+// A file system in use: the disk it lives on and the in-memory state kept for it.
+//  Prepare with oufs_init(); the functions without the _r suffix use oufs_default()
+
+typedef struct oufs_s {
+    VDISK *disk;
+
+    // Locks for sharing the file system between threads (see oufs_lib_support.c): each
+    //  inode has a reader/writer lock.  An inode's version is odd while it is locked
+    //  exclusively, so lookups can read it without locking
+    pthread_rwlock_t inode_lock[N_INODES];
+    unsigned int inode_version[N_INODES];
+
+    // Held by oufs_rename while it locks two directories that are not parent and child
+    pthread_mutex_t rename_lock;
+
+    // Deduplication (oufs_dedup.c): -1 = not decided yet (taken from ZDEDUP), 0 = off,
+    //  1 = on; the hash of each data block's contents, valid where the index bit is set
+    int dedup_state;
+    int dedup_index_built;
+    unsigned long long dedup_hash[N_BLOCKS_IN_DISK];
+    unsigned char dedup_indexed[N_BLOCKS_IN_DISK >> 3];
+} OUFS;
+
+
 /**********************************************************************/
 // Representing files (project 4!)
 
 typedef struct oufile_s {
+    // File system the file was opened on.  A handle is used by one thread at a time
+    //  (different handles may be used in parallel)
+    OUFS *fs;
+
     INODE_REFERENCE inode_reference;
     char mode;
     int offset;
+
+    // Size of the file as seen through this handle, including unflushed data
+    unsigned int size;
+
+    // Delayed allocation: written data is held here until the handle is flushed,
+    //  at which point blocks are allocated for the whole run at once.
+    //  Bit i of dirty_blocks is set when buffer[i] holds logical block i
+    unsigned short dirty_blocks;
+    DATA_BLOCK buffer[BLOCKS_PER_INODE];
+
+    // 1 = the file is stored compressed (IT_COMPRESSED_FILE) when flushed
+    char compressed;
 } OUFILE;
 
+// One directory entry, as returned by oufs_readdir()
+typedef struct oudirent_s {
+    char name[FILE_NAME_SIZE];
+    INODE_REFERENCE inode_reference;
+
+    // Type of the entry's inode: IT_DIRECTORY, IT_FILE, IT_COMPRESSED_FILE
+    char type;
+} OUDIRENT;
+
+// Open directory: a cursor over its entries.  A handle is used by one thread at a
+//  time, and holds no lock between calls
+typedef struct oudir_s {
+    OUFS *fs;
+
+    INODE_REFERENCE inode_reference;
+
+    // Next entry to look at: the index of its block in the inode's data times
+    //  DIRECTORY_ENTRIES_PER_BLOCK, plus its index in the block
+    int position;
+
+    // The directory block last read (its index in the inode's data, or -1 for none)
+    //  and the directory's version when it was read; it is read again once the
+    //  directory has changed
+    int block_index;
+    unsigned int block_version;
+    BLOCK block;
+
+    OUDIRENT entry;
+} OUDIR;
+
 
 #endif
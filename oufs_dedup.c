@@ -0,0 +1,233 @@
+#include "oufs_lib.h"
+
+#define debug 0
+
+/*
+ * Content-hash block deduplication.
+ *
+ * Identical file data blocks are shared between inodes through the block share
+ * counts in the master block, exactly like clones (oufs_clone): a shared block is
+ * copied before it is written, and freed once its last owner releases it.
+ *
+ * The hash->block index lives in memory only, in the OUFS context.  Like the tables
+ * it mirrors, it is only used inside a transaction, which one thread at a time has
+ * open (see oufs_lock_inode_r).  It is built
+ * from the file data on disk the first time it is needed and kept up to date as
+ * blocks are written and freed.  A hash match is always confirmed by comparing the block contents, so a
+ * stale entry can never cause two different blocks to be merged.
+ */
+
+/**
+ * FNV-1a hash of a data block
+ *
+ * @param block The block contents
+ * @return The 64-bit hash
+ */
+static unsigned long long oufs_dedup_hash(DATA_BLOCK *block) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        hash ^= block->data[i];
+        hash *= 1099511628211ULL;
+    }
+    return (hash);
+}
+
+/**
+ * Turn deduplication of written blocks on or off
+ *
+ * Unless set here, deduplication is on when the ZDEDUP environment variable is set.
+ *
+ * @param on 1 to enable, 0 to disable
+ */
+void oufs_dedup_enable_r(OUFS *fs, int on) {
+    fs->dedup_state = on;
+}
+
+/**
+ * @return 1 if written blocks are deduplicated
+ */
+int oufs_dedup_enabled_r(OUFS *fs) {
+    if (fs->dedup_state < 0)
+        fs->dedup_state = (getenv("ZDEDUP") != NULL);
+    return (fs->dedup_state);
+}
+
+/**
+ * Record the contents of a file data block in the index
+ *
+ * @param block_ref The block
+ * @param block Its contents
+ */
+void oufs_dedup_remember_r(OUFS *fs, BLOCK_REFERENCE block_ref, DATA_BLOCK *block) {
+    fs->dedup_hash[block_ref] = oufs_dedup_hash(block);
+    SET_BIT(fs->dedup_indexed, block_ref);
+}
+
+/**
+ * Drop a block from the index (it is being freed)
+ *
+ * @param block_ref The block
+ */
+void oufs_dedup_forget_r(OUFS *fs, BLOCK_REFERENCE block_ref) {
+    RESET_BIT(fs->dedup_indexed, block_ref);
+}
+
+/**
+ * Index the data blocks of every file on the disk
+ */
+static void oufs_dedup_build_index(OUFS *fs) {
+    BLOCK inodeBlock, dataBlock;
+
+    memset(fs->dedup_indexed, 0, sizeof(fs->dedup_indexed));
+    for (int b = 1; b <= N_INODE_BLOCKS; ++b) {
+        vdisk_read_block_r(fs->disk, b, &inodeBlock);
+        for (int i = 0; i < INODES_PER_BLOCK; ++i) {
+            INODE *inode = &inodeBlock.inodes.inode[i];
+            if (inode->type != IT_FILE)
+                continue;
+            for (int j = 0; j < BLOCKS_PER_INODE; ++j) {
+                BLOCK_REFERENCE ref = inode->data[j];
+                if (!BLOCK_IS_MAPPED(ref) || BLOCK_IS_UNWRITTEN(ref) || GET_BIT(fs->dedup_indexed, ref))
+                    continue;
+                vdisk_read_block_r(fs->disk, ref, &dataBlock);
+                oufs_dedup_remember_r(fs, ref, &dataBlock.data);
+            }
+        }
+    }
+    fs->dedup_index_built = 1;
+
+    if (debug)
+        fprintf(stderr, "Dedup index built\n");
+}
+
+/**
+ * Look for an allocated file data block with the given contents
+ *
+ * @param masterBlock The in-memory master block (allocation and share tables)
+ * @param block The contents to look for
+ * @param exclude A block that must not be returned (UNALLOCATED_BLOCK for none)
+ * @return The matching block, or UNALLOCATED_BLOCK if there is none or it cannot take
+ *         another share
+ */
+BLOCK_REFERENCE oufs_dedup_lookup_r(OUFS *fs, BLOCK *masterBlock, DATA_BLOCK *block, BLOCK_REFERENCE exclude) {
+    BLOCK candidate;
+
+    if (!fs->dedup_index_built)
+        oufs_dedup_build_index(fs);
+
+    unsigned long long hash = oufs_dedup_hash(block);
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        if (b == exclude || !GET_BIT(fs->dedup_indexed, b) || fs->dedup_hash[b] != hash)
+            continue;
+        if (!GET_BIT(masterBlock->master.block_allocated_flag, b) ||
+            masterBlock->master.block_share_count[b] == UCHAR_MAX) {
+            continue;
+        }
+        // Confirm: the block may have been rewritten since it was indexed
+        vdisk_read_block_r(fs->disk, b, &candidate);
+        if (memcmp(candidate.data.data, block->data, BLOCK_SIZE) == 0)
+            return ((BLOCK_REFERENCE) b);
+        oufs_dedup_remember_r(fs, b, &candidate.data);
+    }
+    return (UNALLOCATED_BLOCK);
+}
+
+/**
+ * Deduplicate every file on the disk (offline pass)
+ *
+ * Each file data block whose contents match an earlier block is remapped to it and
+ * freed.  The master block is written once at the end.  The files are locked for the
+ * duration of the pass; files created while it runs are left alone.
+ *
+ * @param reclaimed Filled in with the number of blocks freed
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_dedup_disk_r(OUFS *fs, int *reclaimed) {
+    BLOCK masterBlock, inodeBlock, dataBlock;
+    unsigned char locked[N_INODES >> 3];
+
+    // Files are only ever locked after the directories that hold them, so taking
+    //  them in inode order cannot deadlock
+    memset(locked, 0, sizeof(locked));
+    for (int b = 1; b <= N_INODE_BLOCKS; ++b) {
+        vdisk_read_block_r(fs->disk, b, &inodeBlock);
+        for (int i = 0; i < INODES_PER_BLOCK; ++i) {
+            if (inodeBlock.inodes.inode[i].type == IT_FILE) {
+                INODE_REFERENCE ref = (b - 1) * INODES_PER_BLOCK + i;
+                oufs_lock_inode_r(fs, ref, 1);
+                SET_BIT(locked, ref);
+            }
+        }
+    }
+
+    // The inode blocks and the master block are written together
+    *reclaimed = 0;
+    oufs_txn_begin_r(fs);
+    oufs_dedup_build_index(fs);
+    oufs_read_master_r(fs, &masterBlock);
+    for (int b = 1; b <= N_INODE_BLOCKS; ++b) {
+        int inodesChanged = 0;
+        vdisk_read_block_r(fs->disk, b, &inodeBlock);
+        for (int i = 0; i < INODES_PER_BLOCK; ++i) {
+            INODE *inode = &inodeBlock.inodes.inode[i];
+            if (inode->type != IT_FILE || !GET_BIT(locked, (b - 1) * INODES_PER_BLOCK + i))
+                continue;
+            for (int j = 0; j < BLOCKS_PER_INODE; ++j) {
+                BLOCK_REFERENCE ref = inode->data[j];
+                if (!BLOCK_IS_MAPPED(ref) || BLOCK_IS_UNWRITTEN(ref))
+                    continue;
+                vdisk_read_block_r(fs->disk, ref, &dataBlock);
+
+                // Only merge into a lower block so every duplicate converges on one copy
+                BLOCK_REFERENCE match = oufs_dedup_lookup_r(fs, &masterBlock, &dataBlock.data, ref);
+                if (match == UNALLOCATED_BLOCK || match > ref)
+                    continue;
+
+                ++masterBlock.master.block_share_count[match];
+                if (masterBlock.master.block_share_count[ref] == 0)
+                    ++*reclaimed;
+                oufs_release_block_r(fs, &masterBlock, ref);
+                inode->data[j] = match;
+                inodesChanged = 1;
+            }
+        }
+        if (inodesChanged)
+            vdisk_write_block_r(fs->disk, b, &inodeBlock);
+    }
+
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+    int status = oufs_txn_commit_r(fs);
+    for (int i = 0; i < N_INODES; ++i) {
+        if (GET_BIT(locked, i))
+            oufs_unlock_inode_r(fs, i);
+    }
+    return status;
+}
+
+/*
+ * Compatibility wrappers: the original interface, on the default file system
+ */
+
+void oufs_dedup_enable(int on) {
+    oufs_dedup_enable_r(oufs_default(), on);
+}
+
+int oufs_dedup_enabled() {
+    return (oufs_dedup_enabled_r(oufs_default()));
+}
+
+void oufs_dedup_remember(BLOCK_REFERENCE block_ref, DATA_BLOCK *block) {
+    oufs_dedup_remember_r(oufs_default(), block_ref, block);
+}
+
+void oufs_dedup_forget(BLOCK_REFERENCE block_ref) {
+    oufs_dedup_forget_r(oufs_default(), block_ref);
+}
+
+BLOCK_REFERENCE oufs_dedup_lookup(BLOCK *masterBlock, DATA_BLOCK *block, BLOCK_REFERENCE exclude) {
+    return (oufs_dedup_lookup_r(oufs_default(), masterBlock, block, exclude));
+}
+
+int oufs_dedup_disk(int *reclaimed) {
+    return (oufs_dedup_disk_r(oufs_default(), reclaimed));
+}
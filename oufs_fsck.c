@@ -0,0 +1,475 @@
+#include <stdarg.h>
+
+#include "oufs_lib.h"
+
+#define debug 0
+
+/*
+ * File system checker.
+ *
+ * The check runs in three passes.  First the inode table is read, one inode block at a
+ * time by each of a pool of threads, counting the owners of every block it maps.  Then the
+ * directory tree is walked from the root by the same pool: a thread takes a directory
+ * from a shared queue, reads its block, counts the entries naming each inode and queues
+ * the subdirectories it has not seen yet.  The counts are kept with atomic increments, so
+ * the threads share nothing else.  Last, a single thread compares the counts with the
+ * allocation tables, the link counts and the directory sizes and, when repairing, writes
+ * every fix in one transaction.
+ *
+ * Nothing else may change the file system while it is being checked: the tools hold the
+ * image lock (zfsck opens it exclusively to repair it), and zbench checks after its
+ * threads have finished.
+ */
+
+// Most threads a check uses: there is no more work than one inode block each
+#define MAX_FSCK_THREADS N_INODE_BLOCKS
+
+// Inode types that are in use, and block references that can hold file or directory data
+#define FSCK_IN_USE(type) ((type) == IT_DIRECTORY || IS_FILE_TYPE(type))
+#define FSCK_DATA_BLOCK(ref) (BLOCK_INDEX(ref) > N_INODE_BLOCKS && BLOCK_INDEX(ref) < N_BLOCKS_IN_DISK)
+
+typedef struct oufs_fsck_s {
+    OUFS *fs;
+    int repair;
+
+    // The tables as read from the disk, and the directory blocks reached by the walk
+    BLOCK master;
+    INODE inodes[N_INODES];
+    BLOCK directories[N_INODES];
+
+    // Counted by the threads: the inodes mapping each block, the entries (other than .
+    //  and ..) naming each inode, and how often each directory was reached.  parents holds
+    //  the directory through which each directory was reached first
+    int owners[N_BLOCKS_IN_DISK];
+    int references[N_INODES];
+    int visits[N_INODES];
+    INODE_REFERENCE parents[N_INODES];
+    int failed;
+
+    // Work shared by the threads: the next inode block to read, then the directories
+    //  still to walk and the number of threads walking one
+    int next_inode_block;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    INODE_REFERENCE queue[N_INODES];
+    int queued;
+    int busy;
+
+    // Found so far, and how many of those are fixed on the disk
+    int problems;
+    int repaired;
+} OUFS_FSCK;
+
+/**
+ * Report one problem
+ *
+ * @param fixable 1 if the caller can repair it
+ * @param format printf format of the description
+ * @return 1 if the caller should repair it now
+ */
+static int oufs_fsck_problem(OUFS_FSCK *ck, int fixable, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    ck->problems++;
+    if (fixable && ck->repair) {
+        ck->repaired++;
+        printf(", repaired");
+    }
+    printf("\n");
+    return (fixable && ck->repair);
+}
+
+/**
+ * Pass 1 thread: read inode blocks until there are none left, counting block owners
+ */
+static void *oufs_fsck_scan(void *arg) {
+    OUFS_FSCK *ck = arg;
+    BLOCK block;
+    int b;
+
+    while ((b = __atomic_add_fetch(&ck->next_inode_block, 1, __ATOMIC_RELAXED)) <= N_INODE_BLOCKS) {
+        if (vdisk_read_block_r(ck->fs->disk, b, &block) != 0) {
+            __atomic_store_n(&ck->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        for (int e = 0; e < INODES_PER_BLOCK; ++e) {
+            INODE *inode = &ck->inodes[(b - 1) * INODES_PER_BLOCK + e];
+            *inode = block.inodes.inode[e];
+            if (!FSCK_IN_USE(inode->type))
+                continue;
+            for (int j = 0; j < BLOCKS_PER_INODE; ++j) {
+                if (BLOCK_IS_MAPPED(inode->data[j]) && FSCK_DATA_BLOCK(inode->data[j]))
+                    __atomic_add_fetch(&ck->owners[BLOCK_INDEX(inode->data[j])], 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return (NULL);
+}
+
+/**
+ * Queue a directory for the walk
+ */
+static void oufs_fsck_push(OUFS_FSCK *ck, INODE_REFERENCE dir) {
+    pthread_mutex_lock(&ck->lock);
+    ck->queue[ck->queued++] = dir;
+    pthread_cond_signal(&ck->changed);
+    pthread_mutex_unlock(&ck->lock);
+}
+
+/**
+ * Read one directory and count the entries in it, queueing the new subdirectories
+ *
+ * @param dir The directory
+ */
+static void oufs_fsck_directory(OUFS_FSCK *ck, INODE_REFERENCE dir) {
+    BLOCK_REFERENCE ref = ck->inodes[dir].data[0];
+
+    // A directory without a usable block is reported in pass 3
+    if (!BLOCK_IS_MAPPED(ref) || !FSCK_DATA_BLOCK(ref))
+        return;
+    if (vdisk_read_block_r(ck->fs->disk, BLOCK_INDEX(ref), &ck->directories[dir]) != 0) {
+        __atomic_store_n(&ck->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    for (int i = 2; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+        INODE_REFERENCE child = ck->directories[dir].directory.entry[i].inode_reference;
+        if (child >= N_INODES || !FSCK_IN_USE(ck->inodes[child].type))
+            continue;
+        __atomic_add_fetch(&ck->references[child], 1, __ATOMIC_RELAXED);
+        if (ck->inodes[child].type == IT_DIRECTORY && __atomic_fetch_add(&ck->visits[child], 1, __ATOMIC_RELAXED) == 0) {
+            ck->parents[child] = dir;
+            oufs_fsck_push(ck, child);
+        }
+    }
+}
+
+/**
+ * Pass 2 thread: walk directories until the queue is empty and no other thread can add
+ * to it
+ */
+static void *oufs_fsck_walk(void *arg) {
+    OUFS_FSCK *ck = arg;
+
+    pthread_mutex_lock(&ck->lock);
+    for (;;) {
+        while (ck->queued == 0 && ck->busy > 0)
+            pthread_cond_wait(&ck->changed, &ck->lock);
+        if (ck->queued == 0)
+            break;
+        INODE_REFERENCE dir = ck->queue[--ck->queued];
+        ck->busy++;
+        pthread_mutex_unlock(&ck->lock);
+
+        oufs_fsck_directory(ck, dir);
+
+        pthread_mutex_lock(&ck->lock);
+        if (--ck->busy == 0)
+            pthread_cond_broadcast(&ck->changed);
+    }
+    pthread_mutex_unlock(&ck->lock);
+    return (NULL);
+}
+
+/**
+ * Run one pass on a pool of threads
+ *
+ * @param body The thread body
+ * @param n_threads The number of threads
+ */
+static void oufs_fsck_run(OUFS_FSCK *ck, void *(*body)(void *), int n_threads) {
+    pthread_t threads[MAX_FSCK_THREADS];
+
+    for (int t = 0; t < n_threads; ++t)
+        pthread_create(&threads[t], NULL, body, ck);
+    for (int t = 0; t < n_threads; ++t)
+        pthread_join(threads[t], NULL);
+}
+
+/**
+ * Pass 3, directories: check the . and .. entries, the entries naming free inodes or
+ * a directory that is linked elsewhere, and the entry count
+ *
+ * @param dir A directory reached by the walk
+ * @param inodesChanged Marks the directory's inode when it is fixed
+ * @param dirsChanged Marks the directory's block when it is fixed
+ */
+static void oufs_fsck_check_directory(OUFS_FSCK *ck, INODE_REFERENCE dir, unsigned char *inodesChanged,
+                                      unsigned char *dirsChanged) {
+    INODE *inode = &ck->inodes[dir];
+    DIRECTORY_ENTRY *entry = ck->directories[dir].directory.entry;
+    INODE_REFERENCE parent = (dir == 0) ? 0 : ck->parents[dir];
+    int used = 0;
+
+    if (!BLOCK_IS_MAPPED(inode->data[0]) || !FSCK_DATA_BLOCK(inode->data[0])) {
+        oufs_fsck_problem(ck, 0, "directory %d: no directory block (%d)", dir, inode->data[0]);
+        return;
+    }
+
+    if ((entry[0].inode_reference != dir || strcmp(entry[0].name, ".") != 0)
+        && oufs_fsck_problem(ck, 1, "directory %d: . names inode %d", dir, entry[0].inode_reference)) {
+        strncpy(entry[0].name, ".", FILE_NAME_SIZE);
+        entry[0].inode_reference = dir;
+        SET_BIT(dirsChanged, dir);
+    }
+    if ((entry[1].inode_reference != parent || strcmp(entry[1].name, "..") != 0)
+        && oufs_fsck_problem(ck, 1, "directory %d: .. names inode %d, not %d", dir, entry[1].inode_reference, parent)) {
+        strncpy(entry[1].name, "..", FILE_NAME_SIZE);
+        entry[1].inode_reference = parent;
+        SET_BIT(dirsChanged, dir);
+    }
+
+    for (int i = 0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+        INODE_REFERENCE child = entry[i].inode_reference;
+        if (child == UNALLOCATED_INODE) {
+            // A free entry keeps no name, or it would still be listed
+            if (entry[i].name[0] != 0 && oufs_fsck_problem(ck, 1, "directory %d: free entry %.*s has a name", dir,
+                                                           (int) FILE_NAME_SIZE, entry[i].name)) {
+                oufs_clean_directory_entry(&entry[i]);
+                SET_BIT(dirsChanged, dir);
+            }
+            continue;
+        }
+        if (i >= 2 && (child >= N_INODES || !FSCK_IN_USE(ck->inodes[child].type))) {
+            if (oufs_fsck_problem(ck, 1, "directory %d: %.*s names free inode %d", dir, (int) FILE_NAME_SIZE,
+                                  entry[i].name, child)) {
+                oufs_clean_directory_entry(&entry[i]);
+                SET_BIT(dirsChanged, dir);
+            }
+            continue;
+        }
+        if (i >= 2 && ck->inodes[child].type == IT_DIRECTORY && ck->parents[child] != dir) {
+            if (oufs_fsck_problem(ck, 1, "directory %d: %.*s is another link to directory %d", dir,
+                                  (int) FILE_NAME_SIZE, entry[i].name, child)) {
+                oufs_clean_directory_entry(&entry[i]);
+                ck->references[child]--;
+                SET_BIT(dirsChanged, dir);
+                continue;
+            }
+        }
+        used++;
+    }
+
+    if (inode->size != used && oufs_fsck_problem(ck, 1, "directory %d: size %u, %d entries", dir, inode->size, used)) {
+        inode->size = used;
+        SET_BIT(inodesChanged, dir);
+    }
+}
+
+/**
+ * Pass 3: compare the counts with the tables and fix what differs
+ *
+ * @param inodesChanged Marks each inode that is fixed
+ * @param dirsChanged Marks each directory whose block is fixed
+ */
+static void oufs_fsck_check(OUFS_FSCK *ck, unsigned char *inodesChanged, unsigned char *dirsChanged) {
+    MASTER_BLOCK *master = &ck->master.master;
+
+    // A directory reached through several entries keeps the one its .. agrees with, if
+    //  any, rather than whichever thread got there first
+    for (INODE_REFERENCE d = 1; d < N_INODES; ++d) {
+        INODE_REFERENCE up = ck->directories[d].directory.entry[1].inode_reference;
+        if (ck->visits[d] < 2 || up >= N_INODES || ck->visits[up] == 0)
+            continue;
+        for (int i = 2; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
+            if (ck->directories[up].directory.entry[i].inode_reference == d)
+                ck->parents[d] = up;
+        }
+    }
+
+    for (INODE_REFERENCE d = 0; d < N_INODES; ++d) {
+        if (ck->visits[d] > 0)
+            oufs_fsck_check_directory(ck, d, inodesChanged, dirsChanged);
+    }
+
+    // Inode table: in use exactly when reachable and allocated exactly when in use,
+    //  referenced as often as it says
+    for (INODE_REFERENCE i = 0; i < N_INODES; ++i) {
+        INODE *inode = &ck->inodes[i];
+        int inUse = FSCK_IN_USE(inode->type);
+
+        if (!inUse && inode->type != IT_NONE
+            && oufs_fsck_problem(ck, 1, "inode %d: unknown type %d", i, inode->type)) {
+            oufs_inode_reset(inode);
+            SET_BIT(inodesChanged, i);
+        }
+        if (inUse && i != 0 && ck->references[i] == 0
+            && oufs_fsck_problem(ck, 1, "inode %d: %c, not in any directory", i, inode->type)) {
+            // Leaked: release its blocks along with it
+            for (int j = 0; j < BLOCKS_PER_INODE; ++j) {
+                if (BLOCK_IS_MAPPED(inode->data[j]) && FSCK_DATA_BLOCK(inode->data[j]))
+                    ck->owners[BLOCK_INDEX(inode->data[j])]--;
+                inode->data[j] = UNALLOCATED_BLOCK;
+            }
+            oufs_inode_reset(inode);
+            SET_BIT(inodesChanged, i);
+            inUse = 0;
+        }
+        if (GET_BIT(master->inode_allocated_flag, i) != inUse
+            && oufs_fsck_problem(ck, 1, "inode %d: allocation bit %d, type %c", i,
+                                 GET_BIT(master->inode_allocated_flag, i), inode->type)) {
+            if (inUse)
+                SET_BIT(master->inode_allocated_flag, i);
+            else
+                RESET_BIT(master->inode_allocated_flag, i);
+        }
+        if (!inUse)
+            continue;
+
+        int references = (i == 0) ? 1 : ck->references[i];
+        if (inode->n_references != references
+            && oufs_fsck_problem(ck, 1, "inode %d: n_references %d, %d entries", i, inode->n_references, references)) {
+            inode->n_references = references;
+            SET_BIT(inodesChanged, i);
+        }
+        for (int j = 0; j < BLOCKS_PER_INODE; ++j) {
+            if (!BLOCK_IS_MAPPED(inode->data[j]) || FSCK_DATA_BLOCK(inode->data[j]) || (j == 0 && inode->type == IT_DIRECTORY))
+                continue;
+            if (oufs_fsck_problem(ck, 1, "inode %d: block %d is not a data block", i, inode->data[j])) {
+                inode->data[j] = (inode->type == IT_DIRECTORY) ? UNALLOCATED_BLOCK : HOLE_BLOCK;
+                SET_BIT(inodesChanged, i);
+            }
+        }
+    }
+
+    // Block table: allocated exactly when owned, shared by all but the first owner.  An
+    //  image formatted before the share counts existed has no valid counts to compare
+    if (master->share_magic != MASTER_SHARE_MAGIC) {
+        oufs_fsck_problem(ck, 1, "master block: no share counts (formatted by an older zformat)");
+        memset(master->block_share_count, 0, sizeof(master->block_share_count));
+        master->share_magic = MASTER_SHARE_MAGIC;
+    }
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        int owned = (b <= N_INODE_BLOCKS || ck->owners[b] > 0);
+        int shares = (ck->owners[b] > 1) ? ck->owners[b] - 1 : 0;
+
+        if (GET_BIT(master->block_allocated_flag, b) != owned
+            && oufs_fsck_problem(ck, 1, "block %d: allocation bit %d, %d owners", b,
+                                 GET_BIT(master->block_allocated_flag, b), ck->owners[b])) {
+            if (owned)
+                SET_BIT(master->block_allocated_flag, b);
+            else
+                RESET_BIT(master->block_allocated_flag, b);
+        }
+        if (master->block_share_count[b] != shares
+            && oufs_fsck_problem(ck, shares <= UCHAR_MAX, "block %d: share count %d, %d owners", b,
+                                 master->block_share_count[b], ck->owners[b])) {
+            master->block_share_count[b] = shares;
+        }
+    }
+}
+
+/**
+ * Write every fix in one transaction
+ *
+ * @param inodesChanged The inodes to write
+ * @param dirsChanged The directories whose block to write
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the fixes could not be written
+ */
+static int oufs_fsck_write(OUFS_FSCK *ck, unsigned char *inodesChanged, unsigned char *dirsChanged) {
+    BLOCK inodeBlock;
+
+    if (oufs_txn_begin_r(ck->fs) != 0)
+        return (EXIT_FAILURE);
+    vdisk_write_block_r(ck->fs->disk, MASTER_BLOCK_REFERENCE, &ck->master);
+    for (int b = 1; b <= N_INODE_BLOCKS; ++b) {
+        int changed = 0;
+        vdisk_read_block_r(ck->fs->disk, b, &inodeBlock);
+        for (int e = 0; e < INODES_PER_BLOCK; ++e) {
+            INODE_REFERENCE i = (b - 1) * INODES_PER_BLOCK + e;
+            if (GET_BIT(inodesChanged, i)) {
+                inodeBlock.inodes.inode[e] = ck->inodes[i];
+                changed = 1;
+            }
+        }
+        if (changed)
+            vdisk_write_block_r(ck->fs->disk, b, &inodeBlock);
+    }
+    for (INODE_REFERENCE d = 0; d < N_INODES; ++d) {
+        if (GET_BIT(dirsChanged, d))
+            vdisk_write_block_r(ck->fs->disk, BLOCK_INDEX(ck->inodes[d].data[0]), &ck->directories[d]);
+    }
+    int status = oufs_txn_commit_r(ck->fs);
+
+    // Blocks may have been freed or gained owners behind the deduplication index
+    ck->fs->dedup_index_built = 0;
+    return (status);
+}
+
+/**
+ * Check the file system for consistency, and optionally repair it
+ *
+ * Checks that the inode and block allocation tables match the inodes in use and the
+ * blocks they map, that each link count matches the entries naming the inode, that each
+ * directory's size matches its entries and that . and .. name the right directories.
+ * Each problem found is printed on a line of its own.  Inodes that no directory names are
+ * freed along with their blocks by a repair.
+ *
+ * @param n_threads The number of threads to read the disk with
+ * @param repair 1 to write the fixes to the disk, 0 to only report the problems
+ * @param problems Filled in with the number of problems found
+ * @param repaired Filled in with the number of those that were fixed
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the disk could not be read or the fixes
+ *         written
+ */
+int oufs_fsck_r(OUFS *fs, int n_threads, int repair, int *problems, int *repaired) {
+    unsigned char inodesChanged[N_INODES >> 3] = {0};
+    unsigned char dirsChanged[N_INODES >> 3] = {0};
+    int status = EXIT_SUCCESS;
+
+    OUFS_FSCK *ck = calloc(1, sizeof(OUFS_FSCK));
+    if (ck == NULL) {
+        fprintf(stderr, "Not enough memory to check the file system\n");
+        return (EXIT_FAILURE);
+    }
+    ck->fs = fs;
+    ck->repair = repair;
+    pthread_mutex_init(&ck->lock, NULL);
+    pthread_cond_init(&ck->changed, NULL);
+    n_threads = MAX(1, MIN(n_threads, MAX_FSCK_THREADS));
+
+    if (vdisk_read_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &ck->master) != 0)
+        ck->failed = 1;
+    oufs_fsck_run(ck, oufs_fsck_scan, n_threads);
+
+    if (ck->failed) {
+        fprintf(stderr, "Could not read the inode table\n");
+        status = EXIT_FAILURE;
+    } else if (ck->inodes[0].type != IT_DIRECTORY) {
+        oufs_fsck_problem(ck, 0, "inode 0: type %c, not the root directory", ck->inodes[0].type);
+    } else {
+        // Walk the tree from the root, then compare
+        ck->visits[0] = 1;
+        ck->queue[ck->queued++] = 0;
+        oufs_fsck_run(ck, oufs_fsck_walk, n_threads);
+        if (ck->failed) {
+            fprintf(stderr, "Could not read the directory tree\n");
+            status = EXIT_FAILURE;
+        } else {
+            oufs_fsck_check(ck, inodesChanged, dirsChanged);
+            if (ck->repaired > 0)
+                status = oufs_fsck_write(ck, inodesChanged, dirsChanged);
+        }
+    }
+
+    if (debug)
+        fprintf(stderr, "Checked with %d threads: %d problems\n", n_threads, ck->problems);
+
+    *problems = ck->problems;
+    *repaired = (status == EXIT_SUCCESS) ? ck->repaired : 0;
+    pthread_cond_destroy(&ck->changed);
+    pthread_mutex_destroy(&ck->lock);
+    free(ck);
+    return (status);
+}
+
+/*
+ * Compatibility wrapper: the original interface, on the default file system
+ */
+
+int oufs_fsck(int n_threads, int repair, int *problems, int *repaired) {
+    return (oufs_fsck_r(oufs_default(), n_threads, repair, problems, repaired));
+}
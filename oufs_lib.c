@@ -1,29 +1,45 @@
 #include "oufs_lib.h"
+#include "oufs_lz4.h"
 
 #define debug 0
+
+static int oufs_flush(OUFILE *fp);
+static int oufs_truncate(OUFILE *fp, int size);
 /**
  * Function that formats the virtual disk per the specification given in oufs.h
  *
  * @param virtual_disk_name the name of the virtual disk.
  * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_format_disk(char *virtual_disk_name) {
+int oufs_format_disk_r(OUFS *fs, char *virtual_disk_name) {
 
-    if (vdisk_disk_open(virtual_disk_name) != 0) {
+    if (vdisk_disk_open_r(fs->disk, virtual_disk_name, oufs_get_durability()) != 0) {
         fprintf(stderr, "oufs_format_disk: Error opening disk or another disk already opened.\n");
         //return(EXIT_FAILURE);
     }
+    /****************** Drop snapshots of the previous file system ********************/
+    char snapshots[VDISK_MAX_SNAPSHOTS][VDISK_SNAPSHOT_NAME_SIZE];
+    int nSnapshots = vdisk_snapshot_list_r(fs->disk, snapshots, VDISK_MAX_SNAPSHOTS);
+    for (int i = 0; i < nSnapshots; i++) {
+        vdisk_snapshot_delete_r(fs->disk, snapshots[i]);
+    }
+
+    //The new file system is written as one transaction.
+    oufs_txn_begin_r(fs);
+
     /************************** Write zeroes to entire disk *****************************/
     DATA_BLOCK zero_block;
     memset(zero_block.data, 0, 256);
     for (int j = 0; j < 128; j++) {
-        vdisk_write_block(j, &zero_block);
+        vdisk_write_block_r(fs->disk, j, &zero_block);
     }
 
     /*********************************** Block Setup ***********************************/
 
     //Set up master block
     BLOCK mblock;
+    memset(&mblock, 0, sizeof(mblock));
+    mblock.master.share_magic = MASTER_SHARE_MAGIC;
     SET_BIT(mblock.master.block_allocated_flag, MASTER_BLOCK_REFERENCE);
 
     //Mark inode block???????
@@ -44,7 +60,7 @@ int oufs_format_disk(char *virtual_disk_name) {
 
     // Write unallocated inode blocks and set the bits in the master block to be written later.
     for (int i = 1; i <= N_INODE_BLOCKS; i++) {
-        vdisk_write_block(i, &iblock);
+        vdisk_write_block_r(fs->disk, i, &iblock);
         SET_BIT(mblock.master.block_allocated_flag, i);
     }
 
@@ -53,7 +69,7 @@ int oufs_format_disk(char *virtual_disk_name) {
     iblock.inodes.inode[0].size = 2;
     iblock.inodes.inode[0].data[0] = 9;
 
-    vdisk_write_block(1, &iblock);
+    vdisk_write_block_r(fs->disk, 1, &iblock);
     //Create blank directory block.
     BLOCK dirBlock;
 
@@ -71,18 +87,19 @@ int oufs_format_disk(char *virtual_disk_name) {
     }
 
     //Write root directory block.
-    vdisk_write_block(N_INODE_BLOCKS+1, &dirBlock);
+    vdisk_write_block_r(fs->disk, N_INODE_BLOCKS+1, &dirBlock);
     SET_BIT(mblock.master.block_allocated_flag, N_INODE_BLOCKS+1);
 
     //Write Master Block
-    vdisk_write_block(MASTER_BLOCK_REFERENCE, &mblock);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &mblock);
+    int status = oufs_txn_commit_r(fs);
 
     if(debug)
         fprintf(stderr, "Disk successfully formatted.\n");
 
-    vdisk_disk_close();
+    vdisk_disk_close_r(fs->disk);
 
-    return EXIT_SUCCESS;
+    return status;
 }
 /**
  * Function to make new directories in the OUFS file system.
@@ -90,56 +107,68 @@ int oufs_format_disk(char *virtual_disk_name) {
  * @param path the user given path of the directory to be made.
  * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_mkdir(char *cwd, char *path) {
+int oufs_mkdir_r(OUFS *fs, char *cwd, char *path) {
     INODE_REFERENCE child, parent;
     char local_name[FILE_NAME_SIZE];
 
     //Find where the directory should be located.
-    if(oufs_find_file(cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
+    if(oufs_find_file_r(fs, cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
     {
         fprintf(stderr, "Unable to traverse CWD or provided path.\n");
         return EXIT_FAILURE;
     }
 
+    //The parent stays locked until the new entry is written.
     INODE parentINODE;
-    oufs_read_inode_by_reference(parent, &parentINODE); //Read parent inode
+    oufs_lock_inode_r(fs, parent, 1);
+    oufs_read_inode_by_reference_r(fs, parent, &parentINODE); //Read parent inode
+    if(parentINODE.type != IT_DIRECTORY)
+    {
+        fprintf(stderr, "The specified parent no longer exists.\n");
+        oufs_unlock_inode_r(fs, parent);
+        return EXIT_FAILURE;
+    }
     if(parentINODE.size >= DIRECTORY_ENTRIES_PER_BLOCK)
     {
         fprintf(stderr, "The specified parent is already full.\n");
+        oufs_unlock_inode_r(fs, parent);
         return EXIT_FAILURE;
     }
 
     BLOCK parentBlock;
-    vdisk_read_block(parentINODE.data[0], &parentBlock); //Read parent parentBlock from inode reference
+    vdisk_read_block_r(fs->disk, parentINODE.data[0], &parentBlock); //Read parent parentBlock from inode reference
 
     for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
     {
         if(strncmp(parentBlock.directory.entry[i].name, local_name, FILE_NAME_SIZE) == 0){
             //TODO: Support file and directory with same name.
             fprintf(stderr, "directory '%s' already exists\n", local_name);
+            oufs_unlock_inode_r(fs, parent);
             return EXIT_FAILURE;
         }
     }
 
     // Create the directory in the current parentBlock.
 
-    // Find an open inode, read master parentBlock and search.
+    // Find an open inode, read master parentBlock and search.  The master block is read and
+    //  written inside the transaction, which only one thread has open at a time.
     BLOCK masterBlock;
-    vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBlock);
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &masterBlock);
 
-    int openINODE = oufs_find_open_bit(masterBlock.master.inode_allocated_flag);
-    int openBLOCK = oufs_find_open_bit(masterBlock.master.block_allocated_flag);
+    // The directory's inode and block come from the allocation group chosen for it.
+    int group = oufs_directory_group(&masterBlock, parent);
+    int openINODE = oufs_allocate_inode(&masterBlock, group);
+    BLOCK_REFERENCE openBLOCK;
 
-    if((openBLOCK == -1) || (openINODE == -1))
+    if((openINODE == -1) || oufs_allocate_block_run(&masterBlock, GROUP_FIRST_BLOCK(group), 1, &openBLOCK) != 0)
     {
         fprintf(stderr, "Either out of open inodes or blocks.\n");
+        oufs_txn_abort_r(fs);
+        oufs_unlock_inode_r(fs, parent);
         return EXIT_FAILURE;
     }
 
-    // Mark bits as allocated
-    SET_BIT(masterBlock.master.inode_allocated_flag, openINODE);
-    SET_BIT(masterBlock.master.block_allocated_flag, openBLOCK);
-
     for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
     {
         if(strncmp(parentBlock.directory.entry[i].name, "", FILE_NAME_SIZE) == 0)
@@ -178,14 +207,80 @@ int oufs_mkdir(char *cwd, char *path) {
         newDBLOCK.directory.entry[i].inode_reference = UNALLOCATED_INODE;
     }
 
-    //Write back the approprite blocks and inodes.
-    vdisk_write_block(parentINODE.data[0], &parentBlock);
-    vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBlock);
-    oufs_write_inode_by_reference(openINODE, &newINODE);
-    oufs_write_inode_by_reference(parent, &parentINODE);
-    vdisk_write_block(openBLOCK, &newDBLOCK);
+    //Write back the approprite blocks and inodes as one transaction.
+    vdisk_write_block_r(fs->disk, parentINODE.data[0], &parentBlock);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+    oufs_write_inode_by_reference_r(fs, openINODE, &newINODE);
+    oufs_write_inode_by_reference_r(fs, parent, &parentINODE);
+    vdisk_write_block_r(fs->disk, openBLOCK, &newDBLOCK);
 
-    return EXIT_SUCCESS;
+    int status = oufs_txn_commit_r(fs);
+    oufs_unlock_inode_r(fs, parent);
+    return status;
+}
+/**
+ * Checks for the "." and ".." entries, which name a directory's own inode or its parent's.
+ * Operations on an entry lock the directory and then the entry, so these cannot be their target.
+ * @param name the name of the entry.
+ * @return 1 if name is "." or "..", otherwise 0.
+ */
+static int oufs_is_dot_entry(char *name)
+{
+    return strncmp(name, ".", FILE_NAME_SIZE) == 0 || strncmp(name, "..", FILE_NAME_SIZE) == 0;
+}
+/**
+ * Reads an inode and, if it is a directory, its directory block.  The reads are done without
+ * locking and kept if no thread locked the inode exclusively meanwhile; otherwise they are
+ * done again under a shared lock.
+ * @param ref the inode to be read.
+ * @param inode receives the inode.
+ * @param block receives the directory block.
+ * @return 1 if the inode is a directory, otherwise 0 (block is not loaded).
+ */
+static int oufs_read_directory(OUFS *fs, INODE_REFERENCE ref, INODE *inode, BLOCK *block)
+{
+    unsigned int version = (ref < N_INODES) ? __atomic_load_n(&fs->inode_version[ref], __ATOMIC_ACQUIRE) : 1;
+    if((version & 1) == 0)
+    {
+        oufs_read_inode_by_reference_r(fs, ref, inode);
+        int isDirectory = ((*inode).type == IT_DIRECTORY);
+        if(isDirectory)
+            vdisk_read_block_r(fs->disk, (*inode).data[0], block);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&fs->inode_version[ref], __ATOMIC_RELAXED) == version)
+            return isDirectory;
+    }
+
+    oufs_lock_inode_r(fs, ref, 0);
+    oufs_read_inode_by_reference_r(fs, ref, inode);
+    int isDirectory = ((*inode).type == IT_DIRECTORY);
+    if(isDirectory)
+        vdisk_read_block_r(fs->disk, (*inode).data[0], block);
+    oufs_unlock_inode_r(fs, ref);
+    return isDirectory;
+}
+/**
+ * Looks up a name in a directory.  The caller holds a lock on the directory.
+ * @param dir the directory to search.
+ * @param name the name of the entry.
+ * @param dirINODE receives the inode of the directory.
+ * @param dirBLOCK receives the directory block.
+ * @return the inode of the entry, or UNALLOCATED_INODE if there is none (or dir is no longer a directory).
+ */
+static INODE_REFERENCE oufs_lookup_entry(OUFS *fs, INODE_REFERENCE dir, char *name, INODE *dirINODE, BLOCK *dirBLOCK)
+{
+    if(dir >= N_INODES)
+        return UNALLOCATED_INODE;
+    oufs_read_inode_by_reference_r(fs, dir, dirINODE);
+    if((*dirINODE).type != IT_DIRECTORY)
+        return UNALLOCATED_INODE;
+    vdisk_read_block_r(fs->disk, (*dirINODE).data[0], dirBLOCK);
+    for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i)
+    {
+        if(strncmp((*dirBLOCK).directory.entry[i].name, name, FILE_NAME_SIZE) == 0)
+            return (*dirBLOCK).directory.entry[i].inode_reference;
+    }
+    return UNALLOCATED_INODE;
 }
 /**
  * Function used to traverse the file structure one token at a time to find a given file or directoyr.
@@ -196,13 +291,24 @@ int oufs_mkdir(char *cwd, char *path) {
  * @param local_name the name of the final chunk of the given path.
  * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name) {
+int oufs_find_file_r(OUFS *fs, char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name) {
     int numTok = 0;
     BLOCK currentBlock;
     INODE currentINODE;
     int status = 1;
 
-    vdisk_read_block(ROOT_DIRECTORY_BLOCK, &currentBlock);
+    //Tokenizing is destructive: work on copies so callers can resolve several paths against one cwd.
+    char cwdCopy[MAX_PATH_LENGTH];
+    char pathCopy[MAX_PATH_LENGTH];
+    strncpy(cwdCopy, cwd, MAX_PATH_LENGTH-1);
+    cwdCopy[MAX_PATH_LENGTH-1] = 0;
+    strncpy(pathCopy, path, MAX_PATH_LENGTH-1);
+    pathCopy[MAX_PATH_LENGTH-1] = 0;
+    cwd = cwdCopy;
+    path = pathCopy;
+
+    //Each directory is read as one consistent copy (see oufs_read_directory); callers that change the result lock and re-check it.
+    oufs_read_directory(fs, 0, &currentINODE, &currentBlock);
     *parent = 0;
     *child = UNALLOCATED_INODE;
 
@@ -219,12 +325,10 @@ int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFEREN
             {
                 if(strncmp(tokenizedCWD[i], currentBlock.directory.entry[j].name, FILE_NAME_SIZE) == 0)
                 {
-                    oufs_read_inode_by_reference(currentBlock.directory.entry[j].inode_reference, &currentINODE);
-                    if(currentINODE.type == IT_DIRECTORY)
+                    INODE_REFERENCE entryRef = currentBlock.directory.entry[j].inode_reference;
+                    if(oufs_read_directory(fs, entryRef, &currentINODE, &currentBlock))
                     {
-                        *parent = currentBlock.directory.entry[j].inode_reference;
-                        //fprintf(stderr, "Reading block from current INODE reference.\n");
-                        vdisk_read_block(currentINODE.data[0], &currentBlock);
+                        *parent = entryRef;
                         status = 1;
                     }
                 }
@@ -234,9 +338,11 @@ int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFEREN
             if(status == 0)
             {
                 fprintf(stderr, "Unable to locate directory '%s'. CWD is likely invalid.\n", tokenizedCWD[i]);
+                free(tokenizedCWD);
                 return EXIT_FAILURE;
             }
         }
+        free(tokenizedCWD);
     }
 
     //At this point, path is either absolute, or currentBlock is at the CWD block.
@@ -251,14 +357,9 @@ int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFEREN
         for(int j=0; j < DIRECTORY_ENTRIES_PER_BLOCK; ++j) //Look through all the entries in the dirblock
         {
             if(strncmp(tokenizedPath[i], currentBlock.directory.entry[j].name, FILE_NAME_SIZE) == 0) {
-                oufs_read_inode_by_reference(currentBlock.directory.entry[j].inode_reference, &currentINODE);
-
                 *parent = currentBlock.directory.entry[j].inode_reference;
-                if(currentINODE.type == IT_DIRECTORY) {
-                    //fprintf(stderr, "Reading block from current INODE reference.\n");
-                    vdisk_read_block(currentINODE.data[0], &currentBlock);
+                if(oufs_read_directory(fs, *parent, &currentINODE, &currentBlock))
                     status = 1;
-                }
             }
             if(status == 1)
                 break;
@@ -266,11 +367,13 @@ int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFEREN
         if(status == 0) {
             fprintf(stderr, "Unable to locate directory or file '%s'.\n", tokenizedPath[i]);
             *parent = UNALLOCATED_INODE;
+            free(tokenizedPath);
             return EXIT_FAILURE;
         }
     }
 
-    strncpy(local_name, tokenizedPath[pathNumTok-1], FILE_NAME_SIZE-1);
+    //A path with no names ("/") is the directory itself.
+    strncpy(local_name, (pathNumTok > 0) ? tokenizedPath[pathNumTok-1] : ".", FILE_NAME_SIZE-1);
     for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; ++i) {
         if (strncmp(currentBlock.directory.entry[i].name, local_name, FILE_NAME_SIZE) == 0) {
             (*child) = currentBlock.directory.entry[i].inode_reference;
@@ -278,16 +381,34 @@ int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFEREN
         }
     }
 
+    free(tokenizedPath);
     return EXIT_SUCCESS;
 }
+// One entry of a listing: its name and inode, sorted by name
+typedef struct list_entry_s {
+    char *name;
+    INODE_REFERENCE inode;
+} LIST_ENTRY;
+
 /**
- * Command similar to 'ls' but for OUFS. Lists files in ASCII order.
- *
+ * Orders listing entries by name (ASCII order).
+ * @param p1 value one
+ * @param p2 value two
+ */
+static int oufs_cmp_list_entry(const void *p1, const void *p2)
+{
+    return strncmp((*(LIST_ENTRY *) p1).name, (*(LIST_ENTRY *) p2).name, FILE_NAME_SIZE);
+}
+/**
+ * Lists a directory in ASCII order, optionally with the type, link count and size of each entry.
+ * The (name, inode) pairs are sorted together, and the inodes are read by inode block: each
+ * distinct inode block is read once, whatever the number of entries in it.
  * @param cwd input of the current working directory.
  * @param path input of the program specified path.
+ * @param longFormat 1 = print the type, link count and size of each entry.
  * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_list(char *cwd, char *path)
+static int oufs_list_directory(OUFS *fs, char *cwd, char *path, int longFormat)
 {
     INODE_REFERENCE child, parent;
     INODE parentINODE;
@@ -297,15 +418,14 @@ int oufs_list(char *cwd, char *path)
     char local_name[FILE_NAME_SIZE];
 
     //Find where the directory should be located.
-    if(oufs_find_file(cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
+    if(oufs_find_file_r(fs, cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
     {
         fprintf(stderr, "Unable to traverse CWD or provided path.\n");
         return EXIT_FAILURE;
     }
 
     //Read parent inode and block.
-    oufs_read_inode_by_reference(parent, &parentINODE);
-    vdisk_read_block(parentINODE.data[0], &parentBLOCK);
+    oufs_read_directory(fs, parent, &parentINODE, &parentBLOCK);
 
     INODE childINODE;
     BLOCK childBLOCK;
@@ -317,8 +437,6 @@ int oufs_list(char *cwd, char *path)
             //TODO: Support file and directory with same name.
             //fprintf(stderr, "Found local_name '%s' in parent block.\n", local_name);
             child = parentBLOCK.directory.entry[locationInParent].inode_reference;
-            oufs_read_inode_by_reference(parentBLOCK.directory.entry[locationInParent].inode_reference, &childINODE);
-
             childStatus = 1;
             break;
         }
@@ -329,40 +447,203 @@ int oufs_list(char *cwd, char *path)
         fprintf(stderr, "Specified directory (%s) not found in parent. Exiting...\n", local_name);
         return EXIT_FAILURE;
     }
-    vdisk_read_block(childINODE.data[0], &childBLOCK);
 
-    char* itemList[DIRECTORY_ENTRIES_PER_BLOCK];
-    char* typeList[DIRECTORY_ENTRIES_PER_BLOCK];
-    size_t listInc = 0;
-    INODE checkingINODE;
+    //The listed directory is read under a shared lock.
+    oufs_lock_inode_r(fs, child, 0);
+    oufs_read_inode_by_reference_r(fs, child, &childINODE);
+    if(childINODE.type == IT_DIRECTORY)
+        vdisk_read_block_r(fs->disk, childINODE.data[0], &childBLOCK);
 
-    for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++) {
-        if(strnlen(childBLOCK.directory.entry[i].name, FILE_NAME_SIZE) > 0) {
-            itemList[listInc] = childBLOCK.directory.entry[i].name;
+    LIST_ENTRY itemList[DIRECTORY_ENTRIES_PER_BLOCK];
+    size_t listInc = 0;
 
-            listInc++;
+    //A file is listed by itself.
+    if(childINODE.type != IT_DIRECTORY) {
+        itemList[listInc].name = local_name;
+        itemList[listInc].inode = child;
+        listInc++;
+    }
+    else {
+        for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++) {
+            if(strnlen(childBLOCK.directory.entry[i].name, FILE_NAME_SIZE) > 0) {
+                itemList[listInc].name = childBLOCK.directory.entry[i].name;
+                itemList[listInc].inode = childBLOCK.directory.entry[i].inode_reference;
+                listInc++;
+            }
         }
     }
 
-    qsort(itemList, listInc, sizeof(char*), cmpstringp);
+    qsort(itemList, listInc, sizeof(LIST_ENTRY), oufs_cmp_list_entry);
 
-    for(int i=0; i < listInc; ++i) {
-        for(int j=0; j < DIRECTORY_ENTRIES_PER_BLOCK; j++) {
-            if(strncmp(childBLOCK.directory.entry[j].name, itemList[i], FILE_NAME_SIZE) == 0) {
-                oufs_read_inode_by_reference(childBLOCK.directory.entry[j].inode_reference, &childINODE);
+    //Inode blocks, each read the first time an entry needs it.
+    BLOCK inodeBLOCKS[N_INODE_BLOCKS];
+    int loaded[N_INODE_BLOCKS] = {0};
 
-                if(childINODE.type == IT_FILE) {
-                    printf("%s\n", itemList[i]);
-                }
-                else {
-                    printf("%s/\n", itemList[i]);
-                }
-                break;
+    for(int i=0; i < listInc; ++i) {
+        if(itemList[i].inode >= N_INODES) {
+            fprintf(stderr, "Entry '%s' has an invalid inode (%d).\n", itemList[i].name, itemList[i].inode);
+            continue;
+        }
+        int inodeBlock = itemList[i].inode / INODES_PER_BLOCK;
+        if(!loaded[inodeBlock]) {
+            if(vdisk_read_block_r(fs->disk, inodeBlock + 1, &inodeBLOCKS[inodeBlock]) != 0) {
+                oufs_unlock_inode_r(fs, child);
+                return EXIT_FAILURE;
             }
+            loaded[inodeBlock] = 1;
         }
+        INODE *entryINODE = &inodeBLOCKS[inodeBlock].inodes.inode[itemList[i].inode % INODES_PER_BLOCK];
+
+        char *suffix = IS_FILE_TYPE((*entryINODE).type) ? "" : "/";
+        if(longFormat)
+            printf("%c %3d %5u %s%s\n", (*entryINODE).type, (*entryINODE).n_references, (*entryINODE).size, itemList[i].name, suffix);
+        else
+            printf("%s%s\n", itemList[i].name, suffix);
     }
+    oufs_unlock_inode_r(fs, child);
     return EXIT_SUCCESS;
 }
+/**
+ * Command similar to 'ls' but for OUFS. Lists files in ASCII order.
+ *
+ * @param cwd input of the current working directory.
+ * @param path input of the program specified path.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_list_r(OUFS *fs, char *cwd, char *path)
+{
+    return oufs_list_directory(fs, cwd, path, 0);
+}
+/**
+ * Command similar to 'ls -l' but for OUFS. Lists files in ASCII order, each with its type
+ * (IT_DIRECTORY, IT_FILE or IT_COMPRESSED_FILE), link count and size.
+ *
+ * @param cwd input of the current working directory.
+ * @param path input of the program specified path.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_list_long_r(OUFS *fs, char *cwd, char *path)
+{
+    return oufs_list_directory(fs, cwd, path, 1);
+}
+
+/**
+ * Opens a directory for reading its entries one at a time (oufs_readdir).
+ * @param cwd input of the current working directory.
+ * @param path input of the program specified path.
+ * @return the open directory, or NULL if path is not a directory
+ */
+OUDIR *oufs_opendir_r(OUFS *fs, char *cwd, char *path)
+{
+    INODE_REFERENCE parent, child;
+    INODE childINODE;
+    char local_name[FILE_NAME_SIZE];
+
+    if(oufs_find_file_r(fs, cwd, path, &parent, &child, local_name) != EXIT_SUCCESS || child == UNALLOCATED_INODE
+       || child >= N_INODES || oufs_read_inode_by_reference_r(fs, child, &childINODE) != 0
+       || childINODE.type != IT_DIRECTORY)
+    {
+        fprintf(stderr, "oufs_opendir: '%s' is not a directory.\n", path);
+        return NULL;
+    }
+
+    OUDIR *dp = malloc(sizeof(OUDIR));
+    if(dp == NULL)
+        return NULL;
+    (*dp).fs = fs;
+    (*dp).inode_reference = child;
+    (*dp).position = 0;
+    (*dp).block_index = -1;
+    return dp;
+}
+/**
+ * Reads one block of an open directory under a shared lock, along with the version of the
+ * directory it belongs to.  A block the directory does not have reads as empty.
+ * @param dp the open directory.
+ * @param blockIndex the index of the block in the directory's data.
+ * @return 0 on success, -1 if the directory is gone
+ */
+static int oufs_dir_load(OUDIR *dp, int blockIndex)
+{
+    OUFS *fs = (*dp).fs;
+    INODE dirINODE;
+    int status = 0;
+
+    oufs_lock_inode_r(fs, (*dp).inode_reference, 0);
+    (*dp).block_version = __atomic_load_n(&fs->inode_version[(*dp).inode_reference], __ATOMIC_RELAXED);
+    if(oufs_read_inode_by_reference_r(fs, (*dp).inode_reference, &dirINODE) != 0 || dirINODE.type != IT_DIRECTORY)
+        status = -1;
+    else if(dirINODE.data[blockIndex] == UNALLOCATED_BLOCK || dirINODE.data[blockIndex] == HOLE_BLOCK)
+        oufs_clear_dblock(&(*dp).block);
+    else if(vdisk_read_block_r(fs->disk, dirINODE.data[blockIndex], &(*dp).block) != 0)
+        status = -1;
+    oufs_unlock_inode_r(fs, (*dp).inode_reference);
+
+    (*dp).block_index = (status == 0) ? blockIndex : -1;
+    return status;
+}
+/**
+ * Returns the next entry of an open directory ("." and ".." included).  Only the block under
+ * the cursor is kept, so memory does not grow with the directory.  The cursor holds no lock:
+ * the block is read again if the directory changed since it was read, and an entry added or
+ * removed behind the cursor may or may not be returned.
+ * @param dp the open directory.
+ * @return the entry, valid until the next call, or NULL at the end of the directory
+ */
+OUDIRENT *oufs_readdir(OUDIR *dp)
+{
+    OUFS *fs = (*dp).fs;
+    INODE entryINODE;
+
+    while((*dp).position < BLOCKS_PER_INODE * DIRECTORY_ENTRIES_PER_BLOCK)
+    {
+        int blockIndex = (*dp).position / DIRECTORY_ENTRIES_PER_BLOCK;
+        if(blockIndex != (*dp).block_index
+           || __atomic_load_n(&fs->inode_version[(*dp).inode_reference], __ATOMIC_ACQUIRE) != (*dp).block_version)
+        {
+            if(oufs_dir_load(dp, blockIndex) != 0)
+                return NULL;
+        }
+
+        DIRECTORY_ENTRY *entry = &(*dp).block.directory.entry[(*dp).position % DIRECTORY_ENTRIES_PER_BLOCK];
+        (*dp).position++;
+        if((*entry).inode_reference >= N_INODES || strnlen((*entry).name, FILE_NAME_SIZE) == 0)
+            continue;
+
+        strncpy((*dp).entry.name, (*entry).name, FILE_NAME_SIZE-1);
+        (*dp).entry.name[FILE_NAME_SIZE-1] = 0;
+        (*dp).entry.inode_reference = (*entry).inode_reference;
+        (*dp).entry.type = (oufs_read_inode_by_reference_r(fs, (*entry).inode_reference, &entryINODE) == 0) ? entryINODE.type : IT_NONE;
+        return &(*dp).entry;
+    }
+    return NULL;
+}
+/**
+ * Returns the cursor of an open directory, to resume from later with oufs_seekdir.
+ * @param dp the open directory.
+ * @return the position of the next entry
+ */
+int oufs_telldir(OUDIR *dp)
+{
+    return (*dp).position;
+}
+/**
+ * Moves the cursor of an open directory.
+ * @param dp the open directory.
+ * @param position a position returned by oufs_telldir (0 = the first entry).
+ */
+void oufs_seekdir(OUDIR *dp, int position)
+{
+    (*dp).position = MAX(0, position);
+}
+/**
+ * Closes an open directory.
+ * @param dp the open directory.
+ */
+void oufs_closedir(OUDIR *dp)
+{
+    free(dp);
+}
 
 /**
  * Finds the first open bit in a given char.
@@ -391,13 +672,14 @@ char **oufs_path_parse(char *input, int *numberOfTokens) {
     int numTok = 0;
     char **tokenizedData = calloc(bufferSize, sizeof(char *));
     char *tokenPointer;
+    char *savePointer;
 
     //Allocating memory
     if (!tokenizedData) {
         fprintf(stderr, "trsh_INPUTPARSE: memory allocation error - pointer array\n");
         exit(EXIT_FAILURE);
     }
-    tokenPointer = strtok(input, TOKEN_DELIMITERS); //Get a pointer to the first token.
+    tokenPointer = strtok_r(input, TOKEN_DELIMITERS, &savePointer); //Get a pointer to the first token.
     while (tokenPointer != NULL) { //Checking to see if token exists.
         tokenizedData[numTok] = tokenPointer;
         if (numTok >= bufferSize) {
@@ -409,7 +691,7 @@ char **oufs_path_parse(char *input, int *numberOfTokens) {
             }
         }
         numTok++;
-        tokenPointer = strtok(0, TOKEN_DELIMITERS); //Get next pointer
+        tokenPointer = strtok_r(0, TOKEN_DELIMITERS, &savePointer); //Get next pointer
     }
     *numberOfTokens = numTok;
     return tokenizedData; //Return the array of pointers.
@@ -420,34 +702,42 @@ char **oufs_path_parse(char *input, int *numberOfTokens) {
  * @param path input of the program specified path.
  * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_rmdir(char *cwd, char *path) {
+int oufs_rmdir_r(OUFS *fs, char *cwd, char *path) {
     INODE_REFERENCE child, parent;
     char local_name[FILE_NAME_SIZE];
 
     //Find where the directory should be located.
-    if(oufs_find_file(cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
+    if(oufs_find_file_r(fs, cwd, path, &parent, &child, local_name) == EXIT_FAILURE)
     {
         fprintf(stderr, "Unable to traverse CWD or provided path.\n");
         return EXIT_FAILURE;
     }
 
     INODE childINODE, parentINODE;
-    BLOCK childBLOCK, parentBLOCK;
+    BLOCK parentBLOCK;
+
+    if(oufs_is_dot_entry(local_name))
+    {
+        fprintf(stderr, "Cannot remove '%s'.\n", local_name);
+        return EXIT_FAILURE;
+    }
 
-    oufs_read_inode_by_reference(parent, &parentINODE);
-    vdisk_read_block(parentINODE.data[0], &parentBLOCK);
+    //Lock the parent, then the directory being removed.
+    oufs_lock_inode_r(fs, parent, 1);
+    oufs_read_inode_by_reference_r(fs, parent, &parentINODE);
+    vdisk_read_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
 
     int childStatus = 0;
     int locationInParent;
     BLOCK_REFERENCE childBlockRef;
-    for(locationInParent=0; locationInParent < DIRECTORY_ENTRIES_PER_BLOCK; ++locationInParent)
+    for(locationInParent=0; parentINODE.type == IT_DIRECTORY && locationInParent < DIRECTORY_ENTRIES_PER_BLOCK; ++locationInParent)
     {
         if(strncmp(parentBLOCK.directory.entry[locationInParent].name, local_name, FILE_NAME_SIZE) == 0){
             //TODO: Support file and directory with same name.
             //fprintf(stderr, "Found local_name '%s' in parent block.\n", local_name);
             child = parentBLOCK.directory.entry[locationInParent].inode_reference;
-            oufs_read_inode_by_reference(parentBLOCK.directory.entry[locationInParent].inode_reference, &childINODE);
-            vdisk_read_block(childINODE.data[0], &childBLOCK);
+            oufs_lock_inode_r(fs, child, 1);
+            oufs_read_inode_by_reference_r(fs, child, &childINODE);
             childBlockRef = childINODE.data[0];
             childStatus = 1;
             break;
@@ -457,17 +747,18 @@ int oufs_rmdir(char *cwd, char *path) {
     if(childStatus == 0) //Fail if not in specified parent.
     {
         fprintf(stderr, "Specified directory (%s) not found in parent. Exiting...\n", local_name);
+        oufs_unlock_inode_r(fs, parent);
         return EXIT_FAILURE;
     }
 
-    if((childINODE.type != IT_DIRECTORY)) //Fail if not directory.
-    {
-        fprintf(stderr, "Given path termination point (%s) is not a directory.\n", local_name);
-        return EXIT_FAILURE;
-    }
-    if(childINODE.size > 2) //Fail if not empty.
+    if((childINODE.type != IT_DIRECTORY) || childINODE.size > 2) //Fail if not an empty directory.
     {
-        fprintf(stderr, "Given path termination point (%s) is not empty.\n", local_name);
+        if(childINODE.type != IT_DIRECTORY)
+            fprintf(stderr, "Given path termination point (%s) is not a directory.\n", local_name);
+        else
+            fprintf(stderr, "Given path termination point (%s) is not empty.\n", local_name);
+        oufs_unlock_inode_r(fs, child);
+        oufs_unlock_inode_r(fs, parent);
         return EXIT_FAILURE;
     }
 
@@ -475,7 +766,8 @@ int oufs_rmdir(char *cwd, char *path) {
 
     //Edit master block
     BLOCK masterBLOCK;
-    vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &masterBLOCK);
     RESET_BIT(masterBLOCK.master.block_allocated_flag, childINODE.data[0]);
     RESET_BIT(masterBLOCK.master.inode_allocated_flag, child);
 
@@ -489,19 +781,20 @@ int oufs_rmdir(char *cwd, char *path) {
     oufs_inode_reset(&childINODE);
 
     //Write Parent INODE and BLOCK
-    oufs_write_inode_by_reference(parent, &parentINODE);
-    vdisk_write_block(parentINODE.data[0], &parentBLOCK);
+    oufs_write_inode_by_reference_r(fs, parent, &parentINODE);
+    vdisk_write_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
 
     //WRITE MASTER BLOCK
-    vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK);
 
     //Write Child INODE and BLOCK
-    oufs_write_inode_by_reference(child, &childINODE);
-    vdisk_write_block(childBlockRef, &cleanDBLOCK);
-
+    oufs_write_inode_by_reference_r(fs, child, &childINODE);
+    vdisk_write_block_r(fs->disk, childBlockRef, &cleanDBLOCK);
 
-
-    return EXIT_SUCCESS;
+    int status = oufs_txn_commit_r(fs);
+    oufs_unlock_inode_r(fs, child);
+    oufs_unlock_inode_r(fs, parent);
+    return status;
 }
 /**
  * Function to reset a given inode.
@@ -509,170 +802,155 @@ int oufs_rmdir(char *cwd, char *path) {
  */
 
 /**
+ * Creates an empty file in a directory.  The caller holds the directory locked exclusively.
+ * @param parentINODE_REF the directory the file is created in.
+ * @param local_name the name of the new file.
+ * @param childINODE receives the inode of the new file.
+ * @return the inode reference of the new file, or UNALLOCATED_INODE on failure.
+ */
+static INODE_REFERENCE oufs_create_file(OUFS *fs, INODE_REFERENCE parentINODE_REF, char *local_name, INODE *childINODE)
+{
+    INODE parentINODE;
+    BLOCK parentBLOCK;
+    INODE_REFERENCE childINODE_REF;
+
+    //Find an empty place in the block.
+    oufs_read_inode_by_reference_r(fs, parentINODE_REF, &parentINODE);
+    vdisk_read_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
+    int availableEntry = -1;
+    for(int i=0; i < BLOCKS_PER_INODE; i++) {
+        if(parentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE) {
+            availableEntry = i;
+            break;
+        }
+    }
+    if(availableEntry < 0)
+    {
+        fprintf(stderr, "oufs_fopen: parent directory is full. Exiting...\n");
+        return UNALLOCATED_INODE;
+    }
+
+    //Allocate a new inode for the file, in its directory's allocation group if possible.
+    BLOCK masterBLOCK;
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &masterBLOCK);
+    int newINODE_REFERENCE = oufs_allocate_inode(&masterBLOCK, INODE_GROUP(parentINODE_REF));
+    if(newINODE_REFERENCE < 1) //Error if no available inodes.
+    {
+        fprintf(stderr, "oufs_fopen: no available inodes. Exiting...\n");
+        oufs_txn_abort_r(fs);
+        return UNALLOCATED_INODE;
+    }
+    childINODE_REF = (INODE_REFERENCE) newINODE_REFERENCE;
+    (*childINODE).size = 0;
+    for(int i = 0; i < BLOCKS_PER_INODE; i++)
+    {
+        (*childINODE).data[i] = UNALLOCATED_BLOCK; //Set all blocks to unallocated.
+    }
+    (*childINODE).n_references = 1;
+    (*childINODE).type = IT_FILE;
+
+    parentINODE.size++;
+
+    strncpy(parentBLOCK.directory.entry[availableEntry].name, local_name, FILE_NAME_SIZE-1);
+    parentBLOCK.directory.entry[availableEntry].name[FILE_NAME_SIZE-1] = 0; //Ensure null termination.
+    parentBLOCK.directory.entry[availableEntry].inode_reference = childINODE_REF;
+    vdisk_write_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK);
+    oufs_write_inode_by_reference_r(fs, parentINODE_REF, &parentINODE);
+    oufs_write_inode_by_reference_r(fs, childINODE_REF, childINODE);
+    int status = oufs_txn_commit_r(fs);
+    return status == EXIT_SUCCESS ? childINODE_REF : UNALLOCATED_INODE;
+}
+/**
+ * Opens a file for reading ('r'), writing ('w', which creates it or drops its old contents)
+ * or appending ('a', which creates it if needed).
  *
- * @param cwd
- * @param path
- * @param mode
- * @return
+ * The name is looked up again with the parent directory locked (exclusively if the file may
+ * be created), so threads opening the same new file create it once.
+ * @param cwd the current working directory of the file system.
+ * @param path the user provided path.
+ * @param mode "r", "w" or "a".
+ * @return the new file handle, or NULL on failure.
  */
-OUFILE *oufs_fopen(char *cwd, char *path, char *mode)
+OUFILE *oufs_fopen_r(OUFS *fs, char *cwd, char *path, char *mode)
 {
     char local_name[FILE_NAME_SIZE];
     INODE_REFERENCE parentINODE_REF, childINODE_REF;
     INODE childINODE, parentINODE;
-    oufs_find_file(cwd, path, &parentINODE_REF, &childINODE_REF, local_name);
+    BLOCK parentBLOCK;
+    oufs_find_file_r(fs, cwd, path, &parentINODE_REF, &childINODE_REF, local_name);
+
+    if(*mode != 'r' && *mode != 'w' && *mode != 'a')
+    {
+        fprintf(stderr, "oufs_fopen: Invalid mode(%s). Exiting...\n", mode);
+        return NULL;
+    }
+    if(*mode != 'r' && parentINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "oufs_fopen: parent does not exist. Exiting...\n");
+        return NULL;
+    }
+    if(oufs_is_dot_entry(local_name))
+    {
+        fprintf(stderr, "oufs_fopen: '%s' is not a file. Exiting...\n", local_name);
+        return NULL;
+    }
+
+    //Parent, then the file.
+    oufs_lock_inode_r(fs, parentINODE_REF, *mode != 'r');
+    childINODE_REF = oufs_lookup_entry(fs, parentINODE_REF, local_name, &parentINODE, &parentBLOCK);
+    if(childINODE_REF == UNALLOCATED_INODE && *mode == 'r')
+    {
+        fprintf(stderr, "oufs_fopen: file does not exist. Exiting...\n");
+        oufs_unlock_inode_r(fs, parentINODE_REF);
+        return NULL;
+    }
+    if(childINODE_REF == UNALLOCATED_INODE && parentINODE.type != IT_DIRECTORY)
+    {
+        fprintf(stderr, "oufs_fopen: parent does not exist. Exiting...\n");
+        oufs_unlock_inode_r(fs, parentINODE_REF);
+        return NULL;
+    }
+    if(childINODE_REF == UNALLOCATED_INODE)
+        childINODE_REF = oufs_create_file(fs, parentINODE_REF, local_name, &childINODE);
+    else
+    {
+        oufs_lock_inode_r(fs, childINODE_REF, 0);
+        oufs_read_inode_by_reference_r(fs, childINODE_REF, &childINODE);
+        oufs_unlock_inode_r(fs, childINODE_REF);
+    }
+    oufs_unlock_inode_r(fs, parentINODE_REF);
+    if(childINODE_REF == UNALLOCATED_INODE)
+        return NULL;
 
     OUFILE *fp = malloc(sizeof(OUFILE));
+    fp->fs = fs;
+    fp->inode_reference = childINODE_REF;
+    fp->mode = *mode;
+    fp->dirty_blocks = 0;
+    fp->compressed = (childINODE.type == IT_COMPRESSED_FILE);
 
     switch(*mode) {
         case 'r' : //File reading case
-            if(childINODE_REF == UNALLOCATED_INODE) {
-                fprintf(stderr, "oufs_fopen: file does not exist. Exiting...\n");
-                return NULL;
-            }
-            //Initialize oufile_s
-            fp->inode_reference = childINODE_REF;
-            fp->mode = *mode;
             fp->offset = 0;
+            fp->size = childINODE.size;
             return(fp);
         case 'w' : //File writing case
-            if(parentINODE_REF == UNALLOCATED_INODE)
-            {
-                fprintf(stderr, "oufs_fopen: parent does not exist. Exiting...\n");
-                return NULL;
-            }
-            if(childINODE_REF == UNALLOCATED_INODE)
-            {
-                //Find an empty place in the block.
-                oufs_read_inode_by_reference(parentINODE_REF, &parentINODE);
-                BLOCK parentBLOCK;
-                vdisk_read_block(parentINODE.data[0],&parentBLOCK);
-                int availableEntry = -1;
-                for(int i=0; i < BLOCKS_PER_INODE; i++) {
-                    if(parentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE) {
-                        availableEntry = i;
-                        break;
-                    }
-                }
-                if(availableEntry < 0)
-                {
-                    fprintf(stderr, "oufs_fopen: parent directory is full. Exiting...\n");
-                    return NULL;
-                }
-
-                //Allocate a new inode for the file.
-                BLOCK masterBLOCK;
-                vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
-                int newINODE_REFERENCE = oufs_find_open_bit(masterBLOCK.master.inode_allocated_flag);
-                if(newINODE_REFERENCE < 1) //Error if no available inodes.
-                {
-                    fprintf(stderr, "oufs_fopen: no available inodes. Exiting...\n");
-                    return NULL;
-                }
-                childINODE_REF = (INODE_REFERENCE) newINODE_REFERENCE;
-                SET_BIT(masterBLOCK.master.inode_allocated_flag, childINODE_REF); //Set the bit.
-                childINODE.size = 0;
-                for(int i = 0; i < BLOCKS_PER_INODE; i++)
-                {
-                    childINODE.data[i] = UNALLOCATED_BLOCK; //Set all blocks to unallocated.
-                }
-                childINODE.n_references = 1;
-                childINODE.type = IT_FILE;
-
-                parentINODE.size++;
-
-                strncpy(parentBLOCK.directory.entry[availableEntry].name, local_name, FILE_NAME_SIZE-1);
-                parentBLOCK.directory.entry[availableEntry].name[FILE_NAME_SIZE-1] = 0; //Ensure null termination.
-                parentBLOCK.directory.entry[availableEntry].inode_reference = childINODE_REF;
-                vdisk_write_block(parentINODE.data[0], &parentBLOCK);
-                vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
-                oufs_write_inode_by_reference(parentINODE_REF, &parentINODE);
-                oufs_write_inode_by_reference(childINODE_REF, &childINODE);
-            }
-            else
-            {
-                oufs_read_inode_by_reference(childINODE_REF, &childINODE);
-            }
-
-            //OUFILE *fp declared above.
-            fp->inode_reference = childINODE_REF;
-            fp->mode = *mode;
+            //The old contents are dropped logically; their blocks are reused when the handle is flushed.
             fp->offset = 0;
+            fp->size = 0;
             return(fp);
-        case 'a' : //File appending case.
-            if(parentINODE_REF == UNALLOCATED_INODE)
-            {
-                fprintf(stderr, "oufs_fopen: parent does not exist. Exiting...\n");
-                return NULL;
-            }
-            if(childINODE_REF == UNALLOCATED_INODE)
-            {
-                //Find an empty place in the block.
-                oufs_read_inode_by_reference(parentINODE_REF, &parentINODE);
-                BLOCK parentBLOCK;
-                vdisk_read_block(parentINODE.data[0], &parentBLOCK);
-                int availableEntry = -1;
-                for(int i=0; i < BLOCKS_PER_INODE; i++) {
-                    if(parentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE) {
-                        availableEntry = i;
-                        break;
-                    }
-                }
-                if(availableEntry < 0)
-                {
-                    fprintf(stderr, "oufs_fopen: parent directory is full. Exiting...\n");
-                    return NULL;
-                }
-
-                //Allocate a new inode for the file.
-                BLOCK masterBLOCK;
-                vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
-                int newINODE_REFERENCE = oufs_find_open_bit(masterBLOCK.master.inode_allocated_flag);
-                if(newINODE_REFERENCE < 1) //Error if no available inodes.
-                {
-                    fprintf(stderr, "oufs_fopen: no available inodes. Exiting...\n");
-                    return NULL;
-                }
-                childINODE_REF = (INODE_REFERENCE) newINODE_REFERENCE;
-                SET_BIT(masterBLOCK.master.inode_allocated_flag, childINODE_REF); //Set the bit.
-                childINODE.size = 0;
-                for(int i = 0; i < BLOCKS_PER_INODE; i++)
-                {
-                    childINODE.data[i] = UNALLOCATED_BLOCK; //Set all blocks to unallocated.
-                }
-                childINODE.n_references = 1;
-                childINODE.type = IT_FILE;
-
-                parentINODE.size++;
-
-                strncpy(parentBLOCK.directory.entry[availableEntry].name, local_name, FILE_NAME_SIZE-1);
-                parentBLOCK.directory.entry[availableEntry].name[FILE_NAME_SIZE-1] = 0; //Ensure null termination.
-                parentBLOCK.directory.entry[availableEntry].inode_reference = childINODE_REF;
-                vdisk_write_block(parentINODE.data[0], &parentBLOCK);
-                vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
-                oufs_write_inode_by_reference(parentINODE_REF, &parentINODE);
-                oufs_write_inode_by_reference(childINODE_REF, &childINODE);
-            }
-            else
+        default : //File appending case.
+            if(childINODE.size >= (BLOCK_SIZE*BLOCKS_PER_INODE))
             {
-                oufs_read_inode_by_reference(childINODE_REF, &childINODE);
-                if(childINODE.size >= (BLOCK_SIZE*BLOCKS_PER_INODE))
-                {
-                    fprintf(stderr, "File is already full. Exiting...\n");
-                    return(NULL);
-                }
-
+                fprintf(stderr, "File is already full. Exiting...\n");
+                free(fp);
+                return(NULL);
             }
-
-            //OUFILE *fp declared above.
-            fp->inode_reference = childINODE_REF;
-            fp->mode = *mode;
             fp->offset = childINODE.size;
+            fp->size = childINODE.size;
             return(fp);
-        default:
-            fprintf(stderr, "oufs_fopen: Invalid mode(%s). Exiting...\n", mode);
-            return NULL;
-
     }
 }
 void oufs_inode_reset(INODE *inode) {
@@ -689,332 +967,1812 @@ void oufs_clear_dblock(BLOCK *block) {
     memset(block, 0, 256);
 }
 /**
- * Writes to or appends given data to a file.
- * @param fp the OUFILE object representing the file opened previously.
- * @param buf buffer to be written to the file.
- * @param len the length of the buffer.
- * @return
+ * Grows or shrinks the block map of an inode so that it covers exactly size bytes.
+ *
+ * Blocks that are still covered by the new size are kept in place; only the surplus
+ * past the new end of file is released.  Growing allocates nothing: the new range is
+ * mapped as holes, which read back as zeroes.
+ *
+ * @param inode the inode to be resized (not written back).
+ * @param masterBlock the in-memory master block used for allocation.
+ * @param size the new size of the file in bytes.
+ * @param masterDirty set to 1 if the allocation tables were changed.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_fwrite(OUFILE *fp, unsigned char *buf, int len)
+static int oufs_resize_inode(OUFS *fs, INODE *inode, BLOCK *masterBlock, unsigned int size, int *masterDirty)
 {
-    INODE inode;
-    oufs_read_inode_by_reference((*fp).inode_reference, &inode);
-
-    int bufLocation = 0;
-    int offsetInBlock;
-    int currentBlock;
-    int blkInMem = -1;
-    BLOCK blockMem, masterBlock;
-    vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBlock);
+    int keepBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    BLOCK zeroBlock;
 
-    switch((*fp).mode){
-        case 'w' :
-                for(int i=0; i< BLOCKS_PER_INODE; i++)
-                {
-                    if(inode.data[i] == UNALLOCATED_BLOCK) //Break loop if the block reference is already unallocated.
-                        break;
+    if(size > (BLOCK_SIZE*BLOCKS_PER_INODE))
+    {
+        fprintf(stderr, "oufs_resize_inode: size %u exceeds the maximum file size.\n", size);
+        return EXIT_FAILURE;
+    }
 
-                    RESET_BIT(masterBlock.master.block_allocated_flag, inode.data[i]); //Free the block
-                    inode.data[i] = UNALLOCATED_BLOCK; //Set data to unallocated.
-                }
-            inode.size = 0;
+    //Release the surplus blocks past the new end of file.
+    for(int i=keepBlocks; i < BLOCKS_PER_INODE; i++)
+    {
+        if(BLOCK_IS_MAPPED(inode->data[i]))
+        {
+            oufs_release_block_r(fs, masterBlock, BLOCK_INDEX(inode->data[i]));
+            *masterDirty = 1;
+        }
+        inode->data[i] = UNALLOCATED_BLOCK;
+    }
 
-            while(bufLocation < len) //While there is still data to write.
+    if(size > inode->size)
+    {
+        //Zero the stale bytes after the old end of file in its last block.
+        int tailOffset = inode->size % BLOCK_SIZE;
+        BLOCK_REFERENCE tail = inode->data[inode->size / BLOCK_SIZE];
+        if(tailOffset != 0 && BLOCK_IS_MAPPED(tail) && !BLOCK_IS_UNWRITTEN(tail))
+        {
+            vdisk_read_block_r(fs->disk, tail, &zeroBlock);
+            memset(&zeroBlock.data.data[tailOffset], 0, BLOCK_SIZE - tailOffset);
+            if(masterBlock->master.block_share_count[tail] > 0) //Shared with a clone: copy on write.
             {
-                if(bufLocation >= (BLOCK_SIZE*BLOCKS_PER_INODE))
+                BLOCK_REFERENCE copy;
+                if(oufs_allocate_block_run(masterBlock, tail + 1, 1, &copy) != 0)
                 {
-                    break;
+                    fprintf(stderr, "No more blocks available.\n");
+                    return EXIT_FAILURE;
                 }
-                offsetInBlock = (*fp).offset % 256; //Calculate the current position in block.
-                currentBlock = ((*fp).offset - offsetInBlock) / 256; //Calculate the current block.
+                oufs_release_block_r(fs, masterBlock, tail);
+                inode->data[inode->size / BLOCK_SIZE] = copy;
+                tail = copy;
+                *masterDirty = 1;
+            }
+            vdisk_write_data_block_r(fs->disk, tail, &zeroBlock);
+        }
 
-                if(blkInMem != currentBlock) //Read in current block if necessary.
-                {
-                    if(inode.data[currentBlock] == UNALLOCATED_BLOCK) //Setup new block
-                    {
-                        int allocNewBlock;
-                        if((allocNewBlock = oufs_find_open_bit(masterBlock.master.block_allocated_flag)) < 0)
-                        {
-                            fprintf(stderr, "No more blocks available.\n");
-                            return EXIT_FAILURE;
-                        }
-                        SET_BIT(masterBlock.master.block_allocated_flag, allocNewBlock);
-                        inode.data[currentBlock] = (BLOCK_REFERENCE) allocNewBlock;
-                    }
-                    vdisk_read_block(inode.data[currentBlock], &blockMem);
-                    blkInMem = currentBlock;
-                }
+        //The rest of the new range is sparse.
+        for(int i=0; i < keepBlocks; i++)
+        {
+            if(inode->data[i] == UNALLOCATED_BLOCK)
+                inode->data[i] = HOLE_BLOCK;
+        }
+    }
 
-                blockMem.data.data[offsetInBlock] = buf[bufLocation];
+    inode->size = size;
+    return EXIT_SUCCESS;
+}
+/**
+ * Reads and decompresses the contents of a compressed file.
+ *
+ * @param inode the inode of an IT_COMPRESSED_FILE.
+ * @param buf receives inode->size bytes.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_read_compressed(OUFS *fs, INODE *inode, unsigned char *buf)
+{
+    unsigned char stream[BLOCK_SIZE*BLOCKS_PER_INODE];
+    int nBlocks = 0;
 
-                inode.size++;
-                (*fp).offset++;
-                bufLocation++;
+    for(int i=0; i < BLOCKS_PER_INODE && BLOCK_IS_MAPPED(inode->data[i]); i++, nBlocks++)
+        vdisk_read_block_r(fs->disk, inode->data[i], &stream[i * BLOCK_SIZE]);
 
-                //If block full, buf empty, or file full.
-                if((offsetInBlock >= (BLOCK_SIZE - 1)) || (bufLocation >= (len-1)) || (bufLocation >= (BLOCK_SIZE*BLOCKS_PER_INODE)))
-                {
-                    vdisk_write_block(inode.data[blkInMem], &blockMem); //Write the block.
-                }
-            }
+    if(inode->size == 0)
+        return EXIT_SUCCESS;
 
-            vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBlock); //Write the master block.
-            oufs_write_inode_by_reference((*fp).inode_reference, &inode); //Write the inode.
-            return EXIT_SUCCESS;
-        case 'a' :
-            //Write the characters to the file.
-            while(bufLocation < len) //While there is still data to write.
-            {
-                if(bufLocation >= (BLOCK_SIZE*BLOCKS_PER_INODE))
-                {
-                    break;
-                }
-                offsetInBlock = (*fp).offset % 256; //Calculate the current position in block.
-                currentBlock = ((*fp).offset - offsetInBlock) / 256; //Calculate the current block.
+    int streamLength = stream[0] | (stream[1] << 8);
+    if(nBlocks == 0 || streamLength + COMPRESSED_HEADER_SIZE > nBlocks * BLOCK_SIZE
+       || oufs_lz4_decompress(&stream[COMPRESSED_HEADER_SIZE], streamLength, buf, inode->size) != (int) inode->size)
+    {
+        fprintf(stderr, "oufs_read_compressed: corrupt compressed file.\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+/**
+ * Makes the write buffer of a compressed file's handle hold the whole file.
+ *
+ * A compressed file is recompressed as a whole when flushed, so every block has to be
+ * in the buffer before any part of it is changed.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_buffer_compressed(OUFILE *fp)
+{
+    OUFS *fs = (*fp).fs;
+    INODE inode;
+    int nBlocks = ((*fp).size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if(!(*fp).compressed || (*fp).dirty_blocks != 0 || (*fp).size == 0)
+        return EXIT_SUCCESS;
+
+    oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    memset((*fp).buffer, 0, sizeof((*fp).buffer));
+    if(inode.type == IT_COMPRESSED_FILE)
+    {
+        if(oufs_read_compressed(fs, &inode, (unsigned char *) (*fp).buffer) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+    else
+    {
+        //Switching a plain file to compressed (oufs_fcompress).
+        for(int i=0; i < nBlocks; i++)
+        {
+            if(BLOCK_IS_MAPPED(inode.data[i]) && !BLOCK_IS_UNWRITTEN(inode.data[i]))
+                vdisk_read_block_r(fs->disk, inode.data[i], &(*fp).buffer[i]);
+        }
+        if((*fp).size % BLOCK_SIZE != 0)
+            memset(&(*fp).buffer[nBlocks-1].data[(*fp).size % BLOCK_SIZE], 0, BLOCK_SIZE - (*fp).size % BLOCK_SIZE);
+    }
+
+    (*fp).dirty_blocks = (unsigned short) ((1 << nBlocks) - 1);
+    return EXIT_SUCCESS;
+}
+/**
+ * Writes the buffered contents of a compressed file back to the disk as one stream.
+ *
+ * The blocks the file owns outright are reused in order; blocks shared with a clone or
+ * reserved are replaced, and any surplus is released.  If the data does not compress into
+ * the blocks an inode can hold, the file is stored uncompressed instead.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_flush_compressed(OUFILE *fp)
+{
+    OUFS *fs = (*fp).fs;
+    INODE inode;
+    BLOCK masterBlock;
+    BLOCK_REFERENCE newBlocks[BLOCKS_PER_INODE];
+    BLOCK_REFERENCE goal = UNALLOCATED_BLOCK;
+    unsigned char plain[BLOCK_SIZE*BLOCKS_PER_INODE];
+    unsigned char stream[BLOCK_SIZE*BLOCKS_PER_INODE];
+    int nNew = 0;
+
+    oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    if((*fp).dirty_blocks == 0 && (*fp).size == inode.size && inode.type == IT_COMPRESSED_FILE)
+        return EXIT_SUCCESS;
+
+    //Gather the contents: buffered blocks, zeroes for anything never written.
+    int plainBlocks = ((*fp).size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for(int i=0; i < plainBlocks; i++)
+    {
+        if((*fp).dirty_blocks & (1 << i))
+            memcpy(&plain[i * BLOCK_SIZE], (*fp).buffer[i].data, BLOCK_SIZE);
+        else
+            memset(&plain[i * BLOCK_SIZE], 0, BLOCK_SIZE);
+    }
 
-                if(blkInMem != currentBlock) //Read in current block if necessary.
+    int streamLength = 0;
+    int nBlocks = 0;
+    if((*fp).size > 0)
+    {
+        streamLength = oufs_lz4_compress(plain, (*fp).size, &stream[COMPRESSED_HEADER_SIZE],
+                                         sizeof(stream) - COMPRESSED_HEADER_SIZE);
+        if(streamLength < 0)
+        {
+            //Incompressible: fall back to a plain file holding the same contents.
+            memcpy((*fp).buffer, plain, plainBlocks * BLOCK_SIZE);
+            (*fp).dirty_blocks = (unsigned short) ((1 << plainBlocks) - 1);
+            (*fp).compressed = 0;
+            if(inode.type == IT_COMPRESSED_FILE)
+            {
+                //The stream blocks are rewritten in place; any past the plain data are freed.
+                oufs_read_master_r(fs, &masterBlock);
+                for(int i=plainBlocks; i < BLOCKS_PER_INODE; i++)
                 {
-                    if(inode.data[currentBlock] == UNALLOCATED_BLOCK) //Setup new block
+                    if(BLOCK_IS_MAPPED(inode.data[i]))
                     {
-                        int allocNewBlock;
-                        if((allocNewBlock = oufs_find_open_bit(masterBlock.master.block_allocated_flag)) < 0)
-                        {
-                            fprintf(stderr, "No more blocks available.\n");
-                            return EXIT_FAILURE;
-                        }
-                        SET_BIT(masterBlock.master.block_allocated_flag, allocNewBlock);
-                        inode.data[currentBlock] = (BLOCK_REFERENCE) allocNewBlock;
+                        oufs_release_block_r(fs, &masterBlock, BLOCK_INDEX(inode.data[i]));
+                        inode.data[i] = UNALLOCATED_BLOCK;
                     }
-                    vdisk_read_block(inode.data[currentBlock], &blockMem);
-                    blkInMem = currentBlock;
                 }
+                vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+                inode.size = (*fp).size;
+            }
+            inode.type = IT_FILE;
+            oufs_write_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+            if(oufs_flush(fp) != EXIT_SUCCESS)
+            {
+                //Nothing was written, so the file is still stored compressed; a retry must compress again.
+                (*fp).compressed = 1;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        stream[0] = (unsigned char) (streamLength & 0xff);
+        stream[1] = (unsigned char) (streamLength >> 8);
+        nBlocks = (streamLength + COMPRESSED_HEADER_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        memset(&stream[streamLength + COMPRESSED_HEADER_SIZE], 0, nBlocks * BLOCK_SIZE - streamLength - COMPRESSED_HEADER_SIZE);
+    }
+
+    oufs_read_master_r(fs, &masterBlock);
+
+    //Keep blocks owned outright; give up shared ones and free the surplus.
+    for(int i=0; i < BLOCKS_PER_INODE; i++)
+    {
+        BLOCK_REFERENCE ref = inode.data[i];
+        if(BLOCK_IS_MAPPED(ref) && (i >= nBlocks || masterBlock.master.block_share_count[BLOCK_INDEX(ref)] > 0))
+        {
+            oufs_release_block_r(fs, &masterBlock, BLOCK_INDEX(ref));
+            ref = UNALLOCATED_BLOCK;
+        }
+        if(i < nBlocks && !BLOCK_IS_MAPPED(ref))
+        {
+            if(nNew == 0 && i > 0)
+                goal = BLOCK_INDEX(inode.data[i-1]) + 1;
+            nNew++;
+        }
+        inode.data[i] = BLOCK_IS_MAPPED(ref) ? BLOCK_INDEX(ref) : UNALLOCATED_BLOCK;
+    }
+    if(goal == UNALLOCATED_BLOCK)
+        goal = GROUP_FIRST_BLOCK(INODE_GROUP((*fp).inode_reference));
+    if(oufs_allocate_block_run(&masterBlock, goal, nNew, newBlocks) != 0)
+    {
+        fprintf(stderr, "No more blocks available.\n");
+        return EXIT_FAILURE;
+    }
+    for(int i=0, j=0; i < nBlocks; i++)
+    {
+        if(inode.data[i] == UNALLOCATED_BLOCK)
+            inode.data[i] = newBlocks[j++];
+        vdisk_write_data_block_r(fs->disk, inode.data[i], &stream[i * BLOCK_SIZE]);
+    }
+    (*fp).dirty_blocks = 0;
+
+    inode.type = IT_COMPRESSED_FILE;
+    inode.size = (*fp).size;
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+    oufs_write_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    return EXIT_SUCCESS;
+}
+/**
+ * Brings a logical block of a file into the write buffer of its handle.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param currentBlock the logical block to be buffered.
+ * @param keepOld whether the current contents are needed (partial overwrite).
+ * @param inode the file's inode, loaded on first use.
+ * @param inodeLoaded whether inode has been loaded yet.
+ * @return a pointer to the buffered block.
+ */
+static DATA_BLOCK *oufs_buffer_block(OUFILE *fp, int currentBlock, int keepOld, INODE *inode, int *inodeLoaded)
+{
+    OUFS *fs = (*fp).fs;
+    DATA_BLOCK *blockMem = &(*fp).buffer[currentBlock];
+    int blockStart = currentBlock * BLOCK_SIZE;
+
+    if((*fp).dirty_blocks & (1 << currentBlock)) //Already buffered.
+        return blockMem;
+
+    memset(blockMem->data, 0, BLOCK_SIZE);
+    if(keepOld && blockStart < (*fp).size) //Existing data has to be preserved.
+    {
+        if(!*inodeLoaded)
+        {
+            oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, inode);
+            *inodeLoaded = 1;
+        }
+        if(BLOCK_IS_MAPPED(inode->data[currentBlock]) && !BLOCK_IS_UNWRITTEN(inode->data[currentBlock]))
+        {
+            vdisk_read_block_r(fs->disk, inode->data[currentBlock], blockMem);
+            //Anything past the end of file reads back as zeroes.
+            if((*fp).size < blockStart + BLOCK_SIZE)
+                memset(&blockMem->data[(*fp).size - blockStart], 0, blockStart + BLOCK_SIZE - (*fp).size);
+        }
+    }
+    (*fp).dirty_blocks |= (1 << currentBlock);
+    return blockMem;
+}
+/**
+ * Copies data into the write buffer of a file handle at a given offset.
+ *
+ * Writing past the end of file leaves the gap as a hole; only the partially filled block
+ * that held the old end of file is brought into the buffer so its tail can be zeroed.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param buf buffer to be written to the file.
+ * @param len the length of the buffer.
+ * @param offset the position in the file of the first byte.
+ * @return the number of bytes buffered.
+ */
+static int oufs_buffer_write(OUFILE *fp, unsigned char *buf, int len, int offset)
+{
+    INODE inode;
+    int inodeLoaded = 0;
+    int bufLocation = 0;
+    int offsetInBlock;
+    int currentBlock;
+
+    //Existing contents may be read into the buffer.
+    oufs_lock_inode_r((*fp).fs, (*fp).inode_reference, 0);
+
+    //A compressed file is rewritten whole: bring all of it into the buffer first.
+    if(len > 0 && oufs_buffer_compressed(fp) != EXIT_SUCCESS)
+    {
+        oufs_unlock_inode_r((*fp).fs, (*fp).inode_reference);
+        return 0;
+    }
+
+    //Writing past a partial last block: its stale tail becomes part of the gap.
+    if(len > 0 && offset > (*fp).size && (*fp).size % BLOCK_SIZE != 0)
+        oufs_buffer_block(fp, (*fp).size / BLOCK_SIZE, 1, &inode, &inodeLoaded);
+
+    while(bufLocation < len) //While there is still data to write.
+    {
+        if(offset >= (BLOCK_SIZE*BLOCKS_PER_INODE)) //File full.
+            break;
+
+        offsetInBlock = offset % BLOCK_SIZE; //Calculate the current position in block.
+        currentBlock = offset / BLOCK_SIZE; //Calculate the current block.
+        int chunk = MIN(BLOCK_SIZE - offsetInBlock, len - bufLocation);
+
+        DATA_BLOCK *blockMem = oufs_buffer_block(fp, currentBlock, chunk < BLOCK_SIZE, &inode, &inodeLoaded);
+
+        memcpy(&blockMem->data[offsetInBlock], &buf[bufLocation], chunk);
+        offset += chunk;
+        bufLocation += chunk;
+
+        if(offset > (*fp).size)
+            (*fp).size = offset;
+    }
+
+    oufs_unlock_inode_r((*fp).fs, (*fp).inode_reference);
+    return bufLocation;
+}
+/**
+ * Writes to or appends given data to a file.
+ *
+ * The data is only copied into the handle; no blocks are allocated or written until the
+ * handle is flushed (see oufs_fflush).  In 'w' mode the file ends where the writes end.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param buf buffer to be written to the file.
+ * @param len the length of the buffer.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_fwrite(OUFILE *fp, unsigned char *buf, int len)
+{
+    switch((*fp).mode){
+        case 'w' :
+        case 'a' :
+            break;
+        case 'r' :
+            fprintf(stderr, "File in read only mode - cannot write.\n");
+            return EXIT_FAILURE;
+        default:
+            return EXIT_FAILURE;
+    }
 
-                blockMem.data.data[offsetInBlock] = buf[bufLocation];
+    (*fp).offset += oufs_buffer_write(fp, buf, len, (*fp).offset);
+    return EXIT_SUCCESS;
+}
+/**
+ * Writes data at a given position of a file without moving the file offset.
+ *
+ * Writing past the end of file leaves the gap unallocated (a hole).
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param buf buffer to be written to the file.
+ * @param len the length of the buffer.
+ * @param offset the position in the file of the first byte.
+ * @return the number of bytes written, or -1 on error.
+ */
+int oufs_pwrite(OUFILE *fp, unsigned char *buf, int len, int offset)
+{
+    if((*fp).mode != 'w' && (*fp).mode != 'a')
+    {
+        fprintf(stderr, "File cannot be written - opened in '%c' mode.\n", (*fp).mode);
+        return (-1);
+    }
+    if(offset < 0 || len < 0)
+    {
+        fprintf(stderr, "oufs_pwrite: invalid range (%d, %d).\n", offset, len);
+        return (-1);
+    }
+
+    return oufs_buffer_write(fp, buf, len, offset);
+}
+/**
+ * Moves the offset of an open file.  The offset may be placed past the end of file;
+ * a later write there leaves a hole.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param offset the new offset, relative to whence.
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return the new offset, or -1 on error.
+ */
+int oufs_fseek(OUFILE *fp, int offset, int whence)
+{
+    int base;
+
+    switch(whence) {
+        case SEEK_SET :
+            base = 0;
+            break;
+        case SEEK_CUR :
+            base = (*fp).offset;
+            break;
+        case SEEK_END :
+            base = (*fp).size;
+            break;
+        default:
+            fprintf(stderr, "oufs_fseek: invalid whence (%d).\n", whence);
+            return (-1);
+    }
+
+    if(base + offset < 0 || base + offset > (BLOCK_SIZE*BLOCKS_PER_INODE))
+    {
+        fprintf(stderr, "oufs_fseek: offset out of range (%d).\n", base + offset);
+        return (-1);
+    }
+
+    (*fp).offset = base + offset;
+    return (*fp).offset;
+}
+/**
+ * Writes the buffered blocks of a file that is not stored compressed (see oufs_fflush).
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_flush_blocks(OUFILE *fp)
+{
+    OUFS *fs = (*fp).fs;
+    INODE inode;
+    BLOCK masterBlock;
+    BLOCK_REFERENCE newBlocks[BLOCKS_PER_INODE];
+    BLOCK_REFERENCE goal = UNALLOCATED_BLOCK;
+    int nNew = 0;
+    int masterDirty = 0;
+    int status = EXIT_SUCCESS;
+
+    //Blocks still to be written; the handle keeps its own mask until the blocks have a home, so
+    //  a flush that fails (and whose transaction is aborted) can be retried.
+    unsigned short dirty = (*fp).dirty_blocks;
+
+    oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+
+    //A rewrite also gives back blocks reserved past the data it wrote.
+    int keepBlocks = ((*fp).size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int trimTail = 0;
+    for(int i=keepBlocks; (*fp).mode == 'w' && i < BLOCKS_PER_INODE; i++)
+        trimTail |= BLOCK_IS_MAPPED(inode.data[i]);
+
+    if(dirty == 0 && (*fp).size == inode.size && !trimTail)
+        return EXIT_SUCCESS;
+
+    oufs_read_master_r(fs, &masterBlock);
+
+    //Dirty blocks whose contents already exist elsewhere on the disk share that block instead.
+    for(int i=0; oufs_dedup_enabled_r(fs) && i < BLOCKS_PER_INODE; i++)
+    {
+        if((dirty & (1 << i)) == 0)
+            continue;
+        BLOCK_REFERENCE current = BLOCK_IS_MAPPED(inode.data[i]) ? BLOCK_INDEX(inode.data[i]) : UNALLOCATED_BLOCK;
+        BLOCK_REFERENCE match = oufs_dedup_lookup_r(fs, &masterBlock, &(*fp).buffer[i], current);
+        if(match == UNALLOCATED_BLOCK)
+            continue;
+        ++masterBlock.master.block_share_count[match];
+        if(current != UNALLOCATED_BLOCK)
+            oufs_release_block_r(fs, &masterBlock, current);
+        inode.data[i] = match;
+        dirty &= ~(1 << i);
+        masterDirty = 1;
+    }
+
+    //Dirty blocks shared with a clone are copied on write: give up the share and take a new block.
+    //  This comes after deduplication, which may have given a share of one of this file's own
+    //  dirty blocks to another of its blocks.
+    for(int i=0; i < BLOCKS_PER_INODE; i++)
+    {
+        if((dirty & (1 << i)) && BLOCK_IS_MAPPED(inode.data[i])
+           && masterBlock.master.block_share_count[BLOCK_INDEX(inode.data[i])] > 0)
+        {
+            oufs_release_block_r(fs, &masterBlock, BLOCK_INDEX(inode.data[i]));
+            inode.data[i] = HOLE_BLOCK;
+            masterDirty = 1;
+        }
+    }
+
+    //Count the dirty blocks with no backing store, aiming the run right after the preceding block.
+    for(int i=0; i < BLOCKS_PER_INODE; i++)
+    {
+        if((dirty & (1 << i)) && !BLOCK_IS_MAPPED(inode.data[i]))
+        {
+            for(int j=i-1; nNew == 0 && j >= 0 && goal == UNALLOCATED_BLOCK; j--)
+            {
+                if(BLOCK_IS_MAPPED(inode.data[j]))
+                    goal = BLOCK_INDEX(inode.data[j]) + (i - j);
+            }
+            nNew++;
+        }
+    }
+
+    if(nNew > 0)
+    {
+        //With no preceding block, the run starts in the allocation group of the file's inode.
+        if(goal == UNALLOCATED_BLOCK)
+            goal = GROUP_FIRST_BLOCK(INODE_GROUP((*fp).inode_reference));
+        if(oufs_allocate_block_run(&masterBlock, goal, nNew, newBlocks) != 0)
+        {
+            fprintf(stderr, "No more blocks available.\n");
+            return EXIT_FAILURE;
+        }
+        masterDirty = 1;
+        for(int i=0, j=0; i < BLOCKS_PER_INODE; i++)
+        {
+            if((dirty & (1 << i)) && !BLOCK_IS_MAPPED(inode.data[i]))
+                inode.data[i] = newBlocks[j++];
+        }
+    }
+
+    //Write the buffered blocks in logical (and therefore on-disk) order; reserved blocks become written.
+    for(int i=0; i < BLOCKS_PER_INODE; i++)
+    {
+        if(dirty & (1 << i))
+        {
+            inode.data[i] = BLOCK_INDEX(inode.data[i]);
+            vdisk_write_data_block_r(fs->disk, inode.data[i], &(*fp).buffer[i]);
+            if(oufs_dedup_enabled_r(fs))
+                oufs_dedup_remember_r(fs, inode.data[i], &(*fp).buffer[i]);
+        }
+    }
+    (*fp).dirty_blocks = 0;
+
+    //The written data defines the size; a rewrite that ended early releases the surplus.
+    if((*fp).size > inode.size)
+        inode.size = (*fp).size;
+    if((*fp).size < inode.size || trimTail)
+        status = oufs_resize_inode(fs, &inode, &masterBlock, (*fp).size, &masterDirty);
+
+    //Whatever inside the file was skipped over is a hole.
+    for(int i=0; i < keepBlocks; i++)
+    {
+        if(inode.data[i] == UNALLOCATED_BLOCK)
+            inode.data[i] = HOLE_BLOCK;
+    }
+
+    if(masterDirty)
+        vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock); //Write the master block.
+    oufs_write_inode_by_reference_r(fs, (*fp).inode_reference, &inode); //Write the inode.
+    return status;
+}
+/**
+ * Writes the data buffered in a file handle to the disk.
+ *
+ * All logical blocks that still need backing store are allocated together, as one
+ * contiguous run if the disk allows it (continuing right after the file's preceding block
+ * when possible).  Blocks shared with a clone are copied on write, and with deduplication on,
+ * blocks whose contents are already on the disk share that block instead.  Blocks inside the file
+ * that were never written stay holes.  The master block and inode are each written at most once.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_fflush(OUFILE *fp)
+{
+    OUFS *fs = (*fp).fs;
+    if((*fp).mode != 'w' && (*fp).mode != 'a')
+        return EXIT_SUCCESS;
+
+    oufs_lock_inode_r(fs, (*fp).inode_reference, 1);
+    int status = oufs_flush(fp);
+    oufs_unlock_inode_r(fs, (*fp).inode_reference);
+    return status;
+}
+/**
+ * Writes the data buffered in a file handle to the disk (see oufs_fflush).  The caller holds
+ * the file's inode locked exclusively.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_flush(OUFILE *fp)
+{
+    OUFS *fs = (*fp).fs;
+
+    //Everything the flush writes reaches the disk together.
+    oufs_txn_begin_r(fs);
+    int status = (*fp).compressed ? oufs_flush_compressed(fp) : oufs_flush_blocks(fp);
+    if(status != EXIT_SUCCESS)
+    {
+        oufs_txn_abort_r(fs);
+        return status;
+    }
+    return oufs_txn_commit_r(fs);
+}
+/**
+ * Sets the size of an open file.
+ *
+ * Shrinking releases only the blocks past the new end of file; growing keeps the
+ * existing blocks and leaves the new range as a hole.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param size the new size of the file in bytes.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_ftruncate(OUFILE *fp, int size)
+{
+    OUFS *fs = (*fp).fs;
+
+    if((*fp).mode != 'w' && (*fp).mode != 'a')
+    {
+        fprintf(stderr, "File cannot be truncated - opened in '%c' mode.\n", (*fp).mode);
+        return EXIT_FAILURE;
+    }
+    if(size < 0)
+    {
+        fprintf(stderr, "oufs_ftruncate: invalid size (%d).\n", size);
+        return EXIT_FAILURE;
+    }
+
+    oufs_lock_inode_r(fs, (*fp).inode_reference, 1);
+    int status = oufs_truncate(fp, size);
+    oufs_unlock_inode_r(fs, (*fp).inode_reference);
+    return status;
+}
+/**
+ * Sets the size of an open file (see oufs_ftruncate).  The caller holds the file's inode
+ * locked exclusively.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param size the new size of the file in bytes.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_truncate(OUFILE *fp, int size)
+{
+    OUFS *fs = (*fp).fs;
+    INODE inode;
+    BLOCK masterBlock;
+    int masterDirty = 0;
+
+    //A compressed file is resized in the buffer and rewritten whole.
+    if((*fp).compressed)
+    {
+        if(size > (BLOCK_SIZE*BLOCKS_PER_INODE) || oufs_buffer_compressed(fp) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        for(int i=0; i < BLOCKS_PER_INODE; i++)
+        {
+            int blockStart = i * BLOCK_SIZE;
+            if(!((*fp).dirty_blocks & (1 << i)))
+                memset((*fp).buffer[i].data, 0, BLOCK_SIZE);
+            else if(blockStart + BLOCK_SIZE > size) //Bytes past the new end of file read back as zeroes.
+                memset(&(*fp).buffer[i].data[MAX(size - blockStart, 0)], 0, BLOCK_SIZE - MAX(size - blockStart, 0));
+        }
+        (*fp).dirty_blocks = (unsigned short) ((1 << ((size + BLOCK_SIZE - 1) / BLOCK_SIZE)) - 1);
+        (*fp).size = size;
+        return oufs_flush(fp);
+    }
+
+    //Buffered data has to reach the disk before blocks are released or added.
+    oufs_txn_begin_r(fs);
+    if(oufs_flush(fp) != EXIT_SUCCESS)
+    {
+        oufs_txn_abort_r(fs);
+        return EXIT_FAILURE;
+    }
+
+    oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    oufs_read_master_r(fs, &masterBlock);
+
+    int status = oufs_resize_inode(fs, &inode, &masterBlock, (unsigned int) size, &masterDirty);
+    if(status == EXIT_SUCCESS)
+        (*fp).size = inode.size;
+
+    if(masterDirty)
+        vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+    oufs_write_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    if(oufs_txn_commit_r(fs) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return status;
+}
+/**
+ * Reserves blocks for a range of an open file before the data arrives.
+ *
+ * Every block in the range that has no backing store yet (including holes) is allocated
+ * in one contiguous run with a single master block update, and marked unwritten so that
+ * it reads as zeroes until data is flushed into it.  The file size is not changed.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param offset the first byte of the range.
+ * @param len the number of bytes in the range.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_fallocate(OUFILE *fp, int offset, int len)
+{
+    OUFS *fs = (*fp).fs;
+    INODE inode;
+    BLOCK masterBlock;
+    BLOCK_REFERENCE newBlocks[BLOCKS_PER_INODE];
+    BLOCK_REFERENCE goal = UNALLOCATED_BLOCK;
+    int nNew = 0;
+
+    if((*fp).mode != 'w' && (*fp).mode != 'a')
+    {
+        fprintf(stderr, "File cannot be preallocated - opened in '%c' mode.\n", (*fp).mode);
+        return EXIT_FAILURE;
+    }
+    if(offset < 0 || len < 0 || offset + len > (BLOCK_SIZE*BLOCKS_PER_INODE))
+    {
+        fprintf(stderr, "oufs_fallocate: invalid range (%d, %d).\n", offset, len);
+        return EXIT_FAILURE;
+    }
+
+    //A compressed file's blocks are only known once it is compressed at flush time.
+    if((*fp).compressed)
+        return EXIT_SUCCESS;
+
+    int firstBlock = offset / BLOCK_SIZE;
+    int lastBlock = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    oufs_lock_inode_r(fs, (*fp).inode_reference, 1);
+    oufs_read_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    for(int i=firstBlock; i < lastBlock; i++)
+    {
+        if(!BLOCK_IS_MAPPED(inode.data[i]))
+        {
+            if(nNew == 0 && i > 0 && BLOCK_IS_MAPPED(inode.data[i-1]))
+                goal = BLOCK_INDEX(inode.data[i-1]) + 1;
+            nNew++;
+        }
+    }
+    if(nNew == 0)
+    {
+        oufs_unlock_inode_r(fs, (*fp).inode_reference);
+        return EXIT_SUCCESS;
+    }
+
+    if(goal == UNALLOCATED_BLOCK)
+        goal = GROUP_FIRST_BLOCK(INODE_GROUP((*fp).inode_reference));
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &masterBlock);
+    if(oufs_allocate_block_run(&masterBlock, goal, nNew, newBlocks) != 0)
+    {
+        fprintf(stderr, "No more blocks available.\n");
+        oufs_txn_abort_r(fs);
+        oufs_unlock_inode_r(fs, (*fp).inode_reference);
+        return EXIT_FAILURE;
+    }
+    for(int i=firstBlock, j=0; i < lastBlock; i++)
+    {
+        if(!BLOCK_IS_MAPPED(inode.data[i]))
+            inode.data[i] = newBlocks[j++] | UNWRITTEN_BLOCK_FLAG;
+    }
+
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBlock);
+    oufs_write_inode_by_reference_r(fs, (*fp).inode_reference, &inode);
+    int status = oufs_txn_commit_r(fs);
+    oufs_unlock_inode_r(fs, (*fp).inode_reference);
+    return status;
+}
+/**
+ * Stores an open file compressed from now on.
+ *
+ * The whole file is compressed when the handle is flushed and decompressed by oufs_fread.
+ * Files that are already compressed stay compressed when rewritten or appended to.
+ *
+ * @param fp the OUFILE object representing the file opened previously.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int oufs_fcompress(OUFILE *fp)
+{
+    if((*fp).mode != 'w' && (*fp).mode != 'a')
+    {
+        fprintf(stderr, "File cannot be compressed - opened in '%c' mode.\n", (*fp).mode);
+        return EXIT_FAILURE;
+    }
+    if((*fp).compressed)
+        return EXIT_SUCCESS;
+
+    //Buffered plain data goes to disk first, so the whole file can be reloaded below.
+    OUFS *fs = (*fp).fs;
+    oufs_lock_inode_r(fs, (*fp).inode_reference, 1);
+    int status = oufs_flush(fp);
+
+    if(status == EXIT_SUCCESS)
+    {
+        (*fp).compressed = 1;
+        status = oufs_buffer_compressed(fp);
+        if(status != EXIT_SUCCESS)
+            (*fp).compressed = 0;
+    }
+    oufs_unlock_inode_r(fs, (*fp).inode_reference);
+    return status;
+}
+/**
+ * This function reads a file in the OU File System and saves it to a provided buffer.
+ * Holes and blocks that were reserved but never written are returned as zeroes without
+ * a disk read.  Compressed files are decompressed here.
+ * @param fp the OUFILE object representing the file opened previously.
+ * @param buf the buffer for the file to be read into.
+ * @param len the length of the file to be saved.
+ * @return system defined success value.
+ */
+int oufs_fread(OUFILE *fp, unsigned char *buf, int *len) {
+    if((*fp).mode != 'r')
+    {
+        fprintf(stderr, "File cannot be read - opened in '%c' mode.\n", (*fp).mode);
+        return EXIT_FAILURE;
+    }
+    return oufs_read_file_r((*fp).fs, (*fp).inode_reference, buf, len);
+}
+/**
+ * Reads a whole file, given its inode, into a provided buffer (see oufs_fread).  For callers
+ * that have found the inode themselves, such as a walk over a directory tree.
+ *
+ * Each run of adjacent blocks comes in with one positional read.
+ * @param fileINODE_REF the inode of the file.
+ * @param buf the buffer for the file to be read into (BLOCK_SIZE*BLOCKS_PER_INODE + 1 bytes).
+ * @param len the length of the file to be saved.
+ * @return system defined success value.
+ */
+int oufs_read_file_r(OUFS *fs, INODE_REFERENCE fileINODE_REF, unsigned char *buf, int *len) {
+    int bufLocation = 0;
+    int currentBlock;
+    DATA_BLOCK runMem[BLOCKS_PER_INODE];
+    INODE fileINODE;
+
+    //Readers of a file share its lock, so reads of different files (or the same one) run in parallel.
+    oufs_lock_inode_r(fs, fileINODE_REF, 0);
+    oufs_read_inode_by_reference_r(fs, fileINODE_REF, &fileINODE);
+
+    if(!IS_FILE_TYPE(fileINODE.type))
+    {
+        oufs_unlock_inode_r(fs, fileINODE_REF);
+        fprintf(stderr, "Inode %d is not a file.\n", fileINODE_REF);
+        return EXIT_FAILURE;
+    }
+    if(fileINODE.type == IT_COMPRESSED_FILE)
+    {
+        if(oufs_read_compressed(fs, &fileINODE, buf) != EXIT_SUCCESS)
+        {
+            oufs_unlock_inode_r(fs, fileINODE_REF);
+            return EXIT_FAILURE;
+        }
+        bufLocation = fileINODE.size;
+    }
+
+    while (bufLocation < fileINODE.size) //While there is still data to read.
+    {
+        currentBlock = bufLocation / BLOCK_SIZE; //Calculate the current block.
+        BLOCK_REFERENCE ref = fileINODE.data[currentBlock];
+
+        if(!BLOCK_IS_MAPPED(ref) || BLOCK_IS_UNWRITTEN(ref))
+        {
+            int chunk = MIN(BLOCK_SIZE, fileINODE.size - bufLocation);
+            memset(&buf[bufLocation], 0, chunk);
+            bufLocation += chunk;
+            continue;
+        }
+
+        //Blocks allocated together sit next to each other: read the whole run at once.
+        int run = 1;
+        while(currentBlock + run < BLOCKS_PER_INODE && (currentBlock + run) * BLOCK_SIZE < fileINODE.size
+              && fileINODE.data[currentBlock + run] == ref + run)
+            run++;
+        vdisk_read_blocks_r(fs->disk, ref, run, runMem);
+        int chunk = MIN(run * BLOCK_SIZE, fileINODE.size - bufLocation);
+        memcpy(&buf[bufLocation], runMem, chunk);
+        bufLocation += chunk;
+    }
+    oufs_unlock_inode_r(fs, fileINODE_REF);
+    buf[bufLocation] = 0;
+    *len = bufLocation;
+    return EXIT_SUCCESS;
+}
+/**
+ * This function removes a file reference or file from the OUFS file system.
+ *
+ * Note: the file data is still on the disk until it is overwritten.
+ * @param cwd the current working directory of the file system.
+ * @param path the user provided path.
+ * @return system defined success value.
+ */
+int oufs_remove_r(OUFS *fs, char *cwd, char *path)
+{
+    char local_name[FILE_NAME_SIZE];
+    INODE_REFERENCE parentINODE_REF, childINODE_REF;
+    INODE parentINODE, childINODE;
+    BLOCK parentBLOCK;
+    oufs_find_file_r(fs, cwd, path, &parentINODE_REF, &childINODE_REF, local_name);
+    if(oufs_is_dot_entry(local_name))
+    {
+        fprintf(stderr, "Cannot remove '%s'.\n", local_name);
+        return EXIT_FAILURE;
+    }
+
+    //Lock the parent and look the name up again, then lock the file.
+    oufs_lock_inode_r(fs, parentINODE_REF, 1);
+    childINODE_REF = oufs_lookup_entry(fs, parentINODE_REF, local_name, &parentINODE, &parentBLOCK);
+
+    //Check if child exists
+    if(childINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "File specified does not exist.\n");
+        oufs_unlock_inode_r(fs, parentINODE_REF);
+        return EXIT_FAILURE;
+    }
+
+    //Read the child inode.
+    oufs_lock_inode_r(fs, childINODE_REF, 1);
+    oufs_read_inode_by_reference_r(fs, childINODE_REF, &childINODE);
+
+    //Decrement the child inode number of references.
+    childINODE.n_references--;
+
+    //Remove the file entry from parent.
+    for(int i=0; i< DIRECTORY_ENTRIES_PER_BLOCK; i++)
+    {
+        if(parentBLOCK.directory.entry[i].inode_reference == childINODE_REF
+           && strncmp(parentBLOCK.directory.entry[i].name, local_name, FILE_NAME_SIZE) == 0)
+        {
+            parentBLOCK.directory.entry[i].inode_reference = UNALLOCATED_INODE; //Set entry reference to unalloc.
+            memset(parentBLOCK.directory.entry[i].name, 0, FILE_NAME_SIZE); //Set entry name to nulls.
+            break;
+        }
+
+    }
+    parentINODE.size--;
+    oufs_txn_begin_r(fs);
+    oufs_write_inode_by_reference_r(fs, parentINODE_REF, &parentINODE);
+    vdisk_write_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
+
+    //Check if file is ready for deletion
+    if(childINODE.n_references < 1)
+    {
+        BLOCK masterBLOCK;
+        oufs_read_master_r(fs, &masterBLOCK);
+        //Remove all references
+        for(int i=0; i < BLOCKS_PER_INODE; i++)
+        {
+            if(BLOCK_IS_MAPPED(childINODE.data[i])) //Holes have nothing to deallocate.
+                oufs_release_block_r(fs, &masterBLOCK, BLOCK_INDEX(childINODE.data[i])); //Deallocate block (or drop a clone's share)
+            childINODE.data[i] = UNALLOCATED_BLOCK;
+        }
+        childINODE.size = 0;
+        childINODE.type = IT_NONE;
+        oufs_write_inode_by_reference_r(fs, childINODE_REF, &childINODE); //Write clean inode to inode block.
+
+        RESET_BIT(masterBLOCK.master.inode_allocated_flag, childINODE_REF); //Deallocate inode.
+
+        vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK); //Write master block.
+    }
+    oufs_write_inode_by_reference_r(fs, childINODE_REF, &childINODE);
+    int status = oufs_txn_commit_r(fs);
+    oufs_unlock_inode_r(fs, childINODE_REF);
+    oufs_unlock_inode_r(fs, parentINODE_REF);
+    return status;
+}
+/**
+ * Links a currently existing file to a new location in the file system.
+ * @param cwd the current working directory determined in ENV.
+ * @param path_src the path to a file to link to
+ * @param path_dst the path to a file to be created as a link.
+ * @return system defined success value.
+ */
+int oufs_link_r(OUFS *fs, char *cwd, char *path_src, char *path_dst)
+{
+    INODE_REFERENCE srcChildINODE_REF, srcParentINODE_REF, dstChildINODE_REF, dstParentINODE_REF;
+    INODE srcChildINODE, dstParentINODE;
+    char srcLocalName[FILE_NAME_SIZE];
+    char dstLocalName[FILE_NAME_SIZE];
+    BLOCK dstParentBLOCK;
+
+    //Discover the parent and destination locations
+    oufs_find_file_r(fs, cwd, path_src, &srcParentINODE_REF, &srcChildINODE_REF, srcLocalName);
+    oufs_find_file_r(fs, cwd, path_dst, &dstParentINODE_REF, &dstChildINODE_REF, dstLocalName);
+
+    //Ensure source child does exist.
+    if(srcChildINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "Source file does not exist.\n");
+        return EXIT_FAILURE;
+    }
+
+    //Ensure the destination parent exists.
+    if(dstParentINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "Source parent does not exist.\n");
+        return EXIT_FAILURE;
+    }
+
+    //Ensure source child is a file: only files are locked after a directory that does not hold them.
+    oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE);
+    if(!IS_FILE_TYPE(srcChildINODE.type))
+    {
+        fprintf(stderr, "Source is not a file.\n");
+        return EXIT_FAILURE;
+    }
+
+    //Lock the destination parent, then the file; both are checked again under the locks.
+    oufs_lock_inode_r(fs, dstParentINODE_REF, 1);
+    dstChildINODE_REF = oufs_lookup_entry(fs, dstParentINODE_REF, dstLocalName, &dstParentINODE, &dstParentBLOCK);
+    oufs_lock_inode_r(fs, srcChildINODE_REF, 1);
+    oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE);
+
+    int status = EXIT_FAILURE;
+    if(dstParentINODE.type != IT_DIRECTORY)
+        fprintf(stderr, "Source parent does not exist.\n");
+    else if(dstChildINODE_REF != UNALLOCATED_INODE) //Ensure destination does not exist.
+        fprintf(stderr, "Destination file already exists.\n");
+    else if(!IS_FILE_TYPE(srcChildINODE.type) || srcChildINODE.n_references == 0)
+        fprintf(stderr, "Source file does not exist.\n");
+    else if(dstParentINODE.size >= INODES_PER_BLOCK) //Check if the destination parent has room.
+        fprintf(stderr, "Source parent is full.\n");
+    else
+    {
+        //Find empty entry in destination parent directory block.
+        for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
+        {
+            if(dstParentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE)
+            {
+                dstParentBLOCK.directory.entry[i].inode_reference = srcChildINODE_REF; //Set the available entry to src
+                strncpy(dstParentBLOCK.directory.entry[i].name, dstLocalName, FILE_NAME_SIZE-1); //Copy dst name.
+                dstParentBLOCK.directory.entry[i].name[FILE_NAME_SIZE-1] = 0; //Null terminate if full
+                dstParentINODE.size++; //Increment num directories in parent inode.
+                break;
+            }
+        }
+
+        //Increment number of references on src child inode.
+        srcChildINODE.n_references++;
+
+        //Write changes to disk.
+        oufs_txn_begin_r(fs);
+        vdisk_write_block_r(fs->disk, dstParentINODE.data[0], &dstParentBLOCK);
+        oufs_write_inode_by_reference_r(fs, dstParentINODE_REF, &dstParentINODE);
+        oufs_write_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE);
+        status = oufs_txn_commit_r(fs);
+    }
+    oufs_unlock_inode_r(fs, srcChildINODE_REF);
+    oufs_unlock_inode_r(fs, dstParentINODE_REF);
+    return status;
+}
+/**
+ * Adds a clone of a file's inode to a directory (see oufs_clone).  The caller holds the
+ * directory locked exclusively and the source locked.
+ * @param srcChildINODE the inode of the file to clone.
+ * @param dstParentINODE_REF the directory the clone is added to.
+ * @param dstParentINODE the inode of that directory.
+ * @param dstParentBLOCK the directory block.
+ * @param dstLocalName the name of the clone.
+ * @return system defined success value.
+ */
+static int oufs_clone_inode(OUFS *fs, INODE *srcChildINODE, INODE_REFERENCE dstParentINODE_REF, INODE *dstParentINODE,
+                            BLOCK *dstParentBLOCK, char *dstLocalName)
+{
+    BLOCK masterBLOCK;
+
+    //Allocate the new inode, in the destination directory's allocation group if possible.
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &masterBLOCK);
+    int newINODE_REFERENCE = oufs_allocate_inode(&masterBLOCK, INODE_GROUP(dstParentINODE_REF));
+    if(newINODE_REFERENCE < 1 || newINODE_REFERENCE >= N_INODES)
+    {
+        fprintf(stderr, "oufs_clone: no available inodes. Exiting...\n");
+        oufs_txn_abort_r(fs);
+        return EXIT_FAILURE;
+    }
+
+    //Share every block of the source with the clone.  A block whose share count is full (deduplication
+    //  can take it to UCHAR_MAX) is copied instead.
+    INODE cloneINODE = *srcChildINODE;
+    cloneINODE.n_references = 1;
+    for(int i=0; i < BLOCKS_PER_INODE; i++)
+    {
+        if(!BLOCK_IS_MAPPED(cloneINODE.data[i]))
+            continue;
+        BLOCK_REFERENCE shared = BLOCK_INDEX(cloneINODE.data[i]);
+        if(masterBLOCK.master.block_share_count[shared] < UCHAR_MAX)
+        {
+            ++masterBLOCK.master.block_share_count[shared];
+            continue;
+        }
+
+        BLOCK_REFERENCE copy;
+        BLOCK dataBLOCK;
+        if(oufs_allocate_block_run(&masterBLOCK, GROUP_FIRST_BLOCK(INODE_GROUP(newINODE_REFERENCE)), 1, &copy) != 0)
+        {
+            fprintf(stderr, "oufs_clone: no available blocks. Exiting...\n");
+            oufs_txn_abort_r(fs);
+            return EXIT_FAILURE;
+        }
+        if(!BLOCK_IS_UNWRITTEN(cloneINODE.data[i])) //Unwritten blocks read as zeroes whatever they hold.
+        {
+            vdisk_read_block_r(fs->disk, shared, &dataBLOCK);
+            vdisk_write_data_block_r(fs->disk, copy, &dataBLOCK);
+        }
+        cloneINODE.data[i] = copy | (cloneINODE.data[i] & UNWRITTEN_BLOCK_FLAG);
+    }
+
+    //Add the clone to the destination parent.
+    for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
+    {
+        if((*dstParentBLOCK).directory.entry[i].inode_reference == UNALLOCATED_INODE)
+        {
+            (*dstParentBLOCK).directory.entry[i].inode_reference = (INODE_REFERENCE) newINODE_REFERENCE;
+            strncpy((*dstParentBLOCK).directory.entry[i].name, dstLocalName, FILE_NAME_SIZE-1);
+            (*dstParentBLOCK).directory.entry[i].name[FILE_NAME_SIZE-1] = 0; //Null terminate if full
+            (*dstParentINODE).size++;
+            break;
+        }
+    }
+
+    //Write changes to disk.
+    vdisk_write_block_r(fs->disk, (*dstParentINODE).data[0], dstParentBLOCK);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK);
+    oufs_write_inode_by_reference_r(fs, (INODE_REFERENCE) newINODE_REFERENCE, &cloneINODE);
+    oufs_write_inode_by_reference_r(fs, dstParentINODE_REF, dstParentINODE);
+    return oufs_txn_commit_r(fs);
+}
+/**
+ * Creates an independent copy of a file that shares the source's data blocks.
+ *
+ * The new inode gets a copy of the source's block map and every mapped block gains a
+ * share; no data is copied.  The first write to a shared block through either file
+ * copies it (see oufs_fflush), so the two files can then diverge.
+ * @param cwd the current working directory determined in ENV.
+ * @param path_src the path to the file to clone.
+ * @param path_dst the path of the file to be created.
+ * @return system defined success value.
+ */
+int oufs_clone_r(OUFS *fs, char *cwd, char *path_src, char *path_dst)
+{
+    INODE_REFERENCE srcChildINODE_REF, srcParentINODE_REF, dstChildINODE_REF, dstParentINODE_REF;
+    INODE srcChildINODE, dstParentINODE;
+    char srcLocalName[FILE_NAME_SIZE];
+    char dstLocalName[FILE_NAME_SIZE];
+    BLOCK dstParentBLOCK;
+
+    //Discover the parent and destination locations
+    if(oufs_find_file_r(fs, cwd, path_src, &srcParentINODE_REF, &srcChildINODE_REF, srcLocalName) == EXIT_FAILURE
+       || oufs_find_file_r(fs, cwd, path_dst, &dstParentINODE_REF, &dstChildINODE_REF, dstLocalName) == EXIT_FAILURE)
+    {
+        fprintf(stderr, "Unable to traverse CWD or provided path.\n");
+        return EXIT_FAILURE;
+    }
+
+    //Ensure source child does exist and is a file.
+    if(srcChildINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "Source file does not exist.\n");
+        return EXIT_FAILURE;
+    }
+    oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE);
+    if(!IS_FILE_TYPE(srcChildINODE.type))
+    {
+        fprintf(stderr, "Source is not a file.\n");
+        return EXIT_FAILURE;
+    }
 
-                inode.size++;
-                (*fp).offset++;
-                bufLocation++;
+    //Lock the destination parent, then the source file; both are checked again under the locks.
+    oufs_lock_inode_r(fs, dstParentINODE_REF, 1);
+    dstChildINODE_REF = oufs_lookup_entry(fs, dstParentINODE_REF, dstLocalName, &dstParentINODE, &dstParentBLOCK);
+    oufs_lock_inode_r(fs, srcChildINODE_REF, 0);
+    oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE);
 
-                //If block full, buf empty, or file full.
-                if((offsetInBlock >= (BLOCK_SIZE - 1)) || (bufLocation >= (len-1)) || (bufLocation >= (BLOCK_SIZE*BLOCKS_PER_INODE)))
-                {
-                    vdisk_write_block(inode.data[blkInMem], &blockMem); //Write the block.
-                }
-            }
+    int status = EXIT_FAILURE;
+    if(!IS_FILE_TYPE(srcChildINODE.type) || srcChildINODE.n_references == 0)
+        fprintf(stderr, "Source file does not exist.\n");
+    else if(dstChildINODE_REF != UNALLOCATED_INODE) //Ensure destination does not exist and its parent has room.
+        fprintf(stderr, "Destination file already exists.\n");
+    else if(dstParentINODE.type != IT_DIRECTORY || dstParentINODE.size >= DIRECTORY_ENTRIES_PER_BLOCK)
+        fprintf(stderr, "Destination parent is full.\n");
+    else
+        status = oufs_clone_inode(fs, &srcChildINODE, dstParentINODE_REF, &dstParentINODE, &dstParentBLOCK, dstLocalName);
+    oufs_unlock_inode_r(fs, srcChildINODE_REF);
+    oufs_unlock_inode_r(fs, dstParentINODE_REF);
+    return status;
+}
+/**
+ * Checks whether a directory lies in the tree under another one, by following ".." up to
+ * the root.  The caller holds the rename lock, so no directory moves meanwhile.
+ * @param ancestor the top of the tree.
+ * @param dir the directory to look for.
+ * @return 1 if dir is ancestor or is under it, otherwise 0.
+ */
+static int oufs_is_ancestor(OUFS *fs, INODE_REFERENCE ancestor, INODE_REFERENCE dir)
+{
+    INODE dirINODE;
+    BLOCK dirBLOCK;
 
-            vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBlock); //Write the master block.
-            oufs_write_inode_by_reference((*fp).inode_reference, &inode); //Write the inode.
-            return EXIT_SUCCESS;
-        case 'r' :
-            fprintf(stderr, "File in read only mode - cannot write.\n");
-            return EXIT_FAILURE;
-        default:
-            return EXIT_FAILURE;
+    for(int depth=0; depth < N_INODES; ++depth)
+    {
+        if(dir == ancestor)
+            return 1;
+        if(dir == 0 || dir >= N_INODES || !oufs_read_directory(fs, dir, &dirINODE, &dirBLOCK))
+            return 0;
+        dir = dirBLOCK.directory.entry[1].inode_reference;
     }
+    return 0;
 }
 /**
- * This function reads a file in the OU File System and saves it to a provided buffer.
- * @param fp the OUFILE object representing the file opened previously.
- * @param buf the buffer for the file to be read into.
- * @param len the length of the file to be saved.
+ * Renames a file or directory, moving it to another directory if need be.  Only directory
+ * entries change (and the ".." of a moved directory); the inode and its data stay where they
+ * are.  The change is made in one transaction, so no other operation sees both names or
+ * neither.
+ * @param cwd the current working directory determined in ENV.
+ * @param path_src the path of the file or directory to rename.
+ * @param path_dst its new path, which must not exist yet.
  * @return system defined success value.
  */
-int oufs_fread(OUFILE *fp, unsigned char *buf, int *len) {
-
-    int bufLocation = 0;
-    int offsetInBlock;
-    int currentBlock;
-    int blkInMem = -1;
-    BLOCK blockMem;
-    INODE fileINODE;
+int oufs_rename_r(OUFS *fs, char *cwd, char *path_src, char *path_dst)
+{
+    INODE_REFERENCE srcChildINODE_REF, srcParentINODE_REF, dstChildINODE_REF, dstParentINODE_REF;
+    INODE srcChildINODE, srcParentINODE, dstParentINODE;
+    BLOCK srcParentBLOCK, dstParentBLOCK, childBLOCK;
+    char srcLocalName[FILE_NAME_SIZE];
+    char dstLocalName[FILE_NAME_SIZE];
 
-    if((*fp).mode != 'r')
+    //Discover the parent and destination locations
+    if(oufs_find_file_r(fs, cwd, path_src, &srcParentINODE_REF, &srcChildINODE_REF, srcLocalName) == EXIT_FAILURE
+       || oufs_find_file_r(fs, cwd, path_dst, &dstParentINODE_REF, &dstChildINODE_REF, dstLocalName) == EXIT_FAILURE)
     {
-        fprintf(stderr, "File cannot be read - opened in '%c' mode.\n", (*fp).mode);
+        fprintf(stderr, "Unable to traverse CWD or provided path.\n");
+        return EXIT_FAILURE;
+    }
+    if(oufs_is_dot_entry(srcLocalName) || oufs_is_dot_entry(dstLocalName))
+    {
+        fprintf(stderr, "Cannot rename '%s'.\n", oufs_is_dot_entry(srcLocalName) ? srcLocalName : dstLocalName);
+        return EXIT_FAILURE;
+    }
+    if(srcChildINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "Source file does not exist.\n");
+        return EXIT_FAILURE;
+    }
+    if(dstParentINODE_REF == UNALLOCATED_INODE)
+    {
+        fprintf(stderr, "Destination parent does not exist.\n");
         return EXIT_FAILURE;
     }
 
-    oufs_read_inode_by_reference((*fp).inode_reference, &fileINODE);
-
-    while (bufLocation < fileINODE.size) //While there is still data to write.
+    //Two directories: nothing but a rename locks two unrelated directories, and renames take
+    //turns, so locking the ancestor first (or the lower inode, for unrelated ones) cannot deadlock.
+    INODE_REFERENCE firstINODE_REF = srcParentINODE_REF, secondINODE_REF = dstParentINODE_REF;
+    int sameParent = (srcParentINODE_REF == dstParentINODE_REF);
+    if(!sameParent)
     {
-        offsetInBlock = bufLocation % 256; //Calculate the current position in block.
-        currentBlock = (bufLocation - offsetInBlock) / 256; //Calculate the current block.
+        pthread_mutex_lock(&fs->rename_lock);
 
-        if(blkInMem != currentBlock) //Read in current block if necessary.
+        //A directory cannot move into its own tree.
+        if(oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE) == 0 && srcChildINODE.type == IT_DIRECTORY
+           && oufs_is_ancestor(fs, srcChildINODE_REF, dstParentINODE_REF))
+        {
+            fprintf(stderr, "Cannot move a directory into itself.\n");
+            pthread_mutex_unlock(&fs->rename_lock);
+            return EXIT_FAILURE;
+        }
+        if(oufs_is_ancestor(fs, dstParentINODE_REF, srcParentINODE_REF)
+           || (!oufs_is_ancestor(fs, srcParentINODE_REF, dstParentINODE_REF) && dstParentINODE_REF < srcParentINODE_REF))
+        {
+            firstINODE_REF = dstParentINODE_REF;
+            secondINODE_REF = srcParentINODE_REF;
+        }
+    }
+
+    //Lock the parents, look both names up again, then lock the entry being moved.
+    oufs_lock_inode_r(fs, firstINODE_REF, 1);
+    if(!sameParent)
+        oufs_lock_inode_r(fs, secondINODE_REF, 1);
+    INODE_REFERENCE movedINODE_REF = oufs_lookup_entry(fs, srcParentINODE_REF, srcLocalName, &srcParentINODE, &srcParentBLOCK);
+    dstChildINODE_REF = oufs_lookup_entry(fs, dstParentINODE_REF, dstLocalName, &dstParentINODE, &dstParentBLOCK);
+    if(!sameParent && movedINODE_REF != srcChildINODE_REF) //Replaced since it was checked for a move into itself.
+        movedINODE_REF = UNALLOCATED_INODE;
+    oufs_lock_inode_r(fs, movedINODE_REF, 1);
+
+    int status = EXIT_FAILURE;
+    if(movedINODE_REF == UNALLOCATED_INODE || oufs_read_inode_by_reference_r(fs, movedINODE_REF, &srcChildINODE) != 0
+       || srcChildINODE.type == IT_NONE)
+        fprintf(stderr, "Source file does not exist.\n");
+    else if(dstParentINODE.type != IT_DIRECTORY)
+        fprintf(stderr, "Destination parent does not exist.\n");
+    else if(sameParent && strncmp(srcLocalName, dstLocalName, FILE_NAME_SIZE) == 0)
+        status = EXIT_SUCCESS; //Renamed to itself.
+    else if(dstChildINODE_REF != UNALLOCATED_INODE)
+        fprintf(stderr, "Destination file already exists.\n");
+    else if(!sameParent && dstParentINODE.size >= DIRECTORY_ENTRIES_PER_BLOCK)
+        fprintf(stderr, "Destination parent is full.\n");
+    else
+    {
+        int srcEntry, dstEntry = -1;
+        for(srcEntry=0; srcEntry < DIRECTORY_ENTRIES_PER_BLOCK; srcEntry++)
         {
+            if(strncmp(srcParentBLOCK.directory.entry[srcEntry].name, srcLocalName, FILE_NAME_SIZE) == 0)
+                break;
+        }
 
-            vdisk_read_block(fileINODE.data[currentBlock], &blockMem);
-            blkInMem = currentBlock;
+        oufs_txn_begin_r(fs);
+        if(sameParent)
+        {
+            //Same directory: only the name changes.
+            memset(srcParentBLOCK.directory.entry[srcEntry].name, 0, FILE_NAME_SIZE);
+            strncpy(srcParentBLOCK.directory.entry[srcEntry].name, dstLocalName, FILE_NAME_SIZE-1);
+            vdisk_write_block_r(fs->disk, srcParentINODE.data[0], &srcParentBLOCK);
+        }
+        else
+        {
+            //Take the entry out of the source parent and put it in the destination parent.
+            oufs_clean_directory_entry(&srcParentBLOCK.directory.entry[srcEntry]);
+            srcParentINODE.size--;
+            for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK && dstEntry < 0; i++)
+            {
+                if(dstParentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE)
+                    dstEntry = i;
+            }
+            memset(dstParentBLOCK.directory.entry[dstEntry].name, 0, FILE_NAME_SIZE);
+            strncpy(dstParentBLOCK.directory.entry[dstEntry].name, dstLocalName, FILE_NAME_SIZE-1);
+            dstParentBLOCK.directory.entry[dstEntry].inode_reference = movedINODE_REF;
+            dstParentINODE.size++;
+
+            vdisk_write_block_r(fs->disk, srcParentINODE.data[0], &srcParentBLOCK);
+            oufs_write_inode_by_reference_r(fs, srcParentINODE_REF, &srcParentINODE);
+            vdisk_write_block_r(fs->disk, dstParentINODE.data[0], &dstParentBLOCK);
+            oufs_write_inode_by_reference_r(fs, dstParentINODE_REF, &dstParentINODE);
+
+            //A moved directory's ".." names its new parent.
+            if(srcChildINODE.type == IT_DIRECTORY)
+            {
+                vdisk_read_block_r(fs->disk, srcChildINODE.data[0], &childBLOCK);
+                childBLOCK.directory.entry[1].inode_reference = dstParentINODE_REF;
+                vdisk_write_block_r(fs->disk, srcChildINODE.data[0], &childBLOCK);
+            }
         }
+        status = oufs_txn_commit_r(fs);
+    }
+    oufs_unlock_inode_r(fs, movedINODE_REF);
+    if(!sameParent)
+    {
+        oufs_unlock_inode_r(fs, secondINODE_REF);
+        oufs_unlock_inode_r(fs, firstINODE_REF);
+        pthread_mutex_unlock(&fs->rename_lock);
+    }
+    else
+        oufs_unlock_inode_r(fs, firstINODE_REF);
+    return status;
+}
+// One entry of a tree being removed or copied, in the order the walk reached it
+typedef struct tree_node_s {
+    INODE_REFERENCE inode;
+    int parent; //Node of the directory holding the entry; -1 for the top of the tree.
+    char name[FILE_NAME_SIZE];
+
+    //The copy (oufs_copy_tree): its inode, and its directory block in dirBLOCKS if it is a directory.
+    INODE_REFERENCE copy;
+    INODE copyINODE;
+    int dirSlot;
+} TREE_NODE;
+
+// A tree walked by oufs_tree_walk: every inode in it locked and read once, however often
+// the tree links to it, and every entry in it.
+typedef struct tree_s {
+    int exclusive;
+    INODE_REFERENCE avoid; //A directory the walk must not reach (it is locked already).
+
+    int n_locked;
+    INODE_REFERENCE locked[N_INODES];
+    unsigned char references[N_INODES]; //Entries in the tree naming each inode.
+    INODE inode[N_INODES];
+
+    int n_nodes;
+    TREE_NODE nodes[N_INODES * DIRECTORY_ENTRIES_PER_BLOCK];
+    int n_dirs;
+    BLOCK dirBLOCKS[N_INODES];
+} TREE;
 
-        buf[bufLocation] = blockMem.data.data[offsetInBlock];
+/**
+ * Walks a tree from an entry down, locking each directory the first time it is reached (a
+ * directory before its entries) and listing the entries in preorder.  Files are only read
+ * here: oufs_tree_lock_files locks them once every directory is locked.  The caller holds
+ * the rename lock and the directory the entry is in, and unlocks tree->locked when done.
+ * @param ref the inode of the entry.
+ * @param parentNode the node of the directory holding the entry (-1 for the top).
+ * @param name the name of the entry.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_tree_walk(OUFS *fs, TREE *tree, INODE_REFERENCE ref, int parentNode, char *name)
+{
+    if(ref >= N_INODES || ref == (*tree).avoid)
+    {
+        fprintf(stderr, "Cannot walk '%s': it is not a file or directory of the tree.\n", name);
+        return EXIT_FAILURE;
+    }
 
-        bufLocation++;
+    //The entry cannot go away while its directory is locked, so neither can its inode's type.
+    INODE *inode = &(*tree).inode[ref];
+    if((*tree).references[ref] == 0)
+    {
+        oufs_read_inode_by_reference_r(fs, ref, inode);
+        if((*inode).type == IT_DIRECTORY)
+        {
+            oufs_lock_inode_r(fs, ref, (*tree).exclusive);
+            (*tree).locked[(*tree).n_locked++] = ref;
+            oufs_read_inode_by_reference_r(fs, ref, inode);
+        }
+    }
+    (*tree).references[ref]++;
 
+    if((*inode).type == IT_NONE || ((*inode).type == IT_DIRECTORY && (*tree).references[ref] > 1))
+    {
+        fprintf(stderr, "Cannot walk '%s': the file system needs checking (zfsck).\n", name);
+        return EXIT_FAILURE;
+    }
+
+    TREE_NODE *node = &(*tree).nodes[(*tree).n_nodes];
+    (*node).inode = ref;
+    (*node).parent = parentNode;
+    strncpy((*node).name, name, FILE_NAME_SIZE-1);
+    (*node).name[FILE_NAME_SIZE-1] = 0;
+    int nodeIndex = (*tree).n_nodes++;
+    if((*inode).type != IT_DIRECTORY)
+        return EXIT_SUCCESS;
+
+    BLOCK dirBLOCK;
+    vdisk_read_block_r(fs->disk, (*inode).data[0], &dirBLOCK);
+    for(int i=2; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
+    {
+        DIRECTORY_ENTRY *entry = &dirBLOCK.directory.entry[i];
+        if((*entry).inode_reference == UNALLOCATED_INODE || strnlen((*entry).name, FILE_NAME_SIZE) == 0)
+            continue;
+        if(oufs_tree_walk(fs, tree, (*entry).inode_reference, nodeIndex, (*entry).name) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
     }
-    buf[bufLocation] = 0;
-    *len = bufLocation;
     return EXIT_SUCCESS;
 }
 /**
- * This function removes a file reference or file from the OUFS file system.
- *
- * Note: the file data is still on the disk until it is overwritten.
- * @param cwd the current working directory of the file system.
- * @param path the user provided path.
- * @return system defined success value.
+ * Locks and reads the files of a walked tree, in inode order, after all of its directories:
+ * oufs_link and oufs_clone lock a directory and then a file it need not hold, so a file is
+ * never locked before a directory.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int oufs_tree_lock_files(OUFS *fs, TREE *tree)
+{
+    for(INODE_REFERENCE ref=0; ref < N_INODES; ref++)
+    {
+        if((*tree).references[ref] == 0 || (*tree).inode[ref].type == IT_DIRECTORY)
+            continue;
+        oufs_lock_inode_r(fs, ref, (*tree).exclusive);
+        (*tree).locked[(*tree).n_locked++] = ref;
+        oufs_read_inode_by_reference_r(fs, ref, &(*tree).inode[ref]);
+        if(!IS_FILE_TYPE((*tree).inode[ref].type))
+        {
+            fprintf(stderr, "Cannot lock file %d: the file system needs checking (zfsck).\n", ref);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+/**
+ * Unlocks the inodes of a walked tree, the last locked first.
+ */
+static void oufs_tree_unlock(OUFS *fs, TREE *tree)
+{
+    for(int i=(*tree).n_locked-1; i >= 0; i--)
+        oufs_unlock_inode_r(fs, (*tree).locked[i]);
+}
+/**
+ * Removes a file, or a directory with everything under it.  The tree is walked once with
+ * every inode in it locked, then the whole removal is applied in one transaction: the
+ * allocation tables are changed in one master block update, and only the parent directory,
+ * the parent's inode block and the inode blocks of the tree are written.  A file with links
+ * outside the tree only loses the links inside it.
+ * @param cwd the current working directory determined in ENV.
+ * @param path the path of the file or directory to remove.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_remove(char *cwd, char *path)
+int oufs_remove_tree_r(OUFS *fs, char *cwd, char *path)
 {
     char local_name[FILE_NAME_SIZE];
     INODE_REFERENCE parentINODE_REF, childINODE_REF;
-    INODE parentINODE, childINODE;
-    BLOCK parentBLOCK;
-    oufs_find_file(cwd, path, &parentINODE_REF, &childINODE_REF, local_name);
+    INODE parentINODE;
+    BLOCK parentBLOCK, masterBLOCK;
 
-    //Check if child exists
-    if(childINODE_REF == UNALLOCATED_INODE)
+    if(oufs_find_file_r(fs, cwd, path, &parentINODE_REF, &childINODE_REF, local_name) == EXIT_FAILURE)
     {
-        fprintf(stderr, "File specified does not exist.\n");
+        fprintf(stderr, "Unable to traverse CWD or provided path.\n");
         return EXIT_FAILURE;
     }
+    if(oufs_is_dot_entry(local_name))
+    {
+        fprintf(stderr, "Cannot remove '%s'.\n", local_name);
+        return EXIT_FAILURE;
+    }
+    TREE *tree = calloc(1, sizeof(TREE));
+    if(tree == NULL)
+        return EXIT_FAILURE;
+    (*tree).exclusive = 1;
+    (*tree).avoid = parentINODE_REF;
 
-    //Read the inodes.
-    oufs_read_inode_by_reference(parentINODE_REF, &parentINODE);
-    oufs_read_inode_by_reference(childINODE_REF, &childINODE);
-
-    //Read the parent block.
-    vdisk_read_block(parentINODE.data[0], &parentBLOCK);
-
-    //Decrement the child inode number of references.
-    childINODE.n_references--;
+    //No rename may lock two directories of the tree meanwhile (see oufs_rename); the parent, then the tree.
+    pthread_mutex_lock(&fs->rename_lock);
+    oufs_lock_inode_r(fs, parentINODE_REF, 1);
+    childINODE_REF = oufs_lookup_entry(fs, parentINODE_REF, local_name, &parentINODE, &parentBLOCK);
 
-    //Remove the file entry from parent.
-    for(int i=0; i< BLOCKS_PER_INODE; i++)
+    int status = EXIT_FAILURE;
+    if(childINODE_REF == UNALLOCATED_INODE)
+        fprintf(stderr, "File specified does not exist.\n");
+    else if(oufs_tree_walk(fs, tree, childINODE_REF, -1, local_name) == EXIT_SUCCESS
+            && oufs_tree_lock_files(fs, tree) == EXIT_SUCCESS)
     {
-        if(parentBLOCK.directory.entry[i].inode_reference == childINODE_REF)
+        oufs_txn_begin_r(fs);
+        oufs_read_master_r(fs, &masterBLOCK);
+        for(int k=0; k < (*tree).n_locked; k++)
         {
-            parentBLOCK.directory.entry[i].inode_reference = UNALLOCATED_INODE; //Set entry reference to unalloc.
-            memset(parentBLOCK.directory.entry[i].name, 0, FILE_NAME_SIZE); //Set entry name to nulls.
-            break;
-        }
+            INODE_REFERENCE ref = (*tree).locked[k];
+            INODE *inode = &(*tree).inode[ref];
 
-    }
-    parentINODE.size--;
-    oufs_write_inode_by_reference(parentINODE_REF, &parentINODE);
-    vdisk_write_block(parentINODE.data[0], &parentBLOCK);
+            //Drop the links inside the tree; free what has none left.
+            if((*inode).type != IT_DIRECTORY && (*inode).n_references > (*tree).references[ref])
+                (*inode).n_references -= (*tree).references[ref];
+            else
+            {
+                for(int i=0; i < BLOCKS_PER_INODE; i++)
+                {
+                    if(BLOCK_IS_MAPPED((*inode).data[i])) //Holes have nothing to deallocate.
+                        oufs_release_block_r(fs, &masterBLOCK, BLOCK_INDEX((*inode).data[i]));
+                    (*inode).data[i] = UNALLOCATED_BLOCK;
+                }
+                oufs_inode_reset(inode);
+                RESET_BIT(masterBLOCK.master.inode_allocated_flag, ref);
+            }
+            oufs_write_inode_by_reference_r(fs, ref, inode);
+        }
 
-    //Check if file is ready for deletion
-    if(childINODE.n_references < 1)
-    {
-        BLOCK masterBLOCK;
-        vdisk_read_block(MASTER_BLOCK_REFERENCE, &masterBLOCK);
-        //Remove all references
-        for(int i=0; i < BLOCKS_PER_INODE; i++)
+        //Take the entry out of the parent.
+        for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
         {
-            if(childINODE.data[i] == UNALLOCATED_BLOCK) {
+            if(strncmp(parentBLOCK.directory.entry[i].name, local_name, FILE_NAME_SIZE) == 0)
+            {
+                oufs_clean_directory_entry(&parentBLOCK.directory.entry[i]);
+                parentINODE.size--;
                 break;
             }
-            RESET_BIT(masterBLOCK.master.block_allocated_flag, childINODE.data[i]); //Deallocate block
-            childINODE.data[i] = UNALLOCATED_BLOCK;
         }
-        childINODE.size = 0;
-        childINODE.type = IT_NONE;
-        oufs_write_inode_by_reference(childINODE_REF, &childINODE); //Write clean inode to inode block.
-
-        RESET_BIT(masterBLOCK.master.inode_allocated_flag, childINODE_REF); //Deallocate inode.
-
-        vdisk_write_block(MASTER_BLOCK_REFERENCE, &masterBLOCK); //Write master block.
+        vdisk_write_block_r(fs->disk, parentINODE.data[0], &parentBLOCK);
+        oufs_write_inode_by_reference_r(fs, parentINODE_REF, &parentINODE);
+        vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK);
+        status = oufs_txn_commit_r(fs);
     }
-    oufs_write_inode_by_reference(childINODE_REF, &childINODE);
-    return EXIT_SUCCESS;
+    oufs_tree_unlock(fs, tree);
+    oufs_unlock_inode_r(fs, parentINODE_REF);
+    pthread_mutex_unlock(&fs->rename_lock);
+    free(tree);
+    return status;
 }
 /**
- * Links a currently existing file to a new location in the file system.
+ * Copies a file, or a directory with everything under it.  The source tree is walked once
+ * under shared locks; then every inode and block of the copy is allocated in one master block
+ * update, and the copy is written in one transaction.  A file's blocks are allocated as one
+ * run, holes stay holes and unwritten (preallocated) blocks are not copied.  A file linked
+ * more than once in the tree is copied once per link.
  * @param cwd the current working directory determined in ENV.
- * @param path_src the path to a file to link to
- * @param path_dst the path to a file to be created as a link.
- * @return system defined success value.
+ * @param path_src the path of the file or directory to copy.
+ * @param path_dst the path of the copy, which must not exist yet.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
  */
-int oufs_link(char *cwd, char *path_src, char *path_dst)
+int oufs_copy_tree_r(OUFS *fs, char *cwd, char *path_src, char *path_dst)
 {
     INODE_REFERENCE srcChildINODE_REF, srcParentINODE_REF, dstChildINODE_REF, dstParentINODE_REF;
     INODE srcChildINODE, dstParentINODE;
+    BLOCK dstParentBLOCK, masterBLOCK, dataBLOCK;
     char srcLocalName[FILE_NAME_SIZE];
     char dstLocalName[FILE_NAME_SIZE];
-    BLOCK dstParentBLOCK;
 
-    //Discover the parent and destination locations
-    oufs_find_file(cwd, path_src, &srcParentINODE_REF, &srcChildINODE_REF, srcLocalName);
-    oufs_find_file(cwd, path_dst, &dstParentINODE_REF, &dstChildINODE_REF, dstLocalName);
-
-    //Ensure destination does not exist.
-    if(dstChildINODE_REF != UNALLOCATED_INODE)
+    if(oufs_find_file_r(fs, cwd, path_src, &srcParentINODE_REF, &srcChildINODE_REF, srcLocalName) == EXIT_FAILURE
+       || oufs_find_file_r(fs, cwd, path_dst, &dstParentINODE_REF, &dstChildINODE_REF, dstLocalName) == EXIT_FAILURE)
     {
-        fprintf(stderr, "Destination file already exists.\n");
+        fprintf(stderr, "Unable to traverse CWD or provided path.\n");
         return EXIT_FAILURE;
     }
-
-    //Ensure source child does exist.
     if(srcChildINODE_REF == UNALLOCATED_INODE)
     {
         fprintf(stderr, "Source file does not exist.\n");
         return EXIT_FAILURE;
     }
-
-    //Ensure source child is a file.
-    oufs_read_inode_by_reference(srcChildINODE_REF, &srcChildINODE);
-    if(srcChildINODE.type != IT_FILE)
+    if(oufs_is_dot_entry(dstLocalName) || dstParentINODE_REF == UNALLOCATED_INODE)
     {
-        fprintf(stderr, "Source is not a file.\n");
+        fprintf(stderr, "Cannot copy to '%s'.\n", path_dst);
         return EXIT_FAILURE;
     }
-
-    //Ensure the destination parent exists.
-    if(dstParentINODE_REF == UNALLOCATED_INODE)
-    {
-        fprintf(stderr, "Source parent does not exist.\n");
+    TREE *tree = calloc(1, sizeof(TREE));
+    if(tree == NULL)
         return EXIT_FAILURE;
-    }
-    //Check if the destination parent has room.
-    oufs_read_inode_by_reference(dstParentINODE_REF, &dstParentINODE);
-    if(dstParentINODE.size >= INODES_PER_BLOCK)
+    (*tree).exclusive = 0;
+    (*tree).avoid = dstParentINODE_REF;
+
+    //No directory moves meanwhile (see oufs_rename), so a copy into the source's own tree is
+    //caught here; then the destination, then the source tree.
+    pthread_mutex_lock(&fs->rename_lock);
+    if(oufs_read_inode_by_reference_r(fs, srcChildINODE_REF, &srcChildINODE) == 0 && srcChildINODE.type == IT_DIRECTORY
+       && oufs_is_ancestor(fs, srcChildINODE_REF, dstParentINODE_REF))
     {
-        fprintf(stderr, "Source parent is full.\n");
+        fprintf(stderr, "Cannot copy a directory into itself.\n");
+        pthread_mutex_unlock(&fs->rename_lock);
+        free(tree);
         return EXIT_FAILURE;
     }
+    oufs_lock_inode_r(fs, dstParentINODE_REF, 1);
+    dstChildINODE_REF = oufs_lookup_entry(fs, dstParentINODE_REF, dstLocalName, &dstParentINODE, &dstParentBLOCK);
 
-    //Read dest parent inode reference and block
-    oufs_read_inode_by_reference(dstParentINODE_REF, &dstParentINODE);
-    vdisk_read_block(dstParentINODE.data[0], &dstParentBLOCK);
-
-    //Find empty entry in destination parent directory block.
-    for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
+    int status = EXIT_FAILURE;
+    if(dstParentINODE.type != IT_DIRECTORY)
+        fprintf(stderr, "Destination parent does not exist.\n");
+    else if(dstChildINODE_REF != UNALLOCATED_INODE)
+        fprintf(stderr, "Destination file already exists.\n");
+    else if(dstParentINODE.size >= DIRECTORY_ENTRIES_PER_BLOCK)
+        fprintf(stderr, "Destination parent is full.\n");
+    else if(oufs_tree_walk(fs, tree, srcChildINODE_REF, -1, dstLocalName) == EXIT_SUCCESS
+            && oufs_tree_lock_files(fs, tree) == EXIT_SUCCESS)
     {
-        if(dstParentBLOCK.directory.entry[i].inode_reference == UNALLOCATED_INODE)
+        //What the copy needs: an inode per entry, a block per directory and per mapped file block.
+        int neededBlocks = 0, freeInodes = 0, freeBlocks = 0;
+        for(int k=0; k < (*tree).n_nodes; k++)
         {
-            dstParentBLOCK.directory.entry[i].inode_reference = srcChildINODE_REF; //Set the available entry to src
-            strncpy(dstParentBLOCK.directory.entry[i].name, dstLocalName, FILE_NAME_SIZE-1); //Copy dst name.
-            dstParentBLOCK.directory.entry[i].name[FILE_NAME_SIZE-1] = 0; //Null terminate if full
-            dstParentINODE.size++; //Increment num directories in parent inode.
-            break;
+            INODE *inode = &(*tree).inode[(*tree).nodes[k].inode];
+            for(int i=0; i < BLOCKS_PER_INODE; i++)
+                neededBlocks += ((*inode).type == IT_DIRECTORY) ? (i == 0) : BLOCK_IS_MAPPED((*inode).data[i]);
+        }
+        oufs_txn_begin_r(fs);
+        oufs_read_master_r(fs, &masterBLOCK);
+        for(int g=0; g < N_ALLOCATION_GROUPS; g++)
+        {
+            int groupInodes, groupBlocks;
+            oufs_group_usage(&masterBLOCK, g, &groupInodes, &groupBlocks);
+            freeInodes += groupInodes;
+            freeBlocks += groupBlocks;
         }
-    }
 
-    //Increment number of references on src child inode.
-    srcChildINODE.n_references++;
+        if(freeInodes < (*tree).n_nodes || freeBlocks < neededBlocks)
+        {
+            fprintf(stderr, "Not enough free inodes or blocks for the copy (%d inodes, %d blocks needed).\n",
+                    (*tree).n_nodes, neededBlocks);
+            oufs_txn_abort_r(fs);
+        }
+        else
+        {
+            //Allocate in preorder, so each directory has its copy before its entries.
+            for(int k=0; k < (*tree).n_nodes; k++)
+            {
+                TREE_NODE *node = &(*tree).nodes[k];
+                INODE *srcINODE = &(*tree).inode[(*node).inode];
+                INODE *copyINODE = &(*node).copyINODE;
+                INODE_REFERENCE copyParent = ((*node).parent < 0) ? dstParentINODE_REF : (*tree).nodes[(*node).parent].copy;
+                BLOCK_REFERENCE refs[BLOCKS_PER_INODE];
+
+                *copyINODE = *srcINODE;
+                (*copyINODE).n_references = 1;
+                if((*srcINODE).type == IT_DIRECTORY)
+                {
+                    int group = oufs_directory_group(&masterBLOCK, copyParent);
+                    (*node).copy = oufs_allocate_inode(&masterBLOCK, group);
+                    oufs_allocate_block_run(&masterBLOCK, GROUP_FIRST_BLOCK(group), 1, refs);
+                    for(int i=0; i < BLOCKS_PER_INODE; i++)
+                        (*copyINODE).data[i] = (i == 0) ? refs[0] : UNALLOCATED_BLOCK;
+                    (*copyINODE).size = 2;
+                    (*node).dirSlot = (*tree).n_dirs++;
+                    oufs_clean_directory_block((*node).copy, copyParent, &(*tree).dirBLOCKS[(*node).dirSlot]);
+                }
+                else
+                {
+                    int count = 0, next = 0;
+                    (*node).copy = oufs_allocate_inode(&masterBLOCK, INODE_GROUP(copyParent));
+                    for(int i=0; i < BLOCKS_PER_INODE; i++)
+                        count += BLOCK_IS_MAPPED((*srcINODE).data[i]);
+                    oufs_allocate_block_run(&masterBLOCK, GROUP_FIRST_BLOCK(INODE_GROUP((*node).copy)), count, refs);
+                    for(int i=0; i < BLOCKS_PER_INODE; i++)
+                    {
+                        BLOCK_REFERENCE ref = (*srcINODE).data[i];
+                        if(!BLOCK_IS_MAPPED(ref))
+                            continue;
+                        (*copyINODE).data[i] = refs[next++] | (ref & UNWRITTEN_BLOCK_FLAG);
+                        if(!BLOCK_IS_UNWRITTEN(ref)) //Unwritten blocks read as zeroes whatever they hold.
+                        {
+                            vdisk_read_block_r(fs->disk, BLOCK_INDEX(ref), &dataBLOCK);
+                            vdisk_write_data_block_r(fs->disk, BLOCK_INDEX((*copyINODE).data[i]), &dataBLOCK);
+                        }
+                    }
+                }
 
-    //Write changes to disk.
-    vdisk_write_block(dstParentINODE.data[0], &dstParentBLOCK);
-    oufs_write_inode_by_reference(dstParentINODE_REF, &dstParentINODE);
-    oufs_write_inode_by_reference(srcChildINODE_REF, &srcChildINODE);
-    return EXIT_SUCCESS;
+                //Enter the copy in its directory.
+                BLOCK *parentBLOCK = ((*node).parent < 0) ? &dstParentBLOCK : &(*tree).dirBLOCKS[(*tree).nodes[(*node).parent].dirSlot];
+                INODE *parentINODE = ((*node).parent < 0) ? &dstParentINODE : &(*tree).nodes[(*node).parent].copyINODE;
+                for(int i=0; i < DIRECTORY_ENTRIES_PER_BLOCK; i++)
+                {
+                    if((*parentBLOCK).directory.entry[i].inode_reference == UNALLOCATED_INODE)
+                    {
+                        strncpy((*parentBLOCK).directory.entry[i].name, (*node).name, FILE_NAME_SIZE);
+                        (*parentBLOCK).directory.entry[i].inode_reference = (*node).copy;
+                        (*parentINODE).size++;
+                        break;
+                    }
+                }
+            }
+
+            for(int k=0; k < (*tree).n_nodes; k++)
+            {
+                TREE_NODE *node = &(*tree).nodes[k];
+                if((*node).copyINODE.type == IT_DIRECTORY)
+                    vdisk_write_block_r(fs->disk, (*node).copyINODE.data[0], &(*tree).dirBLOCKS[(*node).dirSlot]);
+                oufs_write_inode_by_reference_r(fs, (*node).copy, &(*node).copyINODE);
+            }
+            vdisk_write_block_r(fs->disk, dstParentINODE.data[0], &dstParentBLOCK);
+            oufs_write_inode_by_reference_r(fs, dstParentINODE_REF, &dstParentINODE);
+            vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &masterBLOCK);
+            status = oufs_txn_commit_r(fs);
+        }
+    }
+    oufs_tree_unlock(fs, tree);
+    oufs_unlock_inode_r(fs, dstParentINODE_REF);
+    pthread_mutex_unlock(&fs->rename_lock);
+    free(tree);
+    return status;
 }
 /**
- * Frees an allocated file pointer.
+ * Flushes any buffered data and frees an allocated file pointer.
  */
 void oufs_fclose(OUFILE *fp)
 {
+    oufs_fflush(fp);
     free(fp);
-}
\ No newline at end of file
+}
+
+/*
+ * Compatibility wrappers: the original interface, on the default file system
+ */
+
+int oufs_format_disk(char *virtual_disk_name) {
+    return (oufs_format_disk_r(oufs_default(), virtual_disk_name));
+}
+
+int oufs_find_file(char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name) {
+    return (oufs_find_file_r(oufs_default(), cwd, path, parent, child, local_name));
+}
+
+int oufs_mkdir(char *cwd, char *path) {
+    return (oufs_mkdir_r(oufs_default(), cwd, path));
+}
+
+int oufs_list(char *cwd, char *path) {
+    return (oufs_list_r(oufs_default(), cwd, path));
+}
+
+int oufs_list_long(char *cwd, char *path) {
+    return (oufs_list_long_r(oufs_default(), cwd, path));
+}
+
+int oufs_rmdir(char *cwd, char *path) {
+    return (oufs_rmdir_r(oufs_default(), cwd, path));
+}
+
+OUFILE *oufs_fopen(char *cwd, char *path, char *mode) {
+    return (oufs_fopen_r(oufs_default(), cwd, path, mode));
+}
+
+int oufs_remove(char *cwd, char *path) {
+    return (oufs_remove_r(oufs_default(), cwd, path));
+}
+
+int oufs_link(char *cwd, char *path_src, char *path_dst) {
+    return (oufs_link_r(oufs_default(), cwd, path_src, path_dst));
+}
+
+OUDIR *oufs_opendir(char *cwd, char *path) {
+    return (oufs_opendir_r(oufs_default(), cwd, path));
+}
+
+int oufs_read_file(INODE_REFERENCE fileINODE_REF, unsigned char *buf, int *len) {
+    return (oufs_read_file_r(oufs_default(), fileINODE_REF, buf, len));
+}
+
+int oufs_clone(char *cwd, char *path_src, char *path_dst) {
+    return (oufs_clone_r(oufs_default(), cwd, path_src, path_dst));
+}
+
+int oufs_rename(char *cwd, char *path_src, char *path_dst) {
+    return (oufs_rename_r(oufs_default(), cwd, path_src, path_dst));
+}
+
+int oufs_remove_tree(char *cwd, char *path) {
+    return (oufs_remove_tree_r(oufs_default(), cwd, path));
+}
+
+int oufs_copy_tree(char *cwd, char *path_src, char *path_dst) {
+    return (oufs_copy_tree_r(oufs_default(), cwd, path_src, path_dst));
+}
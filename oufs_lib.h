@@ -19,9 +19,22 @@
 //Used to reset the nth bit of x
 #define RESET_BIT(var, bitINDEX) ((var)[(bitINDEX) / BITS_IN_BYTE]) &= ~(0x1 << ((bitINDEX) % BITS_IN_BYTE))
 
+// Block references in an inode's data[] may be holes or carry UNWRITTEN_BLOCK_FLAG
+#define BLOCK_IS_MAPPED(ref) ((ref) != UNALLOCATED_BLOCK && (ref) != HOLE_BLOCK)
+#define BLOCK_INDEX(ref) ((BLOCK_REFERENCE) ((ref) & ~UNWRITTEN_BLOCK_FLAG))
+#define BLOCK_IS_UNWRITTEN(ref) ((((ref) & UNWRITTEN_BLOCK_FLAG) != 0) && (BLOCK_INDEX(ref) < N_BLOCKS_IN_DISK))
+
+// Inode types that hold file data
+#define IS_FILE_TYPE(type) ((type) == IT_FILE || (type) == IT_COMPRESSED_FILE)
+
+// Bytes in front of the compressed stream of an IT_COMPRESSED_FILE
+#define COMPRESSED_HEADER_SIZE 2
+
 // PROVIDED
 void oufs_get_environment(char *cwd, char *disk_name);
 
+int oufs_get_durability();
+
 // PROJECT 3
 int oufs_format_disk(char *virtual_disk_name);
 
@@ -35,6 +48,8 @@ int oufs_mkdir(char *cwd, char *path);
 
 int oufs_list(char *cwd, char *path);
 
+int oufs_list_long(char *cwd, char *path);
+
 int oufs_rmdir(char *cwd, char *path);
 
 void oufs_inode_reset(INODE *inode);
@@ -48,6 +63,22 @@ void oufs_clean_directory_entry(DIRECTORY_ENTRY *entry);
 
 BLOCK_REFERENCE oufs_allocate_new_block();
 
+int oufs_allocate_block_run(BLOCK *masterBlock, BLOCK_REFERENCE goal, int count, BLOCK_REFERENCE *refs);
+
+int oufs_allocate_inode(BLOCK *masterBlock, int group);
+
+void oufs_group_usage(BLOCK *masterBlock, int group, int *freeInodes, int *freeBlocks);
+
+int oufs_directory_group(BLOCK *masterBlock, INODE_REFERENCE parent);
+
+void oufs_release_block(BLOCK *masterBlock, BLOCK_REFERENCE block_ref);
+
+int oufs_txn_begin();
+
+int oufs_txn_commit();
+
+void oufs_txn_abort();
+
 // Helper functions to be provided
 int oufs_find_open_bit(unsigned char *value);
 
@@ -59,12 +90,130 @@ OUFILE *oufs_fopen(char *cwd, char *path, char *mode);
 
 void oufs_fclose(OUFILE *fp);
 
+int oufs_fflush(OUFILE *fp);
+
 int oufs_fwrite(OUFILE *fp, unsigned char *buf, int len);
 
 int oufs_fread(OUFILE *fp, unsigned char *buf, int *len);
 
+int oufs_read_file(INODE_REFERENCE i, unsigned char *buf, int *len);
+
+OUDIR *oufs_opendir(char *cwd, char *path);
+
+OUDIRENT *oufs_readdir(OUDIR *dp);
+
+int oufs_telldir(OUDIR *dp);
+
+void oufs_seekdir(OUDIR *dp, int position);
+
+void oufs_closedir(OUDIR *dp);
+
+int oufs_pwrite(OUFILE *fp, unsigned char *buf, int len, int offset);
+
+int oufs_fseek(OUFILE *fp, int offset, int whence);
+
+int oufs_ftruncate(OUFILE *fp, int size);
+
+int oufs_fallocate(OUFILE *fp, int offset, int len);
+
+int oufs_fcompress(OUFILE *fp);
+
 int oufs_remove(char *cwd, char *path);
 
 int oufs_link(char *cwd, char *path_src, char *path_dst);
 
+int oufs_clone(char *cwd, char *path_src, char *path_dst);
+
+int oufs_rename(char *cwd, char *path_src, char *path_dst);
+
+int oufs_remove_tree(char *cwd, char *path);
+
+int oufs_copy_tree(char *cwd, char *path_src, char *path_dst);
+
+// Block deduplication in oufs_dedup.c
+void oufs_dedup_enable(int on);
+
+int oufs_dedup_enabled();
+
+void oufs_dedup_remember(BLOCK_REFERENCE block_ref, DATA_BLOCK *block);
+
+void oufs_dedup_forget(BLOCK_REFERENCE block_ref);
+
+BLOCK_REFERENCE oufs_dedup_lookup(BLOCK *masterBlock, DATA_BLOCK *block, BLOCK_REFERENCE exclude);
+
+int oufs_dedup_disk(int *reclaimed);
+
+// Consistency check and repair in oufs_fsck.c
+int oufs_fsck(int n_threads, int repair, int *problems, int *repaired);
+
+// Context-first forms of the functions above, which use oufs_default()
+void oufs_init(OUFS *fs, VDISK *disk);
+
+OUFS *oufs_default();
+
+void oufs_lock_inode_r(OUFS *fs, INODE_REFERENCE i, int exclusive);
+
+void oufs_unlock_inode_r(OUFS *fs, INODE_REFERENCE i);
+
+
+int oufs_format_disk_r(OUFS *fs, char *virtual_disk_name);
+
+int oufs_read_inode_by_reference_r(OUFS *fs, INODE_REFERENCE i, INODE *inode);
+
+int oufs_write_inode_by_reference_r(OUFS *fs, INODE_REFERENCE i, INODE *inode);
+
+int oufs_find_file_r(OUFS *fs, char *cwd, char *path, INODE_REFERENCE *parent, INODE_REFERENCE *child, char *local_name);
+
+int oufs_mkdir_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_list_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_list_long_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_rmdir_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_read_master_r(OUFS *fs, BLOCK *block);
+
+BLOCK_REFERENCE oufs_allocate_new_block_r(OUFS *fs);
+
+void oufs_release_block_r(OUFS *fs, BLOCK *masterBlock, BLOCK_REFERENCE block_ref);
+
+int oufs_txn_begin_r(OUFS *fs);
+
+int oufs_txn_commit_r(OUFS *fs);
+
+void oufs_txn_abort_r(OUFS *fs);
+
+OUFILE *oufs_fopen_r(OUFS *fs, char *cwd, char *path, char *mode);
+
+int oufs_read_file_r(OUFS *fs, INODE_REFERENCE i, unsigned char *buf, int *len);
+
+OUDIR *oufs_opendir_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_remove_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_link_r(OUFS *fs, char *cwd, char *path_src, char *path_dst);
+
+int oufs_clone_r(OUFS *fs, char *cwd, char *path_src, char *path_dst);
+
+int oufs_rename_r(OUFS *fs, char *cwd, char *path_src, char *path_dst);
+
+int oufs_remove_tree_r(OUFS *fs, char *cwd, char *path);
+
+int oufs_copy_tree_r(OUFS *fs, char *cwd, char *path_src, char *path_dst);
+
+void oufs_dedup_enable_r(OUFS *fs, int on);
+
+int oufs_dedup_enabled_r(OUFS *fs);
+
+void oufs_dedup_remember_r(OUFS *fs, BLOCK_REFERENCE block_ref, DATA_BLOCK *block);
+
+void oufs_dedup_forget_r(OUFS *fs, BLOCK_REFERENCE block_ref);
+
+BLOCK_REFERENCE oufs_dedup_lookup_r(OUFS *fs, BLOCK *masterBlock, DATA_BLOCK *block, BLOCK_REFERENCE exclude);
+
+int oufs_dedup_disk_r(OUFS *fs, int *reclaimed);
+
+int oufs_fsck_r(OUFS *fs, int n_threads, int repair, int *problems, int *repaired);
+
 #endif
@@ -33,6 +33,113 @@ void oufs_get_environment(char *cwd, char *disk_name) {
 
 }
 
+/**
+ * Read the durability level for the virtual disk from the environment
+ *
+ * ZDURABILITY is one of none, ordered (the default) or full.
+ *
+ * @return VDISK_DURABILITY_NONE, VDISK_DURABILITY_ORDERED or VDISK_DURABILITY_FULL
+ */
+int oufs_get_durability() {
+    char *str = getenv("ZDURABILITY");
+    if (str == NULL || strcmp(str, "ordered") == 0)
+        return (VDISK_DURABILITY_ORDERED);
+    if (strcmp(str, "none") == 0)
+        return (VDISK_DURABILITY_NONE);
+    if (strcmp(str, "full") == 0)
+        return (VDISK_DURABILITY_FULL);
+
+    fprintf(stderr, "Unknown durability level (%s); using ordered\n", str);
+    return (VDISK_DURABILITY_ORDERED);
+}
+
+/**
+ * Prepare a file system context for a disk
+ *
+ * The disk is opened and closed with vdisk_disk_open_r()/vdisk_disk_close_r() as usual;
+ * the context only has to outlive its use.
+ *
+ * @param fs The context
+ * @param disk The virtual disk the file system lives on
+ */
+void oufs_init(OUFS *fs, VDISK *disk) {
+    memset(fs, 0, sizeof(*fs));
+    fs->disk = disk;
+    fs->dedup_state = -1;
+    for (int i = 0; i < N_INODES; ++i)
+        pthread_rwlock_init(&fs->inode_lock[i], NULL);
+    pthread_mutex_init(&fs->rename_lock, NULL);
+}
+
+// The file system used by the functions without the _r suffix, prepared on first use
+static OUFS oufs_default_fs;
+static pthread_once_t oufs_default_once = PTHREAD_ONCE_INIT;
+
+static void oufs_default_init() {
+    oufs_init(&oufs_default_fs, vdisk_default());
+}
+
+/**
+ * The file system used by the functions without the _r suffix: the one on vdisk_default()
+ */
+OUFS *oufs_default() {
+    pthread_once(&oufs_default_once, oufs_default_init);
+    return (&oufs_default_fs);
+}
+
+/**
+ * Lock an inode for reading (shared) or for changing it (exclusive)
+ *
+ * A file system context may be used by several threads at once.  Operations lock
+ * what they touch in this order, which keeps them from deadlocking:
+ *   1. inodes: a directory before the entries in it (parent before child), and
+ *      only one directory at a time otherwise.  oufs_rename, which moves an entry
+ *      between two directories, holds the file system's rename lock while it locks
+ *      both, an ancestor before its descendant; oufs_remove_tree and oufs_copy_tree
+ *      hold it while they lock a whole tree, top down.  A file may be locked after a
+ *      directory that does not hold it (oufs_link, oufs_clone), so a file is never
+ *      locked before a directory: the tree operations lock all of the tree's
+ *      directories first, then its files in inode order
+ *   2. the disk transaction (oufs_txn_begin), which only one thread has open at a time
+ *
+ * The master block (and the deduplication index that mirrors it) is only read and
+ * changed inside the transaction that writes it, so no other lock covers it.
+ *
+ * While an inode is locked exclusively its version is odd; it is even again, and
+ * different, once the lock is released.  Lookups use this to read directories
+ * without taking the lock.
+ *
+ * @param i The inode; UNALLOCATED_INODE is ignored
+ * @param exclusive 1 to change the inode (or the directory entries it holds), 0 to read it
+ */
+void oufs_lock_inode_r(OUFS *fs, INODE_REFERENCE i, int exclusive) {
+    if (i >= N_INODES)
+        return;
+    if (exclusive) {
+        pthread_rwlock_wrlock(&fs->inode_lock[i]);
+        unsigned int version = __atomic_load_n(&fs->inode_version[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&fs->inode_version[i], version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    } else
+        pthread_rwlock_rdlock(&fs->inode_lock[i]);
+}
+
+/**
+ * Release an inode locked with oufs_lock_inode_r()
+ *
+ * @param i The inode; UNALLOCATED_INODE is ignored
+ */
+void oufs_unlock_inode_r(OUFS *fs, INODE_REFERENCE i) {
+    if (i >= N_INODES)
+        return;
+
+    // Only the exclusive holder sees an odd version
+    unsigned int version = __atomic_load_n(&fs->inode_version[i], __ATOMIC_RELAXED);
+    if (version & 1)
+        __atomic_store_n(&fs->inode_version[i], version + 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&fs->inode_lock[i]);
+}
+
 /**
  * Configure a directory entry so that it has no name and no inode
  *
@@ -80,6 +187,26 @@ void oufs_clean_directory_block(INODE_REFERENCE self, INODE_REFERENCE parent, BL
 
 }
 
+/**
+ * Read the master block
+ *
+ * Images formatted before the share counts existed hold whatever was in memory where
+ * the counts now live.  Such images have no clones, so every count is taken as 0; the
+ * next write of the master block stores the zeroes along with MASTER_SHARE_MAGIC.
+ *
+ * @param block Filled in with the master block
+ * @return 0 on success; <0 on error
+ */
+int oufs_read_master_r(OUFS *fs, BLOCK *block) {
+    if (vdisk_read_block_r(fs->disk, MASTER_BLOCK_REFERENCE, block) != 0)
+        return (-1);
+    if (block->master.share_magic != MASTER_SHARE_MAGIC) {
+        memset(block->master.block_share_count, 0, sizeof(block->master.block_share_count));
+        block->master.share_magic = MASTER_SHARE_MAGIC;
+    }
+    return (0);
+}
+
 /**
  * Allocate a new data block
  *
@@ -89,10 +216,11 @@ void oufs_clean_directory_block(INODE_REFERENCE self, INODE_REFERENCE parent, BL
  * then UNALLOCATED_BLOCK is returned
  *
  */
-BLOCK_REFERENCE oufs_allocate_new_block() {
+BLOCK_REFERENCE oufs_allocate_new_block_r(OUFS *fs) {
     BLOCK block;
-    // Read the master block
-    vdisk_read_block(MASTER_BLOCK_REFERENCE, &block);
+    // Read the master block (inside the transaction that writes it)
+    oufs_txn_begin_r(fs);
+    oufs_read_master_r(fs, &block);
 
     // Scan for an available block
     int block_byte;
@@ -111,6 +239,7 @@ BLOCK_REFERENCE oufs_allocate_new_block() {
         // No
         if (debug)
             fprintf(stderr, "No blocks\n");
+        oufs_txn_abort_r(fs);
         return (UNALLOCATED_BLOCK);
     }
 
@@ -124,7 +253,9 @@ BLOCK_REFERENCE oufs_allocate_new_block() {
     block.master.block_allocated_flag[block_byte] |= (1 << block_bit);
 
     // Write out the updated master block
-    vdisk_write_block(MASTER_BLOCK_REFERENCE, &block);
+    vdisk_write_block_r(fs->disk, MASTER_BLOCK_REFERENCE, &block);
+    if (oufs_txn_commit_r(fs) != EXIT_SUCCESS)
+        return (UNALLOCATED_BLOCK);
 
     if (debug)
         fprintf(stderr, "Allocating block=%d (%d)\n", block_byte, block_bit);
@@ -140,6 +271,167 @@ BLOCK_REFERENCE oufs_allocate_new_block() {
 }
 
 
+/**
+ * Allocate a run of data blocks in an in-memory master block
+ *
+ * The run is placed at goal if there is room there, otherwise at the first gap large
+ * enough to hold all of it, searching forward from goal (usually in the allocation group
+ * of the file) and wrapping around.  Only if the disk is too fragmented for that are the
+ * blocks taken one at a time, in the same order.  The master block is not written.
+ *
+ * @param masterBlock The master block in which the allocation bits are set
+ * @param goal Preferred first block of the run (UNALLOCATED_BLOCK for no preference)
+ * @param count Number of blocks to allocate
+ * @param refs Filled in with the allocated block indices, in ascending order
+ * @return 0 on success; -1 if fewer than count blocks are free (nothing is allocated)
+ *
+ */
+int oufs_allocate_block_run(BLOCK *masterBlock, BLOCK_REFERENCE goal, int count, BLOCK_REFERENCE *refs) {
+    unsigned char *flags = masterBlock->master.block_allocated_flag;
+    int first = -1;
+
+    if (count <= 0)
+        return (0);
+
+    // Is the goal itself free for the whole run?
+    if (goal != UNALLOCATED_BLOCK && goal + count <= N_BLOCKS_IN_DISK) {
+        first = goal;
+        for (int i = goal; i < goal + count; ++i) {
+            if (GET_BIT(flags, i)) {
+                first = -1;
+                break;
+            }
+        }
+    }
+
+    // First fit from the goal; a run cannot wrap past the end of the disk
+    int start = (goal < N_BLOCKS_IN_DISK) ? goal : 0;
+    for (int i = 0, length = 0; first < 0 && i < N_BLOCKS_IN_DISK; ++i) {
+        int b = (start + i) % N_BLOCKS_IN_DISK;
+        if (b == 0)
+            length = 0;
+        length = GET_BIT(flags, b) ? 0 : length + 1;
+        if (length == count)
+            first = b - count + 1;
+    }
+
+    if (first >= 0) {
+        for (int i = 0; i < count; ++i) {
+            SET_BIT(flags, first + i);
+            refs[i] = (BLOCK_REFERENCE) (first + i);
+        }
+    } else {
+        // Fragmented: gather single blocks, then put them in ascending order
+        int found = 0;
+        for (int i = 0; found < count && i < N_BLOCKS_IN_DISK; ++i) {
+            int b = (start + i) % N_BLOCKS_IN_DISK;
+            if (!GET_BIT(flags, b))
+                refs[found++] = (BLOCK_REFERENCE) b;
+        }
+        if (found < count) {
+            if (debug)
+                fprintf(stderr, "No blocks\n");
+            return (-1);
+        }
+        for (int i = 1; i < count; ++i) {
+            for (int j = i; j > 0 && refs[j - 1] > refs[j]; --j) {
+                BLOCK_REFERENCE swap = refs[j];
+                refs[j] = refs[j - 1];
+                refs[j - 1] = swap;
+            }
+        }
+        for (int i = 0; i < count; ++i)
+            SET_BIT(flags, refs[i]);
+    }
+
+    if (debug)
+        fprintf(stderr, "Allocating %d blocks starting at %d\n", count, refs[0]);
+
+    return (0);
+}
+
+/**
+ * Allocate an inode in an in-memory master block, in the given allocation group if it has a
+ * free one, otherwise in the groups that follow it
+ *
+ * @param masterBlock The master block in which the allocation bit is set
+ * @param group Preferred allocation group
+ * @return The inode reference; -1 if no inode is free
+ */
+int oufs_allocate_inode(BLOCK *masterBlock, int group) {
+    for (int i = 0; i < N_INODES; ++i) {
+        int inode = (group * INODES_PER_GROUP + i) % N_INODES;
+        if (!GET_BIT(masterBlock->master.inode_allocated_flag, inode)) {
+            SET_BIT(masterBlock->master.inode_allocated_flag, inode);
+            return (inode);
+        }
+    }
+    return (-1);
+}
+
+/**
+ * Count the free inodes and blocks of an allocation group
+ *
+ * @param masterBlock The master block
+ * @param group The allocation group
+ * @param freeInodes Receives the number of free inodes
+ * @param freeBlocks Receives the number of free blocks
+ */
+void oufs_group_usage(BLOCK *masterBlock, int group, int *freeInodes, int *freeBlocks) {
+    *freeInodes = 0;
+    *freeBlocks = 0;
+    for (int i = group * INODES_PER_GROUP; i < (group + 1) * INODES_PER_GROUP; ++i)
+        *freeInodes += !GET_BIT(masterBlock->master.inode_allocated_flag, i);
+    for (int b = group * BLOCKS_PER_GROUP; b < (group + 1) * BLOCKS_PER_GROUP; ++b)
+        *freeBlocks += !GET_BIT(masterBlock->master.block_allocated_flag, b);
+}
+
+/**
+ * Choose the allocation group of a new directory
+ *
+ * Directories are spread out: a new one goes to the group with the most free inodes
+ * (the parent's group wins ties), provided that the group also has a free block.  The
+ * files created in the directory then share its group, so work in different directories
+ * touches different parts of the tables and files sit near their directory.
+ *
+ * @param masterBlock The master block
+ * @param parent The directory the new directory is created in
+ * @return The allocation group
+ */
+int oufs_directory_group(BLOCK *masterBlock, INODE_REFERENCE parent) {
+    int best = (parent < N_INODES) ? INODE_GROUP(parent) : 0;
+    int bestInodes = -1;
+
+    for (int i = 0; i < N_ALLOCATION_GROUPS; ++i) {
+        int group = (best + i) % N_ALLOCATION_GROUPS;
+        int freeInodes, freeBlocks;
+        oufs_group_usage(masterBlock, group, &freeInodes, &freeBlocks);
+        if (freeBlocks > 0 && freeInodes > bestInodes) {
+            best = group;
+            bestInodes = freeInodes;
+        }
+    }
+    return (best);
+}
+
+/**
+ * Drop one owner of a data block in an in-memory master block
+ *
+ * A block shared between clones only loses a share; the last owner frees it.
+ *
+ * @param masterBlock The master block holding the allocation and share tables
+ * @param block_ref The block being released
+ *
+ */
+void oufs_release_block_r(OUFS *fs, BLOCK *masterBlock, BLOCK_REFERENCE block_ref) {
+    if (masterBlock->master.block_share_count[block_ref] > 0) {
+        --masterBlock->master.block_share_count[block_ref];
+    } else {
+        RESET_BIT(masterBlock->master.block_allocated_flag, block_ref);
+        oufs_dedup_forget_r(fs, block_ref);
+    }
+}
+
 /**
  *  Given an inode reference, read the inode from the virtual disk.
  *
@@ -150,7 +442,7 @@ BLOCK_REFERENCE oufs_allocate_new_block() {
  *         -1 = an error has occurred
  *
  */
-int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
+int oufs_read_inode_by_reference_r(OUFS *fs, INODE_REFERENCE i, INODE *inode) {
     if (debug)
         fprintf(stderr, "Fetching inode %d\n", i);
 
@@ -159,7 +451,7 @@ int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
     int element = (i % INODES_PER_BLOCK);
 
     BLOCK b;
-    if (vdisk_read_block(block, &b) == 0) {
+    if (vdisk_read_block_r(fs->disk, block, &b) == 0) {
         // Successfully loaded the block: copy just this inode
         *inode = b.inodes.inode[element];
         return (0);
@@ -168,7 +460,7 @@ int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
     return (-1);
 }
 
-int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
+int oufs_write_inode_by_reference_r(OUFS *fs, INODE_REFERENCE i, INODE *inode) {
     if (debug)
         fprintf(stderr, "Fetching inode %d\n", i);
 
@@ -177,16 +469,54 @@ int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
     int element = (i % INODES_PER_BLOCK);
 
     BLOCK b;
-    if (vdisk_read_block(block, &b) == 0) {
+    if (vdisk_read_block_r(fs->disk, block, &b) == 0) {
         // Successfully loaded the block: copy just this inode
         b.inodes.inode[element] = *inode;
-        if(vdisk_write_block(block, &b) != 0)
+        if(vdisk_write_block_r(fs->disk, block, &b) != 0)
             return EXIT_FAILURE;
         return (0);
     }
     // Error case
     return (-1);
 }
+/**
+ * Start collecting the blocks written by one file system operation
+ *
+ * Until the matching oufs_txn_commit(), block writes only update an in-memory copy
+ * (reads in the same thread see it).  A block written several times, such as an inode
+ * block holding two updated inodes, reaches the disk once.  Transactions may be nested;
+ * while one thread has a transaction open, other threads wait to begin theirs.
+ *
+ *  @return 0 = success
+ *         -1 = an error has occurred
+ */
+int oufs_txn_begin_r(OUFS *fs) {
+    if (vdisk_txn_begin_r(fs->disk) != 0)
+        return (-1);
+    return (0);
+}
+
+/**
+ * Write the blocks collected since oufs_txn_begin() in block order, with one vectored
+ * write per run of adjacent blocks
+ *
+ *  @return EXIT_SUCCESS, or EXIT_FAILURE if the blocks could not be written
+ */
+int oufs_txn_commit_r(OUFS *fs) {
+    if (vdisk_txn_commit_r(fs->disk) != 0) {
+        fprintf(stderr, "oufs_txn_commit: unable to write the transaction\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Discard the blocks collected since oufs_txn_begin()
+ */
+void oufs_txn_abort_r(OUFS *fs) {
+    vdisk_txn_abort_r(fs->disk);
+}
+
 /**
  * Function to compare two items with qsort.
  *
@@ -203,3 +533,35 @@ int cmpstringp(const void *p1, const void *p2)
 
     return strcmp(*(char *const*)p1, *(char *const*)p2);
 }
+
+/*
+ * Compatibility wrappers: the original interface, on the default file system
+ */
+
+int oufs_read_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
+    return (oufs_read_inode_by_reference_r(oufs_default(), i, inode));
+}
+
+int oufs_write_inode_by_reference(INODE_REFERENCE i, INODE *inode) {
+    return (oufs_write_inode_by_reference_r(oufs_default(), i, inode));
+}
+
+BLOCK_REFERENCE oufs_allocate_new_block() {
+    return (oufs_allocate_new_block_r(oufs_default()));
+}
+
+void oufs_release_block(BLOCK *masterBlock, BLOCK_REFERENCE block_ref) {
+    oufs_release_block_r(oufs_default(), masterBlock, block_ref);
+}
+
+int oufs_txn_begin() {
+    return (oufs_txn_begin_r(oufs_default()));
+}
+
+int oufs_txn_commit() {
+    return (oufs_txn_commit_r(oufs_default()));
+}
+
+void oufs_txn_abort() {
+    oufs_txn_abort_r(oufs_default());
+}
@@ -0,0 +1,201 @@
+#include <string.h>
+#include "oufs_lz4.h"
+
+/*
+ * LZ4 block format: a series of sequences, each made of
+ *   token:    high nibble = literal length, low nibble = match length - 4
+ *             (15 in either nibble means "more length bytes follow")
+ *   [literal length bytes]  literals  offset (2 bytes, little endian)  [match length bytes]
+ * The last sequence has literals only.  The last 5 bytes of input are always
+ * literals and no match starts in the last 12 bytes.
+ */
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+
+/**
+ * Hash the four bytes at p
+ */
+static unsigned int oufs_lz4_hash(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return ((v * 2654435761u) >> (32 - HASH_LOG));
+}
+
+/**
+ * Append a length continuation (the part of a length past 15) to the output
+ *
+ * @return the new output position, or NULL if the output is full
+ */
+static unsigned char *oufs_lz4_put_length(unsigned char *op, unsigned char *oend, int length) {
+    for (; length >= 255; length -= 255) {
+        if (op >= oend)
+            return (NULL);
+        *op++ = 255;
+    }
+    if (op >= oend)
+        return (NULL);
+    *op++ = (unsigned char) length;
+    return (op);
+}
+
+/**
+ * Append one sequence to the output
+ *
+ * @param matchLength Length of the match past MIN_MATCH, or -1 for the final literals-only sequence
+ * @return the new output position, or NULL if the output is full
+ */
+static unsigned char *oufs_lz4_put_sequence(unsigned char *op, unsigned char *oend, const unsigned char *literals,
+                                            int literalLength, int offset, int matchLength) {
+    if (op >= oend)
+        return (NULL);
+    unsigned char *token = op++;
+    *token = (unsigned char) ((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15 && (op = oufs_lz4_put_length(op, oend, literalLength - 15)) == NULL)
+        return (NULL);
+
+    if (oend - op < literalLength)
+        return (NULL);
+    memcpy(op, literals, literalLength);
+    op += literalLength;
+
+    if (matchLength < 0)
+        return (op);
+
+    if (oend - op < 2)
+        return (NULL);
+    *op++ = (unsigned char) (offset & 0xff);
+    *op++ = (unsigned char) (offset >> 8);
+    *token |= (unsigned char) (matchLength >= 15 ? 15 : matchLength);
+    if (matchLength >= 15 && (op = oufs_lz4_put_length(op, oend, matchLength - 15)) == NULL)
+        return (NULL);
+    return (op);
+}
+
+/**
+ * Compress a buffer into an LZ4 block
+ *
+ * @param src Input
+ * @param srcLen Number of input bytes
+ * @param dst Output buffer
+ * @param dstCapacity Size of the output buffer (OUFS_LZ4_BOUND(srcLen) always suffices)
+ * @return the number of bytes written to dst; -1 if they do not fit
+ */
+int oufs_lz4_compress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCapacity) {
+    int table[1 << HASH_LOG];
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *iend = src + srcLen;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstCapacity;
+
+    memset(table, 0xff, sizeof(table));
+
+    if (srcLen >= MF_LIMIT) {
+        const unsigned char *mflimit = iend - MF_LIMIT;
+        const unsigned char *matchlimit = iend - LAST_LITERALS;
+
+        while (ip < mflimit) {
+            unsigned int h = oufs_lz4_hash(ip);
+            int candidate = table[h];
+            table[h] = (int) (ip - src);
+
+            if (candidate < 0 || (ip - src) - candidate > MAX_OFFSET || memcmp(src + candidate, ip, MIN_MATCH) != 0) {
+                ++ip;
+                continue;
+            }
+
+            // Extend the match as far as the format allows
+            const unsigned char *match = src + candidate + MIN_MATCH;
+            const unsigned char *p = ip + MIN_MATCH;
+            while (p < matchlimit && *p == *match) {
+                ++p;
+                ++match;
+            }
+
+            op = oufs_lz4_put_sequence(op, oend, anchor, (int) (ip - anchor), (int) (ip - (src + candidate)),
+                                       (int) (p - ip) - MIN_MATCH);
+            if (op == NULL)
+                return (-1);
+            ip = anchor = p;
+        }
+    }
+
+    op = oufs_lz4_put_sequence(op, oend, anchor, (int) (iend - anchor), 0, -1);
+    if (op == NULL)
+        return (-1);
+    return ((int) (op - dst));
+}
+
+/**
+ * Decompress an LZ4 block
+ *
+ * @param src Compressed input
+ * @param srcLen Number of input bytes
+ * @param dst Output buffer
+ * @param dstCapacity Size of the output buffer
+ * @return the number of bytes written to dst; -1 if the input is malformed or too large
+ */
+int oufs_lz4_decompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCapacity) {
+    const unsigned char *ip = src;
+    const unsigned char *iend = src + srcLen;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + dstCapacity;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        // Literals
+        int length = token >> 4;
+        if (length == 15) {
+            unsigned char b;
+            do {
+                if (ip >= iend)
+                    return (-1);
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        if (iend - ip < length || oend - op < length)
+            return (-1);
+        memcpy(op, ip, length);
+        ip += length;
+        op += length;
+
+        // The last sequence has no match
+        if (ip >= iend)
+            break;
+
+        // Match
+        if (iend - ip < 2)
+            return (-1);
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - dst)
+            return (-1);
+
+        length = token & 15;
+        if (length == 15) {
+            unsigned char b;
+            do {
+                if (ip >= iend)
+                    return (-1);
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += MIN_MATCH;
+        if (oend - op < length)
+            return (-1);
+
+        // Byte by byte: the match may overlap the bytes being produced
+        const unsigned char *match = op - offset;
+        while (length-- > 0)
+            *op++ = *match++;
+    }
+
+    return ((int) (op - dst));
+}
@@ -0,0 +1,19 @@
+#ifndef OUFS_LZ4_H
+#define OUFS_LZ4_H
+
+/*
+ * Small codec for the LZ4 block format (no frame header, no checksums).
+ *
+ * Streams produced here can be decoded by any LZ4 block decoder, and the decoder
+ * accepts any valid LZ4 block.  Written for the small, fixed-size buffers of the file
+ * system rather than for speed on large inputs.
+ */
+
+// Worst-case compressed size of n bytes of input
+#define OUFS_LZ4_BOUND(n) ((n) + ((n) / 255) + 16)
+
+int oufs_lz4_compress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCapacity);
+
+int oufs_lz4_decompress(const unsigned char *src, int srcLen, unsigned char *dst, int dstCapacity);
+
+#endif
@@ -1,32 +1,567 @@
+#define _GNU_SOURCE
 #include "vdisk.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/file.h>
 /*
  * Virtual disk implementation.
  *
  * The disk is implemented on top of a file.  Access provided by this
  * library is on a block-by-block basis
+ *
+ * All state of an open disk lives in a VDISK context, so several disks can be
+ * open at once.  Every function has a _r form taking the context first; the
+ * plain forms are wrappers that use a default context.  File I/O uses
+ * positioned reads and writes, so the file offset is never shared state.
+ *
+ * Snapshots: the file may extend past the N_BLOCKS_IN_DISK blocks of the
+ * file system.  Block N_BLOCKS_IN_DISK holds the snapshot table, and each
+ * snapshot slot k owns the N_BLOCKS_IN_DISK blocks that follow it at
+ * VDISK_SNAPSHOT_BASE + k * N_BLOCKS_IN_DISK.  A snapshot starts out empty;
+ * the first time a block is overwritten after the snapshot was taken, its
+ * old contents are saved into the snapshot's copy of that block.  Reading
+ * through a snapshot returns the saved copy if there is one, or the live
+ * block otherwise.
+ *
+ * Transactions: between vdisk_txn_begin() and vdisk_txn_commit(), written
+ * blocks are staged in memory (reads see the staged copies).  A write made
+ * outside of a transaction is a transaction of its own.  Transactions nest;
+ * aborting a nested one aborts the outermost, whose commit then fails.
+ *
+ * Journal: the region after the snapshot area is a write-ahead log.  Its
+ * first block holds the sequence number expected of the first record; each
+ * committed transaction appends one record (a header block naming the
+ * blocks, then their images) with a single vectored write.  The new block
+ * contents stay in memory until the group of records is made durable with
+ * one fdatasync and checkpointed: written to their home locations (in block
+ * order, one vectored write per run of adjacent blocks), synced, and the log
+ * emptied by advancing the sequence number.  Groups close when the log is
+ * full, on vdisk_journal_sync() and on close.  Opening a disk replays every
+ * intact record left in the log by a crash.
+ *
+ * Durability (chosen when the disk is opened):
+ *   VDISK_DURABILITY_NONE     committed blocks are written home directly; no
+ *                             journal and no syncs.
+ *   VDISK_DURABILITY_ORDERED  file data (vdisk_write_data_block) is written
+ *                             home and synced before the metadata that refers
+ *                             to it is journaled; the records are synced when a
+ *                             group closes (at the latest on close).
+ *   VDISK_DURABILITY_FULL     as ordered, but every transaction is durable when
+ *                             its commit returns.  A sync covers every record
+ *                             written before it, so commits whose record an
+ *                             earlier sync already covered skip theirs.
+ *
+ * Threads: a context may be shared by several threads.  Its state is guarded
+ * by one mutex that is held only briefly.  Block reads do not take it: the
+ * version counter (a sequence lock) is odd while a thread holds the mutex, so a
+ * reader finds its block without locking and only looks again, under the
+ * mutex, if the version changed meanwhile.  Readers therefore proceed in
+ * parallel without writing to shared memory.  One transaction is open at
+ * a time: vdisk_txn_begin() waits while another thread has one open, and
+ * only the thread that opened it sees its staged blocks.  With
+ * VDISK_DURABILITY_FULL a commit waits for its sync after giving up the
+ * transaction, so the next one can be written in the meantime and one sync
+ * covers both (group commit).
+ *
+ * Processes: the image file is locked for as long as it is open.  A disk opened
+ * with vdisk_disk_open() holds an exclusive lock, so one process at a time
+ * changes the file system; vdisk_disk_open_shared() takes a shared lock that
+ * any number of readers hold together and refuses every write.  Opening
+ * waits until the lock is granted.  A reader that finds journal records left
+ * by a crash takes the lock exclusively to replay them, then shares it again.
+ * The locks belong to the open file (OFD locks, or flock() where those do not
+ * exist), so two contexts of one process exclude each other as well.
  */
 
 // Debug flag
 #define debug 0
 
-// File descriptor for virtual disk.  Private to this file
-// Yes, global variables are generally a bad idea...
+// Location of the snapshot table and of the first snapshot's saved blocks
+#define VDISK_SNAPSHOT_TABLE_BLOCK N_BLOCKS_IN_DISK
+#define VDISK_SNAPSHOT_BASE (VDISK_SNAPSHOT_TABLE_BLOCK + 1)
+
+// Location and size (records, in blocks) of the journal
+#define VDISK_JOURNAL_SUPER_BLOCK (VDISK_SNAPSHOT_BASE + VDISK_MAX_SNAPSHOTS * N_BLOCKS_IN_DISK)
+#define VDISK_JOURNAL_BASE (VDISK_JOURNAL_SUPER_BLOCK + 1)
+#define VDISK_JOURNAL_BLOCKS (2 * N_BLOCKS_IN_DISK)
+
+// Tags identifying the journal super block and record headers
+#define VDISK_JOURNAL_MAGIC 0x4c4a554fu
+#define VDISK_RECORD_MAGIC 0x52434a4fu
+
+// Journal super block, padded to one block
+typedef union vdisk_journal_super_u {
+    struct {
+        unsigned int magic;
+
+        // Sequence number of the record at the start of the log
+        unsigned int sequence;
+    } super;
+    char block[BLOCK_SIZE];
+} VDISK_JOURNAL_SUPER;
+
+// Journal record header, padded to one block.  The images of the blocks set in
+//  the map follow it in block order.
+typedef union vdisk_journal_record_u {
+    struct {
+        unsigned int magic;
+        unsigned int sequence;
+        unsigned int count;
+
+        // FNV-1a hash of the header (with checksum 0) and the images
+        unsigned int checksum;
+        unsigned char map[N_BLOCKS_IN_DISK >> 3];
+    } record;
+    char block[BLOCK_SIZE];
+} VDISK_JOURNAL_RECORD;
+
+// Locks on the image file
+#define VDISK_LOCK_NONE 0
+#define VDISK_LOCK_SHARED 1
+#define VDISK_LOCK_EXCLUSIVE 2
+
+// Update an I/O counter; reads update them without holding the disk lock
+#define VDISK_COUNT(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+// Load or store a field that readers look at without holding the disk lock (see
+//  vdisk_block_locate()); the version counter tells them whether what they saw holds
+#define VDISK_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define VDISK_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+// Context used by the functions without the _r suffix
+static VDISK vdisk_default_disk = {.lock = PTHREAD_MUTEX_INITIALIZER, .txn_done = PTHREAD_COND_INITIALIZER,
+                                   .sync_lock = PTHREAD_MUTEX_INITIALIZER,
+                                   .view = -1, .durability = VDISK_DURABILITY_ORDERED};
+
+/**
+ * Take disk->lock in order to change the state of the disk.  The version is odd
+ * while the lock is held, which tells lock-free readers to look again.
+ */
+static void vdisk_lock(VDISK *disk) {
+    pthread_mutex_lock(&disk->lock);
+    __atomic_store_n(&disk->version, VDISK_LOAD(disk->version) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Release disk->lock, publishing the changes made under it
+ */
+static void vdisk_unlock(VDISK *disk) {
+    __atomic_store_n(&disk->version, VDISK_LOAD(disk->version) + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&disk->lock);
+}
+
+/**
+ * Wait for the open transaction to end (disk->lock held, and released meanwhile)
+ */
+static void vdisk_wait(VDISK *disk) {
+    __atomic_store_n(&disk->version, VDISK_LOAD(disk->version) + 1, __ATOMIC_RELEASE);
+    pthread_cond_wait(&disk->txn_done, &disk->lock);
+    __atomic_store_n(&disk->version, VDISK_LOAD(disk->version) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a block that readers may copy meanwhile into the journal (disk->lock held)
+ */
+static void vdisk_block_store(char *to, const void *block) {
+    unsigned long word;
 
-int vdisk_fd = 0;
+    for (int i = 0; i < BLOCK_SIZE; i += sizeof(word)) {
+        memcpy(&word, (const char *) block + i, sizeof(word));
+        VDISK_STORE(*(unsigned long *) (to + i), word);
+    }
+}
 
 /**
- * Open the virtual disk
+ * Copy a block out of the journal without holding disk->lock
+ */
+static void vdisk_block_load(void *block, const char *from) {
+    unsigned long word;
+
+    for (int i = 0; i < BLOCK_SIZE; i += sizeof(word)) {
+        word = VDISK_LOAD(*(const unsigned long *) (from + i));
+        memcpy((char *) block + i, &word, sizeof(word));
+    }
+}
+
+/**
+ * Mark a block as committed to the journal, or clear every mark (block_ref < 0)
+ * (disk->lock held)
+ */
+static void vdisk_journal_mark(VDISK *disk, int block_ref) {
+    if (block_ref >= 0) {
+        VDISK_STORE(disk->journal_pending[block_ref >> 3],
+                    disk->journal_pending[block_ref >> 3] | (1 << (block_ref & 7)));
+        return;
+    }
+    for (int i = 0; i < (N_BLOCKS_IN_DISK >> 3); ++i)
+        VDISK_STORE(disk->journal_pending[i], 0);
+}
+
+/**
+ * Lock or unlock the image file, waiting until the lock is granted.  An exclusive
+ * lock can be turned into a shared one in place; a shared lock must be released
+ * before asking for an exclusive one, or two readers doing so would wait for each
+ * other forever.
  *
- * @param virtual_disk_name Name of the file containing the virtual disk
- * @return 0 on success; < 0 on error
+ * @param type VDISK_LOCK_NONE, VDISK_LOCK_SHARED or VDISK_LOCK_EXCLUSIVE
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_file_lock(int fd, int type) {
+#ifdef F_OFD_SETLKW
+    static const short types[] = {F_UNLCK, F_RDLCK, F_WRLCK};
+    struct flock lock = {.l_type = types[type], .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    while (fcntl(fd, F_OFD_SETLKW, &lock) != 0) {
+#else
+    static const int operations[] = {LOCK_UN, LOCK_SH, LOCK_EX};
+    while (flock(fd, operations[type]) != 0) {
+#endif
+        if (errno != EINTR)
+            return (-1);
+    }
+    return (0);
+}
+
+/**
+ * Read a block of the underlying file, including blocks past the file system
+ * (snapshot area).  Blocks past the end of the file read as zeroes.
+ *
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_file_read(VDISK *disk, unsigned int index, void *block) {
+    ssize_t n = pread(disk->fd, block, BLOCK_SIZE, (off_t) index * BLOCK_SIZE);
+    if (n < 0)
+        return (-4);
+    VDISK_COUNT(disk->stats.blocks_read, 1);
+    memset((char *) block + n, 0, BLOCK_SIZE - n);
+    return (0);
+}
+
+/**
+ * Write a block of the underlying file, including blocks past the file system.
+ *
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_file_write(VDISK *disk, unsigned int index, void *block) {
+    if (pwrite(disk->fd, block, BLOCK_SIZE, (off_t) index * BLOCK_SIZE) != BLOCK_SIZE)
+        return (-4);
+    VDISK_COUNT(disk->stats.blocks_written, 1);
+    return (0);
+}
+
+/**
+ * Find a snapshot by name
+ *
+ * @return the snapshot slot; -1 if there is no such snapshot
+ */
+static int vdisk_snapshot_find(VDISK *disk, char *name) {
+    for (int i = 0; i < VDISK_MAX_SNAPSHOTS; ++i) {
+        if (disk->snapshots.snapshot[i].name[0] != 0 &&
+            strncmp(disk->snapshots.snapshot[i].name, name, VDISK_SNAPSHOT_NAME_SIZE) == 0)
+            return (i);
+    }
+    return (-1);
+}
+
+/**
+ * Save the current contents of a block into every snapshot that has no copy of it yet.
+ * The snapshot table is updated in memory only.
+ *
+ * @return 1 if a copy was saved; 0 if none was needed; <0 on error
+ */
+static int vdisk_snapshot_preserve(VDISK *disk, BLOCK_REFERENCE block_ref) {
+    int saved = 0;
+    char old[BLOCK_SIZE];
+    for (int i = 0; i < VDISK_MAX_SNAPSHOTS; ++i) {
+        VDISK_SNAPSHOT *snapshot = &disk->snapshots.snapshot[i];
+        if (snapshot->name[0] == 0 || (snapshot->saved[block_ref >> 3] & (1 << (block_ref & 7))))
+            continue;
+        if (!saved && vdisk_file_read(disk, block_ref, old) != 0) {
+            fprintf(stderr, "vdisk_write_block(): snapshot copy failed\n");
+            return (-4);
+        }
+        if (vdisk_file_write(disk, VDISK_SNAPSHOT_BASE + i * N_BLOCKS_IN_DISK + block_ref, old) != 0) {
+            fprintf(stderr, "vdisk_write_block(): snapshot copy failed\n");
+            return (-4);
+        }
+        snapshot->saved[block_ref >> 3] |= (1 << (block_ref & 7));
+        saved = 1;
+    }
+    return (saved);
+}
+
+/**
+ * Checksum of a journal record: its header with the checksum field cleared, then the images
+ */
+static unsigned int vdisk_journal_checksum(VDISK_JOURNAL_RECORD *header, char images[][BLOCK_SIZE], int count) {
+    unsigned int hash = 2166136261u;
+    unsigned int saved = header->record.checksum;
+
+    header->record.checksum = 0;
+    for (int i = 0; i < BLOCK_SIZE; ++i)
+        hash = (hash ^ (unsigned char) header->block[i]) * 16777619u;
+    for (int b = 0; b < count; ++b) {
+        for (int i = 0; i < BLOCK_SIZE; ++i)
+            hash = (hash ^ (unsigned char) images[b][i]) * 16777619u;
+    }
+    header->record.checksum = saved;
+    return (hash);
+}
+
+/**
+ * Write a set of blocks to their home locations, in block order, with one vectored
+ * write per run of adjacent blocks.  Snapshot copies of the old contents are saved first.
  *
+ * @param blocks Block contents, indexed by block reference
+ * @param map Bitmap of the blocks to write
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_write_home(VDISK *disk, char blocks[][BLOCK_SIZE], unsigned char *map) {
+    struct iovec iov[N_BLOCKS_IN_DISK];
+
+    int saved = 0;
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        if (map[b >> 3] & (1 << (b & 7))) {
+            int ret = vdisk_snapshot_preserve(disk, b);
+            if (ret < 0)
+                return (ret);
+            saved |= ret;
+        }
+    }
+    if (saved && vdisk_file_write(disk, VDISK_SNAPSHOT_TABLE_BLOCK, &disk->snapshots) != 0) {
+        fprintf(stderr, "vdisk_write_home(): snapshot table update failed\n");
+        return (-4);
+    }
+
+    for (int b = 0; b < N_BLOCKS_IN_DISK;) {
+        int n = 0;
+        while (b + n < N_BLOCKS_IN_DISK && (map[(b + n) >> 3] & (1 << ((b + n) & 7)))) {
+            iov[n].iov_base = blocks[b + n];
+            iov[n].iov_len = BLOCK_SIZE;
+            ++n;
+        }
+        if (n == 0) {
+            ++b;
+            continue;
+        }
+        if (pwritev(disk->fd, iov, n, (off_t) b * BLOCK_SIZE) != n * BLOCK_SIZE) {
+            fprintf(stderr, "vdisk_write_home(): write failed\n");
+            return (-4);
+        }
+        VDISK_COUNT(disk->stats.blocks_written, n);
+        b += n;
+    }
+    return (0);
+}
+
+/**
+ * Flush the file to stable storage
+ *
+ * @return 0 on success; <0 on error
  */
-int vdisk_disk_open(char *virtual_disk_name) {
-    if (vdisk_fd != 0) {
+static int vdisk_sync(VDISK *disk) {
+    if (fdatasync(disk->fd) != 0) {
+        fprintf(stderr, "vdisk_sync(): fdatasync failed\n");
+        return (-4);
+    }
+    VDISK_COUNT(disk->stats.syncs, 1);
+    return (0);
+}
+
+/**
+ * Make the journal durable up to and including a record
+ *
+ * One sync covers every record written before it, so a record that an earlier
+ * sync already covered needs none.
+ *
+ * @param sequence Sequence number of the record
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_journal_sync_to(VDISK *disk, unsigned int sequence) {
+    if (sequence < disk->journal_durable)
+        return (0);
+
+    unsigned int written = disk->journal_sequence;
+    if (vdisk_sync(disk) != 0)
+        return (-4);
+    disk->data_unsynced = 0;
+    if (written > disk->journal_durable)
+        disk->journal_durable = written;
+    return (0);
+}
+
+/**
+ * Make the journal durable up to and including a record, without holding the disk lock
+ *
+ * Commits with VDISK_DURABILITY_FULL wait here, so other threads can write records
+ * while the sync runs.  Waiting threads queue on sync_lock; by the time one gets it,
+ * the sync of the thread before it has often covered its record already.
+ *
+ * @param sequence Sequence number of the record
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_journal_wait(VDISK *disk, unsigned int sequence) {
+    int ret = 0;
+
+    pthread_mutex_lock(&disk->sync_lock);
+    vdisk_lock(disk);
+    int covered = (sequence < disk->journal_durable);
+    unsigned int written = disk->journal_sequence;
+    vdisk_unlock(disk);
+
+    if (!covered) {
+        ret = vdisk_sync(disk);
+        vdisk_lock(disk);
+        if (ret == 0 && written > disk->journal_durable)
+            disk->journal_durable = written;
+        vdisk_unlock(disk);
+    }
+    pthread_mutex_unlock(&disk->sync_lock);
+    return (ret);
+}
+
+/**
+ * Close the current group of journal records: make them durable, write their blocks
+ * home, and empty the log
+ *
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_journal_checkpoint(VDISK *disk) {
+    VDISK_JOURNAL_SUPER super;
+
+    if (disk->journal_head == 0)
+        return (0);
+
+    // One sync makes every record of the group durable
+    if (vdisk_journal_sync_to(disk, disk->journal_sequence - 1) != 0)
+        return (-4);
+    if (vdisk_write_home(disk, disk->journal_blocks, disk->journal_pending) != 0)
+        return (-4);
+
+    // The home blocks must be durable before the records are dropped
+    if (vdisk_sync(disk) != 0)
+        return (-4);
+    disk->data_unsynced = 0;
+
+    // Records older than the new sequence number no longer count; this write
+    //  becomes durable with the next group
+    memset(&super, 0, sizeof(super));
+    super.super.magic = VDISK_JOURNAL_MAGIC;
+    super.super.sequence = disk->journal_sequence;
+    if (vdisk_file_write(disk, VDISK_JOURNAL_SUPER_BLOCK, &super) != 0) {
+        fprintf(stderr, "vdisk_journal_checkpoint(): super block update failed\n");
+        return (-4);
+    }
+    vdisk_journal_mark(disk, -1);
+    disk->journal_head = 0;
+    return (0);
+}
+
+/**
+ * Can the journal be loaded without writing to the file?  That is the case unless
+ * it has never been set up or a record follows the super block.
+ *
+ * @return 1 if it can; 0 otherwise
+ */
+static int vdisk_journal_clean(VDISK *disk) {
+    VDISK_JOURNAL_SUPER super;
+    VDISK_JOURNAL_RECORD header;
+
+    if (vdisk_file_read(disk, VDISK_JOURNAL_SUPER_BLOCK, &super) != 0 ||
+        vdisk_file_read(disk, VDISK_JOURNAL_BASE, &header) != 0)
+        return (0);
+    return (super.super.magic == VDISK_JOURNAL_MAGIC &&
+            (header.record.magic != VDISK_RECORD_MAGIC || header.record.sequence != super.super.sequence));
+}
+
+/**
+ * Load the journal of a newly opened disk and apply the records a crash left in it
+ *
+ * Records are taken in order until the first one that is missing, out of sequence
+ * or fails its checksum (a record that was being written when the crash hit).
+ *
+ * @return the number of records replayed; <0 on error
+ */
+static int vdisk_journal_replay(VDISK *disk) {
+    VDISK_JOURNAL_SUPER super;
+    VDISK_JOURNAL_RECORD header;
+    char (*images)[BLOCK_SIZE] = disk->journal_images;
+    int replayed = 0;
+
+    memset(disk->journal_pending, 0, sizeof(disk->journal_pending));
+    disk->journal_head = 0;
+    if (vdisk_file_read(disk, VDISK_JOURNAL_SUPER_BLOCK, &super) != 0)
+        return (-3);
+
+    // No journal yet (new disk, or one from before journaling): start one
+    if (super.super.magic != VDISK_JOURNAL_MAGIC) {
+        memset(&super, 0, sizeof(super));
+        super.super.magic = VDISK_JOURNAL_MAGIC;
+        super.super.sequence = 1;
+        disk->journal_sequence = 1;
+        disk->journal_durable = 1;
+        return (vdisk_file_write(disk, VDISK_JOURNAL_SUPER_BLOCK, &super) == 0 ? 0 : -4);
+    }
+
+    disk->journal_sequence = super.super.sequence;
+    while (disk->journal_head < VDISK_JOURNAL_BLOCKS) {
+        if (vdisk_file_read(disk, VDISK_JOURNAL_BASE + disk->journal_head, &header) != 0)
+            return (-3);
+        int count = header.record.count;
+        if (header.record.magic != VDISK_RECORD_MAGIC || header.record.sequence != disk->journal_sequence ||
+            count <= 0 || count > N_BLOCKS_IN_DISK || disk->journal_head + 1 + count > VDISK_JOURNAL_BLOCKS)
+            break;
+
+        int mapped = 0;
+        for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+            if (header.record.map[b >> 3] & (1 << (b & 7)))
+                ++mapped;
+        }
+        for (int i = 0; mapped == count && i < count; ++i) {
+            if (vdisk_file_read(disk, VDISK_JOURNAL_BASE + disk->journal_head + 1 + i, images[i]) != 0)
+                return (-3);
+        }
+        if (mapped != count || vdisk_journal_checksum(&header, images, count) != header.record.checksum)
+            break;
+
+        // Later records supersede earlier ones
+        for (int b = 0, i = 0; b < N_BLOCKS_IN_DISK; ++b) {
+            if (header.record.map[b >> 3] & (1 << (b & 7))) {
+                memcpy(disk->journal_blocks[b], images[i++], BLOCK_SIZE);
+                disk->journal_pending[b >> 3] |= (1 << (b & 7));
+            }
+        }
+        disk->journal_head += 1 + count;
+        ++disk->journal_sequence;
+        ++replayed;
+    }
+
+    // What is on the disk is durable by definition
+    disk->journal_durable = disk->journal_sequence;
+    if (replayed > 0 && vdisk_journal_checkpoint(disk) != 0)
+        return (-4);
+    return (replayed);
+}
+
+/**
+ * Open the virtual disk and lock the image
+ *
+ * @param shared 1 = shared lock, read-only; 0 = exclusive lock
+ * @return 0 on success; < 0 on error
+ */
+static int vdisk_disk_open_locked(VDISK *disk, char *virtual_disk_name, int durability, int shared) {
+    if (disk->fd != 0) {
         fprintf(stderr, "A disk is already opened\n");
         return (-1);
     };
 
+    if (durability < VDISK_DURABILITY_NONE || durability > VDISK_DURABILITY_FULL) {
+        fprintf(stderr, "vdisk_disk_open(): bad durability level (%d)\n", durability);
+        return (-1);
+    }
+
     // Open file
     int fd = open(virtual_disk_name, O_RDWR | O_CREAT,
                   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
@@ -37,31 +572,167 @@ int vdisk_disk_open(char *virtual_disk_name) {
         return (-1);
     };
 
-    // Remember the fd in the global variable
-    vdisk_fd = fd;
+    // Wait for the other processes using the image
+    if (vdisk_file_lock(fd, shared ? VDISK_LOCK_SHARED : VDISK_LOCK_EXCLUSIVE) != 0) {
+        fprintf(stderr, "Unable to lock virtual disk (%s)\n", virtual_disk_name);
+        close(fd);
+        return (-1);
+    }
+
+    // Remember the fd in the context
+    vdisk_lock(disk);
+    disk->fd = fd;
+    disk->shared = shared;
+    disk->block_size = BLOCK_SIZE;
+    disk->n_blocks = N_BLOCKS_IN_DISK;
+    disk->durability = durability;
+    memset(&disk->stats, 0, sizeof(disk->stats));
+
+    // Load the snapshot table (all empty for images that never had one)
+    disk->view = -1;
+    if (vdisk_file_read(disk, VDISK_SNAPSHOT_TABLE_BLOCK, &disk->snapshots) != 0) {
+        fprintf(stderr, "vdisk_disk_open(): unable to read snapshot table\n");
+        memset(&disk->snapshots, 0, sizeof(disk->snapshots));
+    }
+
+    // Finish any transactions that were interrupted by a crash; a reader needs the
+    //  image to itself for that
+    int replayed = 0;
+    if (shared && !vdisk_journal_clean(disk) &&
+        (vdisk_file_lock(fd, VDISK_LOCK_NONE) != 0 || vdisk_file_lock(fd, VDISK_LOCK_EXCLUSIVE) != 0))
+        replayed = -1;
+    if (replayed == 0)
+        replayed = vdisk_journal_replay(disk);
+    if (shared && vdisk_file_lock(fd, VDISK_LOCK_SHARED) != 0)
+        replayed = -1;
+
+    // Without the journal the image cannot be trusted, so the disk stays closed
+    if (replayed < 0) {
+        close(fd);
+        disk->fd = 0;
+        disk->shared = 0;
+        disk->journal_head = 0;
+        disk->data_unsynced = 0;
+        memset(disk->journal_pending, 0, sizeof(disk->journal_pending));
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_disk_open(): unable to replay the journal\n");
+        return (-1);
+    }
+    vdisk_unlock(disk);
+    if (replayed > 0)
+        fprintf(stderr, "vdisk_disk_open(): replayed %d journal record(s)\n", replayed);
     return (0);
 };
 
+/**
+ * Open the virtual disk for reading and writing.  Waits until no other process
+ * has it open.
+ *
+ * @param virtual_disk_name Name of the file containing the virtual disk
+ * @param durability VDISK_DURABILITY_NONE, VDISK_DURABILITY_ORDERED or VDISK_DURABILITY_FULL
+ * @return 0 on success; < 0 on error
+ *
+ */
+int vdisk_disk_open_r(VDISK *disk, char *virtual_disk_name, int durability) {
+    return (vdisk_disk_open_locked(disk, virtual_disk_name, durability, 0));
+}
+
+/**
+ * Open the virtual disk for reading only.  Other readers may have it open at the
+ * same time; waits while a process has it open for writing.
+ *
+ * @param virtual_disk_name Name of the file containing the virtual disk
+ * @param durability VDISK_DURABILITY_NONE, VDISK_DURABILITY_ORDERED or VDISK_DURABILITY_FULL
+ * @return 0 on success; < 0 on error
+ */
+int vdisk_disk_open_shared_r(VDISK *disk, char *virtual_disk_name, int durability) {
+    return (vdisk_disk_open_locked(disk, virtual_disk_name, durability, 1));
+}
+
 /**
  * Close the virtual disk
  *
  * @return 0 on success; <0 for an error
  */
-int vdisk_disk_close() {
+int vdisk_disk_close_r(VDISK *disk) {
     // Must be initialized to clos it
-    if (vdisk_fd == 0) {
+    if (disk->fd == 0) {
         fprintf(stderr, "vdisk_disk_close(): disk not initialized\n");
         exit(-1);
     };
 
-    // Close the file
-    close(vdisk_fd);
+    // Write everything committed home (durably unless the level is none), then close the file
+    vdisk_lock(disk);
+    __atomic_store_n(&disk->txn_depth, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&disk->txn_done);
+    if (vdisk_journal_checkpoint(disk) != 0)
+        fprintf(stderr, "vdisk_disk_close(): unable to checkpoint the journal\n");
+    close(disk->fd);
 
-    // Mark as closed
-    vdisk_fd = 0;
+    // Mark as closed (closing the file releases its lock); an unfinished transaction is dropped
+    disk->fd = 0;
+    disk->shared = 0;
+    VDISK_STORE(disk->view, -1);
+    vdisk_unlock(disk);
     return (0);
 }
 
+/**
+ * Is the calling thread the one with the open transaction?  (disk->lock held)
+ *
+ * @return 1 if it is; 0 otherwise
+ */
+static int vdisk_txn_mine(VDISK *disk) {
+    pthread_t owner;
+
+    // Also called without disk->lock; a thread only ever sees itself as the owner
+    //  while it is
+    if (__atomic_load_n(&disk->txn_depth, __ATOMIC_ACQUIRE) == 0)
+        return (0);
+    __atomic_load(&disk->txn_owner, &owner, __ATOMIC_RELAXED);
+    return (pthread_equal(owner, pthread_self()));
+}
+
+/**
+ * Leave one level of the calling thread's transaction (disk->lock held)
+ *
+ * @return the remaining depth
+ */
+static int vdisk_txn_leave(VDISK *disk) {
+    int depth = disk->txn_depth - 1;
+
+    __atomic_store_n(&disk->txn_depth, depth, __ATOMIC_RELEASE);
+    return (depth);
+}
+
+/**
+ * Find the current contents of a block: copy them if they are in memory, otherwise
+ * say where in the file they are.  Reads the disk state only, so it may run without
+ * disk->lock as long as the version shows that no thread changed the state meanwhile.
+ *
+ * @return -1 if the block was copied; otherwise the index of the block in the file
+ */
+static int vdisk_block_locate(VDISK *disk, BLOCK_REFERENCE block_ref, void *block) {
+    int view = VDISK_LOAD(disk->view);
+
+    // Blocks written by this thread's open transaction are only in memory so far
+    if (view < 0 && vdisk_txn_mine(disk) && (disk->txn_staged[block_ref >> 3] & (1 << (block_ref & 7)))) {
+        memcpy(block, disk->txn_blocks[block_ref], BLOCK_SIZE);
+        return (-1);
+    }
+
+    // Committed blocks that have not been checkpointed yet
+    if (view < 0 && (VDISK_LOAD(disk->journal_pending[block_ref >> 3]) & (1 << (block_ref & 7)))) {
+        vdisk_block_load(block, disk->journal_blocks[block_ref]);
+        return (-1);
+    }
+
+    // Viewing a snapshot: blocks changed since it was taken come from its saved copies
+    if (view >= 0 && (disk->snapshots.snapshot[view].saved[block_ref >> 3] & (1 << (block_ref & 7))))
+        return (VDISK_SNAPSHOT_BASE + view * N_BLOCKS_IN_DISK + block_ref);
+    return (block_ref);
+}
+
 /**
  *  Read a disk block into the provided buffer
  *
@@ -70,35 +741,75 @@ int vdisk_disk_close() {
  * @return 0 on success; <0 on error
  *
  */
-int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block) {
+int vdisk_read_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_read_blocks_r(disk, block_ref, 1, block));
+}
+
+/**
+ * Read a run of adjacent disk blocks into the provided buffer
+ *
+ * Behaves like one vdisk_read_block() per block, but the blocks that come from the file
+ * are read with one positional read per run of adjacent blocks.  Positional reads share
+ * no file offset, so threads reading different runs never wait for each other.
+ *
+ * @param block_ref Index of the first block that is to be loaded
+ * @param count The number of blocks
+ * @param blocks Pointer to the buffer (count blocks) that the blocks will be placed into
+ * @return 0 on success; <0 on error
+ */
+int vdisk_read_blocks_r(VDISK *disk, BLOCK_REFERENCE block_ref, int count, void *blocks) {
+    int index[N_BLOCKS_IN_DISK];
+
     if (debug)
     {
-        fprintf(stderr, "##Reading block %d\n", block_ref);
+        fprintf(stderr, "##Reading blocks %d-%d\n", block_ref, block_ref + count - 1);
         fflush(stderr);
     }
 
     // Make sure that the disk is initialized
-    if (vdisk_fd == 0) {
+    if (disk->fd == 0) {
         fprintf(stderr, "vdisk_read_block(): disk not initialized\n");
         exit(-1);
     };
 
     // Make sure that we have a valid block request
-    if (block_ref >= N_BLOCKS_IN_DISK) {
+    if (count < 1 || block_ref >= N_BLOCKS_IN_DISK || count > N_BLOCKS_IN_DISK - block_ref) {
         fprintf(stderr, "vdisk_read_block(): bad block_ref(%d)\n", block_ref);
         return (-2);
     }
 
-    // Lseek to the correct point in the file
-    if (lseek(vdisk_fd, block_ref * BLOCK_SIZE, SEEK_SET) < 0) {
-        fprintf(stderr, "vdisk_read_block(): seek failed\n");
-        return (-3);
+    // Find the blocks without taking the lock; if a thread held the lock meanwhile,
+    //  the answers may be torn, so look again under the lock
+    unsigned int version = __atomic_load_n(&disk->version, __ATOMIC_ACQUIRE);
+    int located = 0;
+    if ((version & 1) == 0) {
+        for (int i = 0; i < count; ++i)
+            index[i] = vdisk_block_locate(disk, block_ref + i, (char *) blocks + i * BLOCK_SIZE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        located = (__atomic_load_n(&disk->version, __ATOMIC_RELAXED) == version);
+    }
+    if (!located) {
+        pthread_mutex_lock(&disk->lock);
+        for (int i = 0; i < count; ++i)
+            index[i] = vdisk_block_locate(disk, block_ref + i, (char *) blocks + i * BLOCK_SIZE);
+        pthread_mutex_unlock(&disk->lock);
     }
 
-    // Read the block
-    if (read(vdisk_fd, block, BLOCK_SIZE) != BLOCK_SIZE) {
-        fprintf(stderr, "vdisk_read_block(): read failed\n");
-        return (-4);
+    // Read the blocks, one run of adjacent ones at a time
+    for (int i = 0; i < count;) {
+        int n = 1;
+        if (index[i] < 0) {
+            ++i;
+            continue;
+        }
+        while (i + n < count && index[i + n] == index[i] + n)
+            ++n;
+        if (pread(disk->fd, (char *) blocks + i * BLOCK_SIZE, n * BLOCK_SIZE, (off_t) index[i] * BLOCK_SIZE) != n * BLOCK_SIZE) {
+            fprintf(stderr, "vdisk_read_block(): read failed\n");
+            return (-4);
+        }
+        VDISK_COUNT(disk->stats.blocks_read, n);
+        i += n;
     }
 
     // Success
@@ -106,40 +817,588 @@ int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block) {
 }
 
 /**
- *  Write a disk block to the virtual disk
+ * Open a transaction for the calling thread, or nest it in the one it has open
+ * (disk->lock held).  Waits while another thread has a transaction open.
+ */
+static void vdisk_txn_enter(VDISK *disk) {
+    while (disk->txn_depth > 0 && !vdisk_txn_mine(disk))
+        vdisk_wait(disk);
+
+    if (disk->txn_depth == 0) {
+        pthread_t self = pthread_self();
+        __atomic_store(&disk->txn_owner, &self, __ATOMIC_RELAXED);
+        memset(disk->txn_staged, 0, sizeof(disk->txn_staged));
+        memset(disk->txn_data, 0, sizeof(disk->txn_data));
+        disk->txn_aborted = 0;
+    }
+    __atomic_store_n(&disk->txn_depth, disk->txn_depth + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write the blocks staged by the outermost transaction (disk->lock held)
  *
- * @param block_ref Index to the block to be written
- * @param block Memory in which the block is currently stored
+ * File data is written home first and synced before the next journal record is
+ * written.  The other blocks are appended to the journal as one record with a single
+ * vectored write; they reach their home locations when the group of records is
+ * checkpointed.  With VDISK_DURABILITY_NONE everything is written
+ * home directly.
  *
+ * @param sequence Set to the sequence number of the journal record, if one was written
+ * @return 0 on success; <0 on error
  */
-int vdisk_write_block(BLOCK_REFERENCE block_ref, void *block) {
+static int vdisk_txn_write(VDISK *disk, unsigned int *sequence) {
+    struct iovec iov[N_BLOCKS_IN_DISK + 1];
+    char (*images)[BLOCK_SIZE] = disk->journal_images;
+    unsigned char data[N_BLOCKS_IN_DISK >> 3];
+    VDISK_JOURNAL_RECORD header;
+
+    if (disk->durability == VDISK_DURABILITY_NONE)
+        return (vdisk_write_home(disk, disk->txn_blocks, disk->txn_staged));
+
+    // Data blocks with an older copy still in the journal are journaled again, so the
+    //  checkpoint (or a replay) cannot bring the old copy back
+    memset(&header, 0, sizeof(header));
+    for (int i = 0; i < (N_BLOCKS_IN_DISK >> 3); ++i) {
+        data[i] = disk->txn_data[i] & disk->txn_staged[i] & ~disk->journal_pending[i];
+        header.record.map[i] = disk->txn_staged[i] & ~data[i];
+    }
+    if (vdisk_write_home(disk, disk->txn_blocks, data) != 0)
+        return (-4);
+    for (int i = 0; i < (N_BLOCKS_IN_DISK >> 3); ++i)
+        disk->data_unsynced |= (data[i] != 0);
+
+    int count = 0;
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        if (header.record.map[b >> 3] & (1 << (b & 7))) {
+            memcpy(images[count], disk->txn_blocks[b], BLOCK_SIZE);
+            iov[count + 1].iov_base = images[count];
+            iov[count + 1].iov_len = BLOCK_SIZE;
+            ++count;
+        }
+    }
+    if (count == 0)
+        return (0);
+
+    // A full log closes the current group first
+    if (disk->journal_head + 1 + count > VDISK_JOURNAL_BLOCKS && vdisk_journal_checkpoint(disk) != 0)
+        return (-4);
+
+    // The record may reach the disk as soon as it is written, so the data it refers
+    //  to has to be durable first
+    if (disk->data_unsynced) {
+        if (vdisk_sync(disk) != 0)
+            return (-4);
+        disk->data_unsynced = 0;
+    }
+
+    header.record.magic = VDISK_RECORD_MAGIC;
+    header.record.sequence = disk->journal_sequence;
+    header.record.count = count;
+    header.record.checksum = vdisk_journal_checksum(&header, images, count);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = BLOCK_SIZE;
+    if (pwritev(disk->fd, iov, count + 1, (off_t) (VDISK_JOURNAL_BASE + disk->journal_head) * BLOCK_SIZE) !=
+        (count + 1) * BLOCK_SIZE) {
+        fprintf(stderr, "vdisk_txn_commit(): journal write failed\n");
+        return (-4);
+    }
+    VDISK_COUNT(disk->stats.blocks_written, count + 1);
+    VDISK_COUNT(disk->stats.journal_records, 1);
+    *sequence = disk->journal_sequence++;
+    disk->journal_head += 1 + count;
+
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        if (header.record.map[b >> 3] & (1 << (b & 7))) {
+            vdisk_block_store(disk->journal_blocks[b], disk->txn_blocks[b]);
+            vdisk_journal_mark(disk, b);
+        }
+    }
+    return (0);
+}
+
+/**
+ * Finish the outermost transaction of the calling thread: write it, let the next
+ * transaction start, and with VDISK_DURABILITY_FULL wait until the record is durable.
+ * Called with disk->lock held and txn_depth back at 0; returns with it released.
+ *
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_txn_close(VDISK *disk) {
+    unsigned int sequence = 0;
+
+    int ret = vdisk_txn_write(disk, &sequence);
+    pthread_cond_broadcast(&disk->txn_done);
+    vdisk_unlock(disk);
+
+    if (ret == 0 && sequence != 0 && disk->durability == VDISK_DURABILITY_FULL)
+        ret = vdisk_journal_wait(disk, sequence);
+    return (ret);
+}
+
+/**
+ * Stage a block in the open transaction, or commit it as a transaction of its own
+ *
+ * @param data 1 = the block holds file data
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_stage_block(VDISK *disk, char *caller, BLOCK_REFERENCE block_ref, void *block, int data) {
     if (debug)
         fprintf(stderr, "##Writing block %d\n", block_ref);
 
     // File open?
-    if (vdisk_fd == 0) {
-        fprintf(stderr, "vdisk_write_block(): disk not initialized\n");
+    if (disk->fd == 0) {
+        fprintf(stderr, "%s(): disk not initialized\n", caller);
         exit(-1);
     };
 
     // Is it a valid block request?
     if (block_ref >= N_BLOCKS_IN_DISK) {
-        fprintf(stderr, "vdisk_write_block(): bad block_ref(%d)\n", block_ref);
+        fprintf(stderr, "%s(): bad block_ref(%d)\n", caller, block_ref);
         return (-2);
     }
 
-    // Move to the beginning of the block
-    if (lseek(vdisk_fd, block_ref * BLOCK_SIZE, SEEK_SET) < 0) {
-        fprintf(stderr, "vdisk_write_block(): seek failed\n");
-        return (-3);
+    vdisk_lock(disk);
+
+    // Snapshots are read-only
+    if (disk->view >= 0) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "%s(): snapshot is read-only\n", caller);
+        return (-5);
     }
 
-    // Read the block
-    if (write(vdisk_fd, block, BLOCK_SIZE) != BLOCK_SIZE) {
-        fprintf(stderr, "vdisk_write_block(): read failed\n");
-        return (-4);
+    // So is a disk shared with other readers
+    if (disk->shared) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "%s(): disk is opened read-only\n", caller);
+        return (-5);
+    }
+
+    // Inside a transaction the block is only staged; otherwise it is a transaction of its own
+    int single = !vdisk_txn_mine(disk);
+    if (single)
+        vdisk_txn_enter(disk);
+    memcpy(disk->txn_blocks[block_ref], block, BLOCK_SIZE);
+    disk->txn_staged[block_ref >> 3] |= (1 << (block_ref & 7));
+    if (data)
+        disk->txn_data[block_ref >> 3] |= (1 << (block_ref & 7));
+    else
+        disk->txn_data[block_ref >> 3] &= ~(1 << (block_ref & 7));
+    if (single) {
+        vdisk_txn_leave(disk);
+        return (vdisk_txn_close(disk));
     }
 
     // Success
+    vdisk_unlock(disk);
+    return (0);
+}
+
+/**
+ *  Write a disk block to the virtual disk
+ *
+ *  The block goes through the journal and reaches its home location at the
+ *  next checkpoint (directly at commit with VDISK_DURABILITY_NONE).  Before a
+ *  block is overwritten for the first time after a snapshot was taken, its
+ *  current contents are saved into that snapshot.
+ *
+ * @param block_ref Index to the block to be written
+ * @param block Memory in which the block is currently stored
+ *
+ */
+int vdisk_write_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_stage_block(disk, "vdisk_write_block", block_ref, block, 0));
+}
+
+/**
+ *  Write a block of file data to the virtual disk
+ *
+ *  Like vdisk_write_block(), except that the block is not journaled: it is
+ *  written home when its transaction commits, ahead of the journaled metadata.
+ *
+ * @param block_ref Index to the block to be written
+ * @param block Memory in which the block is currently stored
+ *
+ */
+int vdisk_write_data_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_stage_block(disk, "vdisk_write_data_block", block_ref, block, 1));
+}
+
+/**
+ * Start a transaction: block writes are staged until the matching commit
+ *
+ * Transactions nest; only the outermost commit writes to the disk.  If another
+ * thread has a transaction open, this waits until it ends.
+ *
+ * @return 0 on success; <0 on error
+ */
+int vdisk_txn_begin_r(VDISK *disk) {
+    if (disk->fd == 0) {
+        fprintf(stderr, "vdisk_txn_begin(): disk not initialized\n");
+        exit(-1);
+    };
+
+    vdisk_lock(disk);
+    vdisk_txn_enter(disk);
+    vdisk_unlock(disk);
+    return (0);
+}
+
+/**
+ * Commit the blocks staged by a transaction
+ *
+ * Committing a nested transaction only ends it; the outermost commit writes the
+ * blocks.  If a nested transaction was aborted, the outermost commit writes nothing
+ * and fails, so no part of the transaction reaches the disk.
+ * File data is written home first and synced before the next journal record is
+ * written.  The other blocks are appended to the journal as one record with a single
+ * vectored write; they reach their home locations when the group of records is
+ * checkpointed.  With VDISK_DURABILITY_FULL the record is durable
+ * on return; with VDISK_DURABILITY_NONE everything is written home directly.
+ *
+ * @return 0 on success; <0 on error
+ */
+int vdisk_txn_commit_r(VDISK *disk) {
+    vdisk_lock(disk);
+    if (!vdisk_txn_mine(disk)) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_txn_commit(): no transaction open\n");
+        return (-1);
+    }
+    if (vdisk_txn_leave(disk) > 0) {
+        vdisk_unlock(disk);
+        return (0);
+    }
+    if (disk->txn_aborted) {
+        memset(disk->txn_staged, 0, sizeof(disk->txn_staged));
+        pthread_cond_broadcast(&disk->txn_done);
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_txn_commit(): a nested transaction was aborted\n");
+        return (-1);
+    }
+    return (vdisk_txn_close(disk));
+}
+
+/**
+ * Checkpoint the journal unless the calling thread has a transaction open (disk->lock held)
+ *
+ * @return 0 on success; <0 on error
+ */
+static int vdisk_journal_flush(VDISK *disk) {
+    if (vdisk_txn_mine(disk)) {
+        fprintf(stderr, "vdisk_journal_sync(): transaction still open\n");
+        return (-1);
+    }
+    return (vdisk_journal_checkpoint(disk));
+}
+
+/**
+ * Make every committed transaction durable and write its blocks home
+ *
+ * @return 0 on success; <0 on error
+ */
+int vdisk_journal_sync_r(VDISK *disk) {
+    if (disk->fd == 0) {
+        fprintf(stderr, "vdisk_journal_sync(): disk not initialized\n");
+        exit(-1);
+    };
+
+    vdisk_lock(disk);
+    int ret = vdisk_journal_flush(disk);
+    vdisk_unlock(disk);
+    return (ret);
+}
+
+/**
+ * Copy the I/O counters of the open disk
+ *
+ * @param stats Filled in with the counters
+ */
+void vdisk_get_stats_r(VDISK *disk, VDISK_STATS *stats) {
+    vdisk_lock(disk);
+    *stats = disk->stats;
+    vdisk_unlock(disk);
+}
+
+/**
+ * Drop the blocks staged by a transaction
+ *
+ * Aborting a nested transaction drops the staged blocks of the enclosing ones as well,
+ * and makes the outermost commit fail.
+ *
+ * @return 0 on success; <0 on error
+ */
+int vdisk_txn_abort_r(VDISK *disk) {
+    vdisk_lock(disk);
+    if (!vdisk_txn_mine(disk)) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_txn_abort(): no transaction open\n");
+        return (-1);
+    }
+    if (vdisk_txn_leave(disk) == 0)
+        pthread_cond_broadcast(&disk->txn_done);
+    else
+        disk->txn_aborted = 1;
+    memset(disk->txn_staged, 0, sizeof(disk->txn_staged));
+    vdisk_unlock(disk);
+    return (0);
+}
+
+/**
+ * Take a read-only snapshot of the whole disk
+ *
+ * Only the snapshot table is written; blocks are copied lazily as they are overwritten.
+ *
+ * @param name Name of the new snapshot
+ * @return 0 on success; <0 on error
+ */
+int vdisk_snapshot_create_r(VDISK *disk, char *name) {
+    if (disk->fd == 0) {
+        fprintf(stderr, "vdisk_snapshot_create(): disk not initialized\n");
+        exit(-1);
+    };
+
+    if (name[0] == 0 || strlen(name) >= VDISK_SNAPSHOT_NAME_SIZE) {
+        fprintf(stderr, "vdisk_snapshot_create(): bad snapshot name (%s)\n", name);
+        return (-2);
+    }
+
+    vdisk_lock(disk);
+    int ret = vdisk_snapshot_find(disk, name) >= 0 ? -2 : -1;
+    if (disk->shared) {
+        fprintf(stderr, "vdisk_snapshot_create(): disk is opened read-only\n");
+        ret = -5;
+    } else if (ret == -2)
+        fprintf(stderr, "vdisk_snapshot_create(): snapshot '%s' already exists\n", name);
+
+    // The snapshot captures the disk with every committed transaction in place
+    else if (vdisk_journal_flush(disk) != 0)
+        ret = -4;
+
+    for (int i = 0; ret == -1 && i < VDISK_MAX_SNAPSHOTS; ++i) {
+        VDISK_SNAPSHOT *snapshot = &disk->snapshots.snapshot[i];
+        if (snapshot->name[0] == 0) {
+            memset(snapshot, 0, sizeof(*snapshot));
+            strncpy(snapshot->name, name, VDISK_SNAPSHOT_NAME_SIZE - 1);
+            ret = 0;
+            if (vdisk_file_write(disk, VDISK_SNAPSHOT_TABLE_BLOCK, &disk->snapshots) != 0) {
+                fprintf(stderr, "vdisk_snapshot_create(): snapshot table update failed\n");
+                snapshot->name[0] = 0;
+                ret = -4;
+            }
+        }
+    }
+    vdisk_unlock(disk);
+
+    if (ret == -1)
+        fprintf(stderr, "vdisk_snapshot_create(): no free snapshot slots\n");
+    return (ret);
+}
+
+/**
+ * Delete a snapshot
+ *
+ * @param name Name of the snapshot
+ * @return 0 on success; <0 on error
+ */
+int vdisk_snapshot_delete_r(VDISK *disk, char *name) {
+    if (disk->fd == 0) {
+        fprintf(stderr, "vdisk_snapshot_delete(): disk not initialized\n");
+        exit(-1);
+    };
+
+    vdisk_lock(disk);
+    int i = vdisk_snapshot_find(disk, name);
+    int ret = 0;
+    if (disk->shared) {
+        fprintf(stderr, "vdisk_snapshot_delete(): disk is opened read-only\n");
+        ret = -5;
+    } else if (i < 0) {
+        fprintf(stderr, "vdisk_snapshot_delete(): no snapshot named '%s'\n", name);
+        ret = -2;
+    } else if (i == disk->view) {
+        fprintf(stderr, "vdisk_snapshot_delete(): snapshot '%s' is being viewed\n", name);
+        ret = -2;
+    } else {
+        memset(&disk->snapshots.snapshot[i], 0, sizeof(VDISK_SNAPSHOT));
+        if (vdisk_file_write(disk, VDISK_SNAPSHOT_TABLE_BLOCK, &disk->snapshots) != 0) {
+            fprintf(stderr, "vdisk_snapshot_delete(): snapshot table update failed\n");
+            ret = -4;
+        }
+    }
+    vdisk_unlock(disk);
+    return (ret);
+}
+
+/**
+ * List the existing snapshots
+ *
+ * @param names Filled in with up to max snapshot names
+ * @param max Capacity of names
+ * @return the number of snapshots
+ */
+int vdisk_snapshot_list_r(VDISK *disk, char names[][VDISK_SNAPSHOT_NAME_SIZE], int max) {
+    int n = 0;
+    vdisk_lock(disk);
+    for (int i = 0; i < VDISK_MAX_SNAPSHOTS && n < max; ++i) {
+        if (disk->snapshots.snapshot[i].name[0] != 0)
+            strncpy(names[n++], disk->snapshots.snapshot[i].name, VDISK_SNAPSHOT_NAME_SIZE);
+    }
+    vdisk_unlock(disk);
+    return (n);
+}
+
+/**
+ * Direct subsequent block reads to a snapshot (read-only)
+ *
+ * @param name Name of the snapshot; NULL returns to the live disk
+ * @return 0 on success; <0 on error
+ */
+int vdisk_snapshot_view_r(VDISK *disk, char *name) {
+    int i = -1;
+
+    vdisk_lock(disk);
+    if (name != NULL && (i = vdisk_snapshot_find(disk, name)) < 0) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_snapshot_view(): no snapshot named '%s'\n", name);
+        return (-2);
+    }
+    VDISK_STORE(disk->view, i);
+    vdisk_unlock(disk);
     return (0);
 }
+
+/**
+ * Return the live disk to the state captured by a snapshot
+ *
+ * Only the blocks that changed since the snapshot was taken are copied back.  Other
+ * snapshots are preserved as usual; the snapshot itself is kept.
+ *
+ * @param name Name of the snapshot
+ * @return 0 on success; <0 on error
+ */
+int vdisk_snapshot_rollback_r(VDISK *disk, char *name) {
+    char block[BLOCK_SIZE];
+    unsigned char saved[N_BLOCKS_IN_DISK >> 3];
+
+    vdisk_lock(disk);
+    int i = vdisk_snapshot_find(disk, name);
+    if (i < 0) {
+        vdisk_unlock(disk);
+        fprintf(stderr, "vdisk_snapshot_rollback(): no snapshot named '%s'\n", name);
+        return (-2);
+    }
+
+    // Saved copies are only made at checkpoints, so bring them up to date first
+    if (vdisk_journal_flush(disk) != 0) {
+        vdisk_unlock(disk);
+        return (-4);
+    }
+    memcpy(saved, disk->snapshots.snapshot[i].saved, sizeof(saved));
+    vdisk_unlock(disk);
+
+    vdisk_txn_begin_r(disk);
+    for (int b = 0; b < N_BLOCKS_IN_DISK; ++b) {
+        if (saved[b >> 3] & (1 << (b & 7))) {
+            if (vdisk_file_read(disk, VDISK_SNAPSHOT_BASE + i * N_BLOCKS_IN_DISK + b, block) != 0 ||
+                vdisk_write_block_r(disk, b, block) != 0) {
+                fprintf(stderr, "vdisk_snapshot_rollback(): failed at block %d\n", b);
+                vdisk_txn_abort_r(disk);
+                return (-4);
+            }
+        }
+    }
+    return (vdisk_txn_commit_r(disk));
+}
+
+/**
+ * Prepare a context for vdisk_disk_open_r()
+ *
+ * @param disk The context
+ */
+void vdisk_init(VDISK *disk) {
+    memset(disk, 0, sizeof(*disk));
+    pthread_mutex_init(&disk->lock, NULL);
+    pthread_cond_init(&disk->txn_done, NULL);
+    pthread_mutex_init(&disk->sync_lock, NULL);
+    disk->view = -1;
+    disk->durability = VDISK_DURABILITY_ORDERED;
+}
+
+/**
+ * The context used by the functions without the _r suffix
+ */
+VDISK *vdisk_default() {
+    return (&vdisk_default_disk);
+}
+
+/*
+ * Compatibility wrappers: the original interface, on the default context
+ */
+
+int vdisk_disk_open(char *virtual_disk_name, int durability) {
+    return (vdisk_disk_open_r(&vdisk_default_disk, virtual_disk_name, durability));
+}
+
+int vdisk_disk_open_shared(char *virtual_disk_name, int durability) {
+    return (vdisk_disk_open_shared_r(&vdisk_default_disk, virtual_disk_name, durability));
+}
+
+int vdisk_disk_close() {
+    return (vdisk_disk_close_r(&vdisk_default_disk));
+}
+
+int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_read_block_r(&vdisk_default_disk, block_ref, block));
+}
+
+int vdisk_read_blocks(BLOCK_REFERENCE block_ref, int count, void *blocks) {
+    return (vdisk_read_blocks_r(&vdisk_default_disk, block_ref, count, blocks));
+}
+
+int vdisk_write_block(BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_write_block_r(&vdisk_default_disk, block_ref, block));
+}
+
+int vdisk_write_data_block(BLOCK_REFERENCE block_ref, void *block) {
+    return (vdisk_write_data_block_r(&vdisk_default_disk, block_ref, block));
+}
+
+int vdisk_txn_begin() {
+    return (vdisk_txn_begin_r(&vdisk_default_disk));
+}
+
+int vdisk_txn_commit() {
+    return (vdisk_txn_commit_r(&vdisk_default_disk));
+}
+
+int vdisk_txn_abort() {
+    return (vdisk_txn_abort_r(&vdisk_default_disk));
+}
+
+int vdisk_journal_sync() {
+    return (vdisk_journal_sync_r(&vdisk_default_disk));
+}
+
+void vdisk_get_stats(VDISK_STATS *stats) {
+    vdisk_get_stats_r(&vdisk_default_disk, stats);
+}
+
+int vdisk_snapshot_create(char *name) {
+    return (vdisk_snapshot_create_r(&vdisk_default_disk, name));
+}
+
+int vdisk_snapshot_delete(char *name) {
+    return (vdisk_snapshot_delete_r(&vdisk_default_disk, name));
+}
+
+int vdisk_snapshot_list(char names[][VDISK_SNAPSHOT_NAME_SIZE], int max) {
+    return (vdisk_snapshot_list_r(&vdisk_default_disk, names, max));
+}
+
+int vdisk_snapshot_view(char *name) {
+    return (vdisk_snapshot_view_r(&vdisk_default_disk, name));
+}
+
+int vdisk_snapshot_rollback(char *name) {
+    return (vdisk_snapshot_rollback_r(&vdisk_default_disk, name));
+}
@@ -1,4 +1,5 @@
 #ifndef VDISK_H
+#define VDISK_H
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -6,6 +7,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 typedef unsigned short BLOCK_REFERENCE;
 
@@ -15,12 +17,166 @@ typedef unsigned short BLOCK_REFERENCE;
 // Total number of blocks on the virtual disk
 #define N_BLOCKS_IN_DISK 128
 
-int vdisk_disk_open(char *virtual_disk_name);
+// Snapshots kept alongside the disk: size of a snapshot name (including the null) and
+//  how many snapshots can exist at once
+#define VDISK_SNAPSHOT_NAME_SIZE 16
+#define VDISK_MAX_SNAPSHOTS 7
+
+// Durability levels (see vdisk.c)
+#define VDISK_DURABILITY_NONE 0
+#define VDISK_DURABILITY_ORDERED 1
+#define VDISK_DURABILITY_FULL 2
+
+// I/O counters of the open disk
+typedef struct vdisk_stats_s {
+    unsigned long blocks_read;
+    unsigned long blocks_written;
+    unsigned long journal_records;
+    unsigned long syncs;
+} VDISK_STATS;
+
+// One snapshot table entry
+typedef struct vdisk_snapshot_s {
+    // Name of the snapshot; empty if the slot is unused
+    char name[VDISK_SNAPSHOT_NAME_SIZE];
+
+    // 1 = a copy of the block has been saved in this snapshot
+    unsigned char saved[N_BLOCKS_IN_DISK >> 3];
+} VDISK_SNAPSHOT;
+
+// The snapshot table, padded to one block
+typedef union vdisk_snapshot_table_u {
+    VDISK_SNAPSHOT snapshot[VDISK_MAX_SNAPSHOTS];
+    char block[BLOCK_SIZE];
+} VDISK_SNAPSHOT_TABLE;
+
+// Everything about one open virtual disk.  Prepare with vdisk_init(); the fields
+//  are private to vdisk.c
+typedef struct vdisk_s {
+    // Guards every field below; txn_done is signalled when the open transaction
+    //  ends, and sync_lock lets one thread at a time sync the journal.  version is
+    //  odd while a thread holding the lock may be changing the fields
+    pthread_mutex_t lock;
+    unsigned int version;
+    pthread_cond_t txn_done;
+    pthread_mutex_t sync_lock;
+
+    // File descriptor of the image (0 = not open); shared = opened read-only, with a
+    //  shared lock on the image
+    int fd;
+    int shared;
+
+    // Geometry: bytes per block and blocks in the file system
+    int block_size;
+    int n_blocks;
+
+    // Durability level and the I/O counters
+    int durability;
+    VDISK_STATS stats;
+
+    // In-memory copy of the snapshot table and the snapshot being viewed (-1 = live)
+    VDISK_SNAPSHOT_TABLE snapshots;
+    int view;
+
+    // Blocks staged by the open transaction (and which of them hold file data);
+    //  txn_depth counts nested begins by txn_owner, the only thread that sees them,
+    //  and txn_aborted is set once a nested transaction was aborted
+    pthread_t txn_owner;
+    char txn_blocks[N_BLOCKS_IN_DISK][BLOCK_SIZE];
+    unsigned char txn_staged[N_BLOCKS_IN_DISK >> 3];
+    unsigned char txn_data[N_BLOCKS_IN_DISK >> 3];
+    int txn_depth;
+    int txn_aborted;
+
+    // Blocks committed to the journal but not yet checkpointed, the next free record
+    //  block of the log, the sequence number of the next record, and the sequence
+    //  number below which records are known to be durable
+    char journal_blocks[N_BLOCKS_IN_DISK][BLOCK_SIZE] __attribute__((aligned(sizeof(unsigned long))));
+    unsigned char journal_pending[N_BLOCKS_IN_DISK >> 3];
+    int journal_head;
+    unsigned int journal_sequence;
+    unsigned int journal_durable;
+
+    // File data written home since the last sync under disk->lock; a journal record
+    //  may not be written before that data is durable
+    int data_unsynced;
+
+    // Scratch space for the block images of one journal record
+    char journal_images[N_BLOCKS_IN_DISK][BLOCK_SIZE];
+} VDISK;
+
+// Context-first interface
+void vdisk_init(VDISK *disk);
+
+VDISK *vdisk_default();
+
+int vdisk_disk_open_r(VDISK *disk, char *virtual_disk_name, int durability);
+
+int vdisk_disk_open_shared_r(VDISK *disk, char *virtual_disk_name, int durability);
+
+int vdisk_disk_close_r(VDISK *disk);
+
+int vdisk_read_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block);
+
+int vdisk_read_blocks_r(VDISK *disk, BLOCK_REFERENCE block_ref, int count, void *blocks);
+
+int vdisk_write_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block);
+
+int vdisk_write_data_block_r(VDISK *disk, BLOCK_REFERENCE block_ref, void *block);
+
+int vdisk_txn_begin_r(VDISK *disk);
+
+int vdisk_txn_commit_r(VDISK *disk);
+
+int vdisk_txn_abort_r(VDISK *disk);
+
+int vdisk_journal_sync_r(VDISK *disk);
+
+void vdisk_get_stats_r(VDISK *disk, VDISK_STATS *stats);
+
+int vdisk_snapshot_create_r(VDISK *disk, char *name);
+
+int vdisk_snapshot_delete_r(VDISK *disk, char *name);
+
+int vdisk_snapshot_list_r(VDISK *disk, char names[][VDISK_SNAPSHOT_NAME_SIZE], int max);
+
+int vdisk_snapshot_view_r(VDISK *disk, char *name);
+
+int vdisk_snapshot_rollback_r(VDISK *disk, char *name);
+
+// The same on the default context (vdisk_default())
+int vdisk_disk_open(char *virtual_disk_name, int durability);
+
+int vdisk_disk_open_shared(char *virtual_disk_name, int durability);
 
 int vdisk_disk_close();
 
 int vdisk_read_block(BLOCK_REFERENCE block_ref, void *block);
 
+int vdisk_read_blocks(BLOCK_REFERENCE block_ref, int count, void *blocks);
+
 int vdisk_write_block(BLOCK_REFERENCE block_ref, void *block);
 
+int vdisk_write_data_block(BLOCK_REFERENCE block_ref, void *block);
+
+int vdisk_txn_begin();
+
+int vdisk_txn_commit();
+
+int vdisk_txn_abort();
+
+int vdisk_journal_sync();
+
+void vdisk_get_stats(VDISK_STATS *stats);
+
+int vdisk_snapshot_create(char *name);
+
+int vdisk_snapshot_delete(char *name);
+
+int vdisk_snapshot_list(char names[][VDISK_SNAPSHOT_NAME_SIZE], int max);
+
+int vdisk_snapshot_view(char *name);
+
+int vdisk_snapshot_rollback(char *name);
+
 #endif
@@ -0,0 +1,192 @@
+/**
+Run a script of OU File System commands in one process.
+
+The script is read from the named file, or from stdin.  Each line is one command:
+the name of a tool (with or without its leading z, or list for zfilez) followed by
+its arguments, separated by blanks.  Blank lines and lines starting with # are
+skipped.  A command that reads stdin (create, append) can be given inline data:
+end its line with <<MARKER, and the lines that follow, up to a line holding just
+MARKER, are its input.  Without inline data its input is empty.
+
+The commands are the tools' own (see zcommand.c), run against one open disk: the
+disk is opened once for the whole script, or, if zfsd is running, every command
+is handed to it.  A failing command is reported with its line number and the
+script goes on; the result is EXIT_FAILURE if any command failed.
+
+    mkdir /etc
+    create /etc/motd <<END
+    Welcome
+    END
+    link /etc/motd /motd
+    list /etc
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "zcommand.h"
+
+// Most arguments of one command, its name included
+#define ZBATCH_MAX_ARGS 8
+
+// Largest inline input: what a file holds
+#define ZBATCH_MAX_INPUT (BLOCK_SIZE * BLOCKS_PER_INODE)
+
+/**
+ * Read the inline input of a command: the lines up to the end marker
+ *
+ * @param script the script.
+ * @param marker the line that ends the input.
+ * @param input receives the input, cut to ZBATCH_MAX_INPUT bytes.
+ * @param lineNumber counts the lines read.
+ * @return the length of the input, or -1 if the script ends before the marker
+ */
+static int zbatch_input(FILE *script, char *marker, char *input, int *lineNumber)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    int len = 0;
+
+    while ((n = getline(&line, &size, script)) > 0) {
+        (*lineNumber)++;
+        if (strncmp(line, marker, strlen(marker)) == 0 && strspn(line + strlen(marker), "\r\n") == n - strlen(marker)) {
+            free(line);
+            return len;
+        }
+        int keep = MIN(n, ZBATCH_MAX_INPUT - len);
+        memcpy(input + len, line, keep);
+        len += keep;
+    }
+    free(line);
+    return -1;
+}
+
+/**
+ * Run one command, with the given input as its stdin
+ *
+ * @param cwd the working directory.
+ * @param disk_name the disk image.
+ * @param opened 1 once the disk has been opened here; commands go to zfsd until then.
+ * @param argc the number of arguments.
+ * @param argv the arguments; argv[0] names the command.
+ * @param input the input.
+ * @param len the length of the input.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int zbatch_run(char *cwd, char *disk_name, int *opened, int argc, char **argv, char *input, int len)
+{
+    int status = EXIT_FAILURE;
+    int pipeFds[2];
+
+    // The input goes through a pipe in place of stdin; it always fits in the pipe
+    if (pipe(pipeFds) != 0)
+        return EXIT_FAILURE;
+    if (len > 0 && write(pipeFds[1], input, len) != len) {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return EXIT_FAILURE;
+    }
+    close(pipeFds[1]);
+    int saved = dup(0);
+    dup2(pipeFds[0], 0);
+    close(pipeFds[0]);
+
+    if (*opened || zfsd_forward(cwd, disk_name, argc, argv, &status) != 0) {
+        // zfsd is not running: open the disk for the rest of the script
+        if (!*opened && vdisk_disk_open(disk_name, oufs_get_durability()) == 0)
+            *opened = 1;
+        if (*opened)
+            status = zcommand_find(argv[0])->run(cwd, argc, argv);
+        fflush(stdout);
+    }
+
+    dup2(saved, 0);
+    close(saved);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    static char input[ZBATCH_MAX_INPUT];
+    char *line = NULL;
+    size_t size = 0;
+    int lineNumber = 0, failed = 0, opened = 0;
+    FILE *script = stdin;
+
+    // Check arguments
+    if (argc > 2) {
+        fprintf(stderr, "Usage: zbatch [<script>]\n");
+        return EXIT_FAILURE;
+    }
+    if (argc == 2 && (script = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    while (getline(&line, &size, script) > 0) {
+        char *args[ZBATCH_MAX_ARGS + 1];
+        char name[MAX_PATH_LENGTH];
+        char *save = NULL, *last = NULL;
+        int nArgs = 0, len = 0;
+
+        // Keep the first arguments and the last token, but count them all
+        lineNumber++;
+        for (char *token = strtok_r(line, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save)) {
+            if (nArgs < ZBATCH_MAX_ARGS)
+                args[nArgs] = token;
+            last = token;
+            nArgs++;
+        }
+        if (nArgs == 0 || args[0][0] == '#')
+            continue;
+        int start = lineNumber;
+
+        // Inline input; it is consumed even if the command is rejected, so its lines
+        //  are not taken for commands
+        if (nArgs > 1 && strncmp(last, "<<", 2) == 0) {
+            char *marker = last + 2;
+            --nArgs;
+            if (*marker == 0 || (len = zbatch_input(script, marker, input, &lineNumber)) < 0) {
+                fprintf(stderr, "zbatch: line %d: inline input without an end marker\n", start);
+                failed++;
+                break;
+            }
+        }
+        if (nArgs > ZBATCH_MAX_ARGS) {
+            fprintf(stderr, "zbatch: line %d: too many arguments\n", start);
+            failed++;
+            continue;
+        }
+
+        // The tool name, with or without its z
+        snprintf(name, sizeof(name), "%s%s", (args[0][0] == 'z') ? "" : "z", args[0]);
+        ZCOMMAND *command = zcommand_find(strcmp(args[0], "list") == 0 ? "zfilez" : name);
+        if (command == NULL) {
+            fprintf(stderr, "zbatch: line %d: unknown command %s\n", start, args[0]);
+            failed++;
+            continue;
+        }
+        args[0] = command->name;
+        args[nArgs] = NULL;
+        if (zbatch_run(cwd, disk_name, &opened, nArgs, args, input, len) != EXIT_SUCCESS) {
+            fprintf(stderr, "zbatch: line %d: %s failed\n", start, command->name);
+            failed++;
+        }
+    }
+
+    // Clean up
+    free(line);
+    if (script != stdin)
+        fclose(script);
+    if (opened)
+        vdisk_disk_close();
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,376 @@
+/**
+Measure the cost of the durability levels of the OU File System.
+
+Each level runs the same workload of namespace operations and file writes on a
+scratch virtual disk (zbench_vdisk, removed afterwards, so ZDISK is not touched).
+
+With -t, the workload is instead run by several threads at once on one shared
+file system, and the allocation tables, reference counts and directory sizes
+are checked for consistency afterwards (oufs_fsck).
+
+With -l, threads only look up a path six levels deep, to show how lookups
+scale: the run is repeated with 1, 2, 4, ... threads up to the number given.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+#define BENCH_DISK "zbench_vdisk"
+
+// Most threads the stress test runs (each one owns a directory in the root)
+#define MAX_STRESS_THREADS 8
+
+// Size of the file that every stress thread reads
+#define SHARED_FILE_SIZE (BLOCK_SIZE*2 + 17)
+
+// Most threads the lookup benchmark runs, the path they look up, and how many
+//  lookups each one makes per iteration
+#define MAX_LOOKUP_THREADS 64
+#define LOOKUP_PATH "/l1/l2/l3/l4/l5/file"
+#define LOOKUPS_PER_ITERATION 50
+
+// One lookup benchmark thread
+typedef struct lookup_thread_s {
+    pthread_t thread;
+    int lookups;
+    int errors;
+} LOOKUP_THREAD;
+
+// One stress test thread
+typedef struct stress_thread_s {
+    pthread_t thread;
+    int id;
+    int n_threads;
+    int iterations;
+    int operations;
+    int errors;
+} STRESS_THREAD;
+
+/**
+ * Run the workload once on a freshly formatted scratch disk.
+ *
+ * @param durability the durability level to open the disk with.
+ * @param iterations the number of times the workload is repeated.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int run_workload(int durability, int iterations)
+{
+    char cwd[MAX_PATH_LENGTH] = "/";
+    char name[FILE_NAME_SIZE];
+    unsigned char data[BLOCK_SIZE*3];
+    struct timespec start, end;
+    VDISK_STATS stats;
+    int operations = 0;
+    static const char *levels[] = {"none", "ordered", "full"};
+
+    memset(data, 'z', sizeof(data));
+    if(oufs_format_disk(BENCH_DISK) != EXIT_SUCCESS || vdisk_disk_open(BENCH_DISK, durability) != 0)
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i=0; i < iterations; i++)
+    {
+        //Create, rewrite and append to a file, make and remove a directory, remove the file.
+        snprintf(name, sizeof(name), "f%d", i % 8);
+        OUFILE *fp = oufs_fopen(cwd, name, "w");
+        if(fp == NULL)
+            break;
+        oufs_fwrite(fp, data, sizeof(data) - BLOCK_SIZE);
+        oufs_fclose(fp);
+        if((fp = oufs_fopen(cwd, name, "a")) == NULL)
+            break;
+        oufs_fwrite(fp, data, BLOCK_SIZE);
+        oufs_fclose(fp);
+
+        snprintf(name, sizeof(name), "d%d", i % 8);
+        oufs_mkdir(cwd, name);
+        oufs_rmdir(cwd, name);
+
+        snprintf(name, sizeof(name), "f%d", i % 8);
+        oufs_remove(cwd, name);
+        operations += 5;
+    }
+    vdisk_get_stats(&stats);
+    vdisk_disk_close(); //Closing makes everything durable, so it is part of the run.
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-8s %8d %10.3f %12.0f %8lu %10lu %8lu\n", levels[durability], operations, seconds,
+           operations / seconds, stats.syncs, stats.blocks_written, stats.journal_records);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Fill a buffer with contents that identify the thread and iteration that wrote them.
+ */
+static void stress_pattern(unsigned char *data, int len, int id, int iteration)
+{
+    for (int i = 0; i < len; i++)
+        data[i] = (unsigned char) ('a' + (id * 7 + iteration * 3 + i) % 26);
+}
+
+/**
+ * Read a whole file and compare it with the expected contents.
+ *
+ * @return 0 if the file holds exactly the expected bytes, otherwise 1
+ */
+static int stress_verify(char *path, unsigned char *expected, int len)
+{
+    unsigned char data[BLOCK_SIZE*BLOCKS_PER_INODE + 1];
+    char cwd[MAX_PATH_LENGTH] = "/";
+    int n = 0;
+
+    OUFILE *fp = oufs_fopen(cwd, path, "r");
+    if (fp == NULL)
+        return 1;
+    int status = oufs_fread(fp, data, &n);
+    oufs_fclose(fp);
+    return status != EXIT_SUCCESS || n != len || memcmp(data, expected, len) != 0;
+}
+
+/**
+ * Body of a stress test thread.  Each thread rewrites, reads back and removes files in
+ * its own directory (t<id>), makes a subdirectory there, copies it, moves it into the next
+ * thread's directory and removes it and its copy, links its file into the next thread's
+ * directory and reads the file that all threads share.
+ */
+static void *stress_thread(void *arg)
+{
+    STRESS_THREAD *st = arg;
+    char cwd[MAX_PATH_LENGTH] = "/";
+    char path[MAX_PATH_LENGTH], link[MAX_PATH_LENGTH], moved[MAX_PATH_LENGTH], copy[MAX_PATH_LENGTH];
+    unsigned char data[BLOCK_SIZE*3], shared[SHARED_FILE_SIZE];
+
+    stress_pattern(shared, sizeof(shared), 0, 0);
+
+    for (int i = 0; i < st->iterations; i++) {
+        int len = 1 + (st->id * 131 + i * 97) % sizeof(data);
+        snprintf(path, sizeof(path), "t%d/f%d", st->id, i % 2);
+        stress_pattern(data, len, st->id, i);
+
+        OUFILE *fp = oufs_fopen(cwd, path, "w");
+        if (fp == NULL) {
+            st->errors++;
+            continue;
+        }
+        oufs_fwrite(fp, data, len);
+        oufs_fclose(fp);
+        st->errors += stress_verify(path, data, len);
+
+        snprintf(link, sizeof(link), "t%d/l%d", (st->id + 1) % st->n_threads, st->id);
+        if (oufs_link(cwd, path, link) == EXIT_SUCCESS) {
+            st->errors += stress_verify(link, data, len);
+            st->errors += (oufs_remove(cwd, link) != EXIT_SUCCESS);
+        }
+
+        snprintf(link, sizeof(link), "t%d/d", st->id);
+        snprintf(moved, sizeof(moved), "t%d/m%d", (st->id + 1) % st->n_threads, st->id);
+        snprintf(copy, sizeof(copy), "t%d/c", st->id);
+        st->errors += (oufs_mkdir(cwd, link) != EXIT_SUCCESS);
+        st->errors += (oufs_copy_tree(cwd, link, copy) != EXIT_SUCCESS);
+        st->errors += (oufs_rename(cwd, link, moved) != EXIT_SUCCESS);
+        st->errors += (oufs_rmdir(cwd, moved) != EXIT_SUCCESS);
+        st->errors += (oufs_remove_tree(cwd, copy) != EXIT_SUCCESS);
+
+        st->errors += stress_verify("shared", shared, sizeof(shared));
+        if (i % 3 == 2)
+            st->errors += (oufs_remove(cwd, path) != EXIT_SUCCESS);
+        st->operations += 12;
+    }
+    return NULL;
+}
+
+/**
+ * Run the workload with several threads sharing one file system, then check it.
+ *
+ * @param durability the durability level to open the disk with.
+ * @param iterations the number of times each thread repeats the workload.
+ * @param nThreads the number of threads.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int run_stress(int durability, int iterations, int nThreads)
+{
+    char cwd[MAX_PATH_LENGTH] = "/";
+    unsigned char shared[SHARED_FILE_SIZE];
+    STRESS_THREAD threads[MAX_STRESS_THREADS];
+    struct timespec start, end;
+    static const char *levels[] = {"none", "ordered", "full"};
+    int operations = 0, errors = 0;
+
+    if (oufs_format_disk(BENCH_DISK) != EXIT_SUCCESS || vdisk_disk_open(BENCH_DISK, durability) != 0)
+        return EXIT_FAILURE;
+
+    stress_pattern(shared, sizeof(shared), 0, 0);
+    OUFILE *fp = oufs_fopen(cwd, "shared", "w");
+    if (fp == NULL)
+        return EXIT_FAILURE;
+    oufs_fwrite(fp, shared, sizeof(shared));
+    oufs_fclose(fp);
+    for (int i = 0; i < nThreads; i++) {
+        char dir[MAX_PATH_LENGTH];
+        snprintf(dir, sizeof(dir), "t%d", i);
+        if (oufs_mkdir(cwd, dir) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < nThreads; i++) {
+        threads[i] = (STRESS_THREAD) {.id = i, .n_threads = nThreads, .iterations = iterations};
+        pthread_create(&threads[i].thread, NULL, stress_thread, &threads[i]);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        operations += threads[i].operations;
+        errors += threads[i].errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int problems = 0, repaired = 0;
+    if (oufs_fsck(nThreads, 0, &problems, &repaired) != EXIT_SUCCESS)
+        errors++;
+    vdisk_disk_close();
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-8s %8d %8d %10.3f %12.0f %8d %8d\n", levels[durability], nThreads, operations, seconds,
+           operations / seconds, errors, problems);
+    return (errors == 0 && problems == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Body of a lookup benchmark thread: resolve the same path over and over.
+ */
+static void *lookup_thread(void *arg)
+{
+    LOOKUP_THREAD *lt = arg;
+    char cwd[MAX_PATH_LENGTH] = "/";
+    char local_name[FILE_NAME_SIZE];
+    INODE_REFERENCE parent, child;
+
+    for (int i = 0; i < lt->lookups; i++) {
+        if (oufs_find_file(cwd, LOOKUP_PATH, &parent, &child, local_name) == EXIT_FAILURE || child == UNALLOCATED_INODE)
+            lt->errors++;
+    }
+    return NULL;
+}
+
+/**
+ * Measure path lookups with 1, 2, 4, ... threads, up to nThreads.
+ *
+ * @param durability the durability level to open the disk with.
+ * @param iterations the number of times each thread repeats the lookups.
+ * @param nThreads the largest number of threads.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int run_lookups(int durability, int iterations, int nThreads)
+{
+    char cwd[MAX_PATH_LENGTH] = "/";
+    char path[MAX_PATH_LENGTH] = "";
+    LOOKUP_THREAD threads[MAX_LOOKUP_THREADS];
+    static const char *levels[] = {"none", "ordered", "full"};
+    double single = 0;
+    int errors = 0;
+
+    if (oufs_format_disk(BENCH_DISK) != EXIT_SUCCESS || vdisk_disk_open(BENCH_DISK, durability) != 0)
+        return EXIT_FAILURE;
+
+    // The directories on the path, then the file at its end
+    for (int i = 1; i <= 5; i++) {
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "/l%d", i);
+        if (oufs_mkdir(cwd, path) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+    OUFILE *fp = oufs_fopen(cwd, LOOKUP_PATH, "w");
+    if (fp == NULL)
+        return EXIT_FAILURE;
+    oufs_fclose(fp);
+
+    for (int n = 1; n <= nThreads && errors == 0; n = (n < nThreads && n * 2 > nThreads) ? nThreads : n * 2) {
+        struct timespec start, end;
+        int lookups = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; i++) {
+            threads[i] = (LOOKUP_THREAD) {.lookups = iterations * LOOKUPS_PER_ITERATION};
+            pthread_create(&threads[i].thread, NULL, lookup_thread, &threads[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            pthread_join(threads[i].thread, NULL);
+            lookups += threads[i].lookups;
+            errors += threads[i].errors;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (n == 1)
+            single = lookups / seconds;
+        printf("%-8s %8d %8d %10.3f %12.0f %8.2f\n", levels[durability], n, lookups, seconds, lookups / seconds,
+               lookups / seconds / single);
+        if (n == nThreads)
+            break;
+    }
+    vdisk_disk_close();
+    return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    int iterations = 200;
+    int nThreads = 0;
+    int lookups = 0;
+    int status = EXIT_SUCCESS;
+    int levels[3];
+    int nLevels = 0;
+
+    // Options: -n <iterations>, -t|-l <threads>, then the levels to measure (all by default)
+    while (argc > 2 && (strcmp(argv[1], "-n") == 0 || strcmp(argv[1], "-t") == 0 || strcmp(argv[1], "-l") == 0)) {
+        int *value = (argv[1][1] == 'n') ? &iterations : &nThreads;
+        lookups |= (argv[1][1] == 'l');
+        if (sscanf(argv[2], "%d", value) != 1 || *value < 1 ||
+            (value == &nThreads && nThreads > (lookups ? MAX_LOOKUP_THREADS : MAX_STRESS_THREADS))) {
+            fprintf(stderr, "Invalid %s (%s)\n", (value == &iterations) ? "iteration count" : "thread count", argv[2]);
+            return EXIT_FAILURE;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    for (int i = 1; i < argc && nLevels < 3; i++) {
+        if (strcmp(argv[i], "none") == 0)
+            levels[nLevels++] = VDISK_DURABILITY_NONE;
+        else if (strcmp(argv[i], "ordered") == 0)
+            levels[nLevels++] = VDISK_DURABILITY_ORDERED;
+        else if (strcmp(argv[i], "full") == 0)
+            levels[nLevels++] = VDISK_DURABILITY_FULL;
+        else {
+            fprintf(stderr, "Usage: zbench [-n <iterations>] [-t <threads> | -l <threads>] [none] [ordered] [full]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (nLevels == 0) {
+        levels[nLevels++] = VDISK_DURABILITY_NONE;
+        levels[nLevels++] = VDISK_DURABILITY_ORDERED;
+        levels[nLevels++] = VDISK_DURABILITY_FULL;
+    }
+
+    if (lookups)
+        printf("%-8s %8s %8s %10s %12s %8s\n", "level", "threads", "lookups", "seconds", "lookups/s", "speedup");
+    else if (nThreads > 0)
+        printf("%-8s %8s %8s %10s %12s %8s %8s\n", "level", "threads", "ops", "seconds", "ops/s", "errors", "problems");
+    else
+        printf("%-8s %8s %10s %12s %8s %10s %8s\n", "level", "ops", "seconds", "ops/s", "syncs", "blocks", "records");
+    for (int i = 0; i < nLevels && status == EXIT_SUCCESS; i++) {
+        if (lookups)
+            status = run_lookups(levels[i], iterations, nThreads);
+        else
+            status = (nThreads > 0) ? run_stress(levels[i], iterations, nThreads) : run_workload(levels[i], iterations);
+        if (status != EXIT_SUCCESS)
+            fprintf(stderr, "Unable to run the benchmark on %s\n", BENCH_DISK);
+    }
+    unlink(BENCH_DISK);
+    return status;
+}
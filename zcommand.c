@@ -0,0 +1,474 @@
+/**
+The commands of the z* tools that work on files and directories, shared by the tools
+themselves and by zfsd (which runs them without opening the disk each time), and the
+client side of zfsd.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "zcommand.h"
+
+/**
+ * Read a command's input (fd 0) until end of file or until it fills a file
+ *
+ * @param buf receives the input; BLOCK_SIZE*BLOCKS_PER_INODE + 1 bytes.
+ * @return the number of bytes read
+ */
+static int zcommand_input(unsigned char *buf)
+{
+    int len = 0;
+    ssize_t n;
+
+    while (len < BLOCK_SIZE * BLOCKS_PER_INODE && (n = read(0, buf + len, BLOCK_SIZE * BLOCKS_PER_INODE - len)) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        len += n;
+    }
+    return len;
+}
+
+/**
+ * zmkdir <dirname>: make a directory
+ */
+static int zcommand_mkdir(char *cwd, int argc, char **argv)
+{
+    if (argc == 2)
+        return oufs_mkdir(cwd, argv[1]);
+
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zmkdir <dirname>\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * zrmdir <dirname>: remove an empty directory
+ */
+static int zcommand_rmdir(char *cwd, int argc, char **argv)
+{
+    if (argc == 2)
+        return oufs_rmdir(cwd, argv[1]);
+
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zrmdir <dirname>\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * zfilez [-l] [-s <snapshot>] [<dirname>]: list a directory, optionally with the type, link
+ * count and size of each entry, optionally as it was in a snapshot
+ */
+static int zcommand_filez(char *cwd, int argc, char **argv)
+{
+    char *snapshot = NULL;
+    int longFormat = 0;
+    char currentDir[MAX_PATH_LENGTH] = "./";
+
+    while (argc >= 2 && argv[1][0] == '-') {
+        if (strncmp(argv[1], "-l", 3) == 0) {
+            longFormat = 1;
+            argv++;
+            argc--;
+        } else if (argc >= 3 && strncmp(argv[1], "-s", 3) == 0) {
+            snapshot = argv[2];
+            argv += 2;
+            argc -= 2;
+        } else {
+            break;
+        }
+    }
+    if (argc > 2) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zfilez [-l] [-s <snapshot>] <dirname> or zfilez for CWD\n");
+        return EXIT_FAILURE;
+    }
+    if (snapshot != NULL && vdisk_snapshot_view(snapshot) != 0)
+        return EXIT_FAILURE;
+
+    char *path = (argc == 2) ? argv[1] : currentDir;
+    int status = longFormat ? oufs_list_long(cwd, path) : oufs_list(cwd, path);
+    fflush(stdout);
+
+    // Back to the live disk
+    if (snapshot != NULL)
+        vdisk_snapshot_view(NULL);
+    return status;
+}
+
+/**
+ * ztouch <filename>: make an empty file, or leave an existing one as it is
+ */
+static int zcommand_touch(char *cwd, int argc, char **argv)
+{
+    if (argc != 2) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: ztouch <filename>\n");
+        return EXIT_FAILURE;
+    }
+    OUFILE *fileDesc = oufs_fopen(cwd, argv[1], "a");
+    if (fileDesc == NULL)
+        return EXIT_FAILURE;
+    oufs_fclose(fileDesc);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * zcreate [-z] [--size <bytes>] <filename>: write a file from the input
+ */
+static int zcommand_create(char *cwd, int argc, char **argv)
+{
+    unsigned char inputBuffer[(BLOCK_SIZE*BLOCKS_PER_INODE) + 1];
+    int sizeHint = -1;
+    int compress = 0;
+
+    // Options: -z stores the file compressed; --size reserves the blocks for the whole file up front
+    while (argc > 2 && argv[1][0] == '-') {
+        if (strncmp(argv[1], "-z", 3) == 0) {
+            compress = 1;
+            argv++;
+            argc--;
+        } else if (argc > 3 && strncmp(argv[1], "--size", 7) == 0) {
+            if (sscanf(argv[2], "%d", &sizeHint) != 1 || sizeHint < 0) {
+                fprintf(stderr, "Invalid size (%s)\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+            argv += 2;
+            argc -= 2;
+        } else {
+            break;
+        }
+    }
+    if (argc != 2) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zcreate [-z] [--size <bytes>] <filename>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Make or open the specified file
+    OUFILE *fileDesc = oufs_fopen(cwd, argv[1], "w");
+    if (fileDesc == NULL) {
+        fprintf(stderr, "Unable to open file.\n");
+        return EXIT_FAILURE;
+    }
+    if (compress && oufs_fcompress(fileDesc) != EXIT_SUCCESS) {
+        oufs_fclose(fileDesc);
+        return EXIT_FAILURE;
+    }
+    if (sizeHint >= 0)
+        oufs_fallocate(fileDesc, 0, MIN(sizeHint, BLOCK_SIZE*BLOCKS_PER_INODE));
+    oufs_fwrite(fileDesc, inputBuffer, zcommand_input(inputBuffer));
+    int status = oufs_fflush(fileDesc);
+
+    // Clean up
+    oufs_fclose(fileDesc);
+    return status;
+}
+
+/**
+ * zappend <filename>: append the input to a file, making it if needed
+ */
+static int zcommand_append(char *cwd, int argc, char **argv)
+{
+    unsigned char inputBuffer[(BLOCK_SIZE*BLOCKS_PER_INODE) + 1];
+
+    if (argc != 2) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zappend <filename>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Make or open the specified file
+    OUFILE *fileDesc = oufs_fopen(cwd, argv[1], "a");
+    if (fileDesc == NULL) {
+        fprintf(stderr, "Unable to open file.\n");
+        return EXIT_FAILURE;
+    }
+    oufs_fwrite(fileDesc, inputBuffer, zcommand_input(inputBuffer));
+    int status = oufs_fflush(fileDesc);
+
+    // Clean up
+    oufs_fclose(fileDesc);
+    return status;
+}
+
+/**
+ * zmore [-s <snapshot>] <filename>: copy a file to the output, optionally as it was in a
+ * snapshot
+ */
+static int zcommand_more(char *cwd, int argc, char **argv)
+{
+    unsigned char inputBuffer[(BLOCK_SIZE*BLOCKS_PER_INODE) + 1];
+    int length = 0;
+    char *snapshot = NULL;
+
+    // Optionally read the file from a snapshot
+    if (argc == 4 && strncmp(argv[1], "-s", 3) == 0) {
+        snapshot = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zmore [-s <snapshot>] <filename>\n");
+        return EXIT_FAILURE;
+    }
+    if (snapshot != NULL && vdisk_snapshot_view(snapshot) != 0)
+        return EXIT_FAILURE;
+
+    int status = EXIT_FAILURE;
+    OUFILE *fileDesc = oufs_fopen(cwd, argv[1], "r");
+    if (fileDesc == NULL) {
+        fprintf(stderr, "Unable to open file.\n");
+    } else {
+        status = oufs_fread(fileDesc, inputBuffer, &length);
+        if (status == EXIT_SUCCESS && write(1, inputBuffer, length) != length)
+            status = EXIT_FAILURE;
+        oufs_fclose(fileDesc);
+    }
+
+    // Back to the live disk
+    if (snapshot != NULL)
+        vdisk_snapshot_view(NULL);
+    return status;
+}
+
+/**
+ * zremove [-r] <filename>: remove a file's directory entry, and the file with its last one;
+ * with -r, remove a directory and everything under it
+ */
+static int zcommand_remove(char *cwd, int argc, char **argv)
+{
+    if (argc == 2)
+        return oufs_remove(cwd, argv[1]);
+    if (argc == 3 && strncmp(argv[1], "-r", 3) == 0)
+        return oufs_remove_tree(cwd, argv[2]);
+
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zremove [-r] <filename>\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * zlink <existing> <new_name>: add another directory entry for a file
+ */
+static int zcommand_link(char *cwd, int argc, char **argv)
+{
+    if (argc == 3)
+        return oufs_link(cwd, argv[1], argv[2]);
+
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zlink <existing> <new_name>\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * zmv <source> <destination>: rename or move a file or directory
+ */
+static int zcommand_mv(char *cwd, int argc, char **argv)
+{
+    if (argc == 3)
+        return oufs_rename(cwd, argv[1], argv[2]);
+
+    // Wrong number of parameters
+    fprintf(stderr, "Usage: zmv <source> <destination>\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * zcp [--reflink | -r] <source> <destination>: copy a file; with -r, copy a directory and
+ * everything under it
+ */
+static int zcommand_cp(char *cwd, int argc, char **argv)
+{
+    unsigned char inputBuffer[(BLOCK_SIZE*BLOCKS_PER_INODE) + 1];
+    int length = 0;
+
+    // Share the source's blocks instead of copying them
+    if (argc == 4 && strncmp(argv[1], "--reflink", 10) == 0)
+        return oufs_clone(cwd, argv[2], argv[3]);
+    if (argc == 4 && strncmp(argv[1], "-r", 3) == 0)
+        return oufs_copy_tree(cwd, argv[2], argv[3]);
+    if (argc != 3) {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zcp [--reflink | -r] <source> <destination>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Read the whole source, then write it to the destination
+    OUFILE *srcDesc = oufs_fopen(cwd, argv[1], "r");
+    if (srcDesc == NULL) {
+        fprintf(stderr, "Unable to open file.\n");
+        return EXIT_FAILURE;
+    }
+    oufs_fread(srcDesc, inputBuffer, &length);
+    int compressed = (*srcDesc).compressed;
+    oufs_fclose(srcDesc);
+    OUFILE *dstDesc = oufs_fopen(cwd, argv[2], "w");
+    if (dstDesc == NULL) {
+        fprintf(stderr, "Unable to open file.\n");
+        return EXIT_FAILURE;
+    }
+
+    // A compressed source gives a compressed copy
+    if (compressed)
+        oufs_fcompress(dstDesc);
+    oufs_fwrite(dstDesc, inputBuffer, length);
+    int status = oufs_fflush(dstDesc);
+
+    // Clean up
+    oufs_fclose(dstDesc);
+    return status;
+}
+
+// Every command, by tool name
+static ZCOMMAND zcommands[] = {
+    {"zmkdir", 0, zcommand_mkdir},
+    {"zrmdir", 0, zcommand_rmdir},
+    {"zfilez", 1, zcommand_filez},
+    {"ztouch", 0, zcommand_touch},
+    {"zcreate", 0, zcommand_create},
+    {"zappend", 0, zcommand_append},
+    {"zmore", 1, zcommand_more},
+    {"zremove", 0, zcommand_remove},
+    {"zlink", 0, zcommand_link},
+    {"zmv", 0, zcommand_mv},
+    {"zcp", 0, zcommand_cp},
+};
+
+/**
+ * Find a command by the name of its tool
+ *
+ * @param name the tool name; a leading directory is ignored.
+ * @return the command, or NULL if there is none
+ */
+ZCOMMAND *zcommand_find(char *name)
+{
+    char *base = strrchr(name, '/');
+    if (base != NULL)
+        name = base + 1;
+    for (int i = 0; i < sizeof(zcommands) / sizeof(zcommands[0]); i++) {
+        if (strcmp(zcommands[i].name, name) == 0)
+            return &zcommands[i];
+    }
+    return NULL;
+}
+
+/**
+ * Run a tool: through zfsd if it is running on the disk, otherwise by opening the disk
+ * for just this command
+ *
+ * @param name the tool name.
+ * @param cwd the working directory.
+ * @param disk_name the disk image.
+ * @param argc the number of arguments.
+ * @param argv the arguments, argv[0] included.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+int zcommand_main(char *name, char *cwd, char *disk_name, int argc, char **argv)
+{
+    ZCOMMAND *command = zcommand_find(name);
+    int status = EXIT_FAILURE;
+
+    argv[0] = command->name;
+    if (zfsd_forward(cwd, disk_name, argc, argv, &status) == 0)
+        return status;
+
+    // Open the virtual disk
+    int opened = command->read_only ? vdisk_disk_open_shared(disk_name, oufs_get_durability())
+                                    : vdisk_disk_open(disk_name, oufs_get_durability());
+    if (opened != 0)
+        return EXIT_FAILURE;
+
+    status = command->run(cwd, argc, argv);
+
+    // Clean up
+    vdisk_disk_close();
+    return status;
+}
+
+/**
+ * The address of the zfsd socket of a disk
+ *
+ * @param disk_name the disk image.
+ * @param address filled in with the address.
+ * @return 0 on success; -1 if the name is too long for a socket
+ */
+int zfsd_address(char *disk_name, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (snprintf(address->sun_path, sizeof(address->sun_path), "%s%s", disk_name, ZFSD_SOCKET_SUFFIX)
+        >= (int) sizeof(address->sun_path))
+        return -1;
+    return 0;
+}
+
+/**
+ * Have zfsd run a command, if it is running on the disk
+ *
+ * The request holds the working directory and the arguments; this process's stdin,
+ * stdout and stderr go along with it, so the command reads and writes them directly.
+ *
+ * @param cwd the working directory.
+ * @param disk_name the disk image.
+ * @param argc the number of arguments.
+ * @param argv the arguments; argv[0] names the command.
+ * @param status filled in with the command's result.
+ * @return 0 if zfsd took the command; -1 if it is not running
+ */
+int zfsd_forward(char *cwd, char *disk_name, int argc, char **argv, int *status)
+{
+    struct sockaddr_un address;
+    char request[ZFSD_MAX_REQUEST];
+    int len = 0;
+
+    // No socket, no zfsd: don't bother connecting
+    if (zfsd_address(disk_name, &address) != 0 || access(address.sun_path, F_OK) != 0)
+        return -1;
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    // The working directory, then the arguments
+    for (int i = -1; i < argc; i++) {
+        char *arg = (i < 0) ? cwd : argv[i];
+        int n = strlen(arg) + 1;
+        if (len + n > ZFSD_MAX_REQUEST) {
+            fprintf(stderr, "zfsd: arguments too long\n");
+            close(sock);
+            *status = EXIT_FAILURE;
+            return 0;
+        }
+        memcpy(request + len, arg, n);
+        len += n;
+    }
+
+    int fds[3] = {0, 1, 2};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {.iov_base = request, .iov_len = len};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int reply;
+    if (sendmsg(sock, &message, MSG_NOSIGNAL) != len || recv(sock, &reply, sizeof(reply), 0) != sizeof(reply)) {
+        fprintf(stderr, "zfsd: no reply from %s\n", address.sun_path);
+        reply = EXIT_FAILURE;
+    }
+    close(sock);
+    *status = reply;
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef ZCOMMAND_H
+#define ZCOMMAND_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "oufs_lib.h"
+
+// Socket zfsd listens on: the disk image's name with this suffix
+#define ZFSD_SOCKET_SUFFIX ".zfsd"
+
+// Largest zfsd request: the working directory and the arguments, each null-terminated
+#define ZFSD_MAX_REQUEST 4096
+
+// One command of the z* tools.  It runs on the default disk, which is already open;
+//  argv holds the tool's own arguments.  Input is read from fd 0, output goes to fds 1
+//  and 2, and the result is EXIT_SUCCESS or EXIT_FAILURE
+typedef struct zcommand_s {
+    char *name;
+
+    // 1 = the command only reads the disk, so it is opened with a shared lock
+    int read_only;
+
+    int (*run)(char *cwd, int argc, char **argv);
+} ZCOMMAND;
+
+ZCOMMAND *zcommand_find(char *name);
+
+int zcommand_main(char *name, char *cwd, char *disk_name, int argc, char **argv);
+
+int zfsd_address(char *disk_name, struct sockaddr_un *address);
+
+int zfsd_forward(char *cwd, char *disk_name, int argc, char **argv, int *status);
+
+#endif
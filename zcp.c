@@ -0,0 +1,21 @@
+/**
+Copy a file in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "zcommand.h"
+
+int main(int argc, char **argv) {
+    // Fetch the key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+
+    // Copy the file (see zcommand.c), through zfsd if it is running
+    return (zcommand_main("zcp", cwd, disk_name, argc, argv));
+}
@@ -0,0 +1,40 @@
+/**
+Deduplicate the data blocks of the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+int main(int argc, char **argv) {
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    int reclaimed = 0;
+    int status = EXIT_FAILURE;
+
+    // Check arguments
+    if (argc == 1) {
+        // Open the virtual disk
+        if (vdisk_disk_open(disk_name, oufs_get_durability()) != 0)
+            return EXIT_FAILURE;
+
+        // Share identical blocks across all files
+        status = oufs_dedup_disk(&reclaimed);
+        printf("%d blocks reclaimed\n", reclaimed);
+
+        // Clean up
+        vdisk_disk_close();
+
+    } else {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zdedup\n");
+    }
+
+    return status;
+}
@@ -0,0 +1,220 @@
+/**
+Export a directory tree of the OU File System to the host.
+
+The tree is walked once by the main thread, which creates the host directories
+and lists the files.  A pool of threads (-j, one per processor by default) then
+copies the files: each one is read by inode (no second path lookup), a run of
+adjacent blocks at a time with positional reads, and written to its host file.
+The disk is only read, under a shared lock.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+// Most writer threads
+#define MAX_EXPORT_THREADS 16
+
+// One file to export
+typedef struct export_file_s {
+    INODE_REFERENCE inode;
+    char *host;
+} EXPORT_FILE;
+
+// The whole export, shared with the threads
+typedef struct export_s {
+    EXPORT_FILE *files;
+    int n_files;
+    int max_files;
+
+    // Next file for a thread to take, and the files that could not be exported
+    int next;
+    int errors;
+} EXPORT;
+
+/**
+ * Add a file to the export
+ *
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int export_add(EXPORT *ex, INODE_REFERENCE inode, char *host)
+{
+    if (ex->n_files == ex->max_files) {
+        int max = ex->max_files ? ex->max_files * 2 : 64;
+        EXPORT_FILE *files = realloc(ex->files, max * sizeof(EXPORT_FILE));
+        if (files == NULL)
+            return EXIT_FAILURE;
+        ex->files = files;
+        ex->max_files = max;
+    }
+    ex->files[ex->n_files].inode = inode;
+    ex->files[ex->n_files].host = strdup(host);
+    return (ex->files[ex->n_files++].host != NULL) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Create a host directory for a directory of the file system and list its contents into
+ * the export, descending into its subdirectories.
+ *
+ * @param dir the directory.
+ * @param host the host directory to create.
+ * @param exported counts the directories created.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int export_walk(EXPORT *ex, INODE_REFERENCE dir, char *host, int *exported)
+{
+    INODE dirINODE, childINODE;
+    BLOCK dirBLOCK;
+    struct stat st;
+
+    // An existing directory is reused; say why anything else cannot be
+    if (mkdir(host, 0777) != 0) {
+        int error = errno;
+        if (error == EEXIST)
+            error = (stat(host, &st) != 0) ? errno : (S_ISDIR(st.st_mode) ? 0 : ENOTDIR);
+        if (error != 0) {
+            fprintf(stderr, "zexport: %s: %s\n", host, strerror(error));
+            return EXIT_FAILURE;
+        }
+    }
+    (*exported)++;
+
+    if (oufs_read_inode_by_reference(dir, &dirINODE) != 0 || vdisk_read_block(dirINODE.data[0], &dirBLOCK) != 0)
+        return EXIT_FAILURE;
+    for (int i = 2; i < DIRECTORY_ENTRIES_PER_BLOCK; i++) {
+        DIRECTORY_ENTRY *entry = &dirBLOCK.directory.entry[i];
+        char hostPath[PATH_MAX];
+
+        if (entry->inode_reference == UNALLOCATED_INODE)
+            continue;
+        snprintf(hostPath, sizeof(hostPath), "%s/%.*s", host, (int) FILE_NAME_SIZE, entry->name);
+        if (oufs_read_inode_by_reference(entry->inode_reference, &childINODE) != 0)
+            return EXIT_FAILURE;
+        if (childINODE.type == IT_DIRECTORY) {
+            if (export_walk(ex, entry->inode_reference, hostPath, exported) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        } else if (export_add(ex, entry->inode_reference, hostPath) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Write one file to the host
+ *
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int export_file(EXPORT_FILE *f)
+{
+    unsigned char buf[BLOCK_SIZE * BLOCKS_PER_INODE + 1];
+    int len = 0, written = 0;
+
+    if (oufs_read_file(f->inode, buf, &len) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    int fd = open(f->host, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "zexport: %s: %s\n", f->host, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    while (written < len) {
+        ssize_t n = write(fd, buf + written, len - written);
+        if (n <= 0) {
+            fprintf(stderr, "zexport: %s: %s\n", f->host, strerror(n < 0 ? errno : EIO));
+            break;
+        }
+        written += n;
+    }
+    if (close(fd) != 0 && written == len) {
+        fprintf(stderr, "zexport: %s: %s\n", f->host, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return (written == len) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Body of an export thread: write files until there are none left.
+ */
+static void *export_thread(void *arg)
+{
+    EXPORT *ex = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&ex->next, 1, __ATOMIC_RELAXED)) < ex->n_files) {
+        if (export_file(&ex->files[i]) != EXIT_SUCCESS)
+            __atomic_add_fetch(&ex->errors, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    int nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t threads[MAX_EXPORT_THREADS];
+    EXPORT ex = {0};
+    int exported = 0;
+
+    // Check arguments
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        if ((nThreads = atoi(argv[2])) <= 0) {
+            fprintf(stderr, "Invalid thread count (%s)\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: zexport [-j <threads>] [<directory>] <hostDirectory>\n");
+        return EXIT_FAILURE;
+    }
+    nThreads = MAX(1, MIN(nThreads, MAX_EXPORT_THREADS));
+    char *src = (argc == 3) ? argv[1] : ".";
+    char *host = argv[argc - 1];
+
+    // Open the virtual disk (read-only)
+    if (vdisk_disk_open_shared(disk_name, oufs_get_durability()) != 0)
+        return EXIT_FAILURE;
+
+    // Find the tree and list it
+    INODE_REFERENCE parent, child;
+    INODE inode;
+    char local_name[FILE_NAME_SIZE];
+    int status = EXIT_FAILURE;
+    if (oufs_find_file(cwd, src, &parent, &child, local_name) != EXIT_SUCCESS || child == UNALLOCATED_INODE
+        || oufs_read_inode_by_reference(child, &inode) != 0 || inode.type != IT_DIRECTORY) {
+        fprintf(stderr, "zexport: %s: no such directory\n", src);
+    } else {
+        status = export_walk(&ex, child, host, &exported);
+    }
+
+    // Copy the files
+    if (status == EXIT_SUCCESS) {
+        nThreads = MIN(nThreads, MAX(ex.n_files, 1));
+        for (int t = 0; t < nThreads; t++)
+            pthread_create(&threads[t], NULL, export_thread, &ex);
+        for (int t = 0; t < nThreads; t++)
+            pthread_join(threads[t], NULL);
+        exported += ex.n_files - ex.errors;
+        printf("%d directories and files exported\n", exported);
+        if (ex.errors > 0)
+            status = EXIT_FAILURE;
+    }
+
+    // Clean up
+    vdisk_disk_close();
+    for (int i = 0; i < ex.n_files; i++)
+        free(ex.files[i].host);
+    free(ex.files);
+    return status;
+}
@@ -0,0 +1,56 @@
+/**
+Check the OU File System for consistency, and optionally repair it.
+
+The inode table and the directory tree are read by a pool of threads (-j, one per
+processor by default).  Without -r the disk is only read, under a shared lock.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+int main(int argc, char **argv) {
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    int nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int repair = 0;
+    int problems = 0, repaired = 0;
+
+    // Check arguments
+    for (; argc > 1; argc--, argv++) {
+        if (strcmp(argv[1], "-r") == 0) {
+            repair = 1;
+        } else if (argc > 2 && strcmp(argv[1], "-j") == 0 && atoi(argv[2]) > 0) {
+            nThreads = atoi(argv[2]);
+            argc--;
+            argv++;
+        } else {
+            // Wrong parameters
+            fprintf(stderr, "Usage: zfsck [-r] [-j <threads>]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Open the virtual disk: exclusively to repair it, read-only to check it
+    int opened = repair ? vdisk_disk_open(disk_name, oufs_get_durability())
+                        : vdisk_disk_open_shared(disk_name, oufs_get_durability());
+    if (opened != 0)
+        return EXIT_FAILURE;
+
+    int status = oufs_fsck(nThreads, repair, &problems, &repaired);
+    if (status == EXIT_SUCCESS) {
+        printf("%d problems found, %d repaired\n", problems, repaired);
+        if (problems != repaired)
+            status = EXIT_FAILURE;
+    }
+
+    // Clean up
+    vdisk_disk_close();
+    return status;
+}
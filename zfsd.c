@@ -0,0 +1,202 @@
+/**
+Serve the OU File System tools from one long-running process.
+
+zfsd opens the disk once and keeps it open, then runs the commands that the tools
+send it over a Unix domain socket next to the image (the disk name followed by
+ZFSD_SOCKET_SUFFIX).  A tool that finds zfsd running hands over its working
+directory, its arguments and its stdin, stdout and stderr, and waits for the
+result, so a command costs a socket round trip instead of a process start, a disk
+open and cold reads of the master and inode blocks.
+
+Commands run one at a time, in the order they arrive.  zfsd holds the image lock
+the whole time, so the tools it does not serve (zformat, zsnap, zinspect, ...) wait
+until it stops.  "zfsd stop", SIGINT or SIGTERM stop it; the disk is closed as a
+tool would close it.
+
+CS3113
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "zcommand.h"
+
+// Connections waiting to be served
+#define ZFSD_BACKLOG 64
+
+// Listening socket, shut down by the signal handler to stop the server
+static int zfsd_listener = -1;
+
+/**
+ * SIGINT/SIGTERM: stop taking requests
+ */
+static void zfsd_stop(int sig)
+{
+    shutdown(zfsd_listener, SHUT_RDWR);
+}
+
+/**
+ * Close every descriptor passed with a message
+ *
+ * @param message the message received.
+ */
+static void zfsd_close_received(struct msghdr *message)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg != NULL; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < n; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+    }
+}
+
+/**
+ * Run one request
+ *
+ * The command reads and writes the client's stdin, stdout and stderr, which are put in
+ * place of zfsd's own for as long as it runs.
+ *
+ * @param client the connection.
+ * @param saved zfsd's own stdin, stdout and stderr.
+ * @return 1 if the request was to stop zfsd, 0 otherwise
+ */
+static int zfsd_serve(int client, int *saved)
+{
+    char request[ZFSD_MAX_REQUEST + 1];
+    char *argv[ZFSD_MAX_REQUEST / 2 + 1];
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {.iov_base = request, .iov_len = ZFSD_MAX_REQUEST};
+    struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+    int status = EXIT_FAILURE;
+    int stop = 0;
+
+    ssize_t len = recvmsg(client, &message, MSG_CMSG_CLOEXEC);
+    if (len < 0)
+        return 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (len == 0 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        // Whatever descriptors did come with a malformed request must not pile up in zfsd
+        zfsd_close_received(&message);
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // The working directory, then the arguments
+    request[len] = 0;
+    char *cwd = request;
+    int argc = 0;
+    for (char *arg = request + strlen(request) + 1; arg < request + len; arg += strlen(arg) + 1)
+        argv[argc++] = arg;
+    argv[argc] = NULL;
+
+    ZCOMMAND *command = (argc > 0) ? zcommand_find(argv[0]) : NULL;
+    if (argc == 2 && strcmp(argv[0], "zfsd") == 0 && strcmp(argv[1], "stop") == 0) {
+        stop = 1;
+        status = EXIT_SUCCESS;
+    } else if (command == NULL || strlen(cwd) >= MAX_PATH_LENGTH) {
+        dprintf(fds[2], "zfsd: cannot run %s\n", (argc > 0) ? argv[0] : "an empty request");
+    } else {
+        for (int i = 0; i < 3; i++)
+            dup2(fds[i], i);
+        status = command->run(cwd, argc, argv);
+        fflush(stdout);
+        fflush(stderr);
+        for (int i = 0; i < 3; i++)
+            dup2(saved[i], i);
+    }
+
+    for (int i = 0; i < 3; i++)
+        close(fds[i]);
+    send(client, &status, sizeof(status), MSG_NOSIGNAL);
+    return stop;
+}
+
+int main(int argc, char **argv)
+{
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    struct sockaddr_un address;
+    int status;
+
+    // Check arguments
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        argv[0] = "zfsd";
+        if (zfsd_forward(cwd, disk_name, argc, argv, &status) == 0)
+            return status;
+        fprintf(stderr, "zfsd is not running on %s\n", disk_name);
+        return EXIT_FAILURE;
+    }
+    if (argc != 1) {
+        fprintf(stderr, "Usage: zfsd [stop]\n");
+        return EXIT_FAILURE;
+    }
+    if (zfsd_address(disk_name, &address) != 0) {
+        fprintf(stderr, "zfsd: disk name too long for a socket (%s)\n", disk_name);
+        return EXIT_FAILURE;
+    }
+
+    // A socket nobody answers on is left over from a zfsd that did not stop cleanly
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0) {
+        fprintf(stderr, "zfsd is already running on %s\n", disk_name);
+        close(probe);
+        return EXIT_FAILURE;
+    }
+    if (probe >= 0)
+        close(probe);
+    unlink(address.sun_path);
+
+    // Listen first, so tools started while the disk is being opened queue up for zfsd
+    //  instead of waiting for its lock
+    zfsd_listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (zfsd_listener < 0 || bind(zfsd_listener, (struct sockaddr *) &address, sizeof(address)) != 0
+        || listen(zfsd_listener, ZFSD_BACKLOG) != 0) {
+        fprintf(stderr, "zfsd: %s: %s\n", address.sun_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (vdisk_disk_open(disk_name, oufs_get_durability()) != 0) {
+        close(zfsd_listener);
+        unlink(address.sun_path);
+        return EXIT_FAILURE;
+    }
+
+    // Signals stop zfsd cleanly, and a client that goes away must not take it along
+    struct sigaction action = {.sa_handler = zfsd_stop};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int saved[3];
+    for (int i = 0; i < 3; i++)
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+
+    for (int stop = 0; !stop;) {
+        int client = accept4(zfsd_listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        stop = zfsd_serve(client, saved);
+        close(client);
+    }
+
+    // Clean up
+    close(zfsd_listener);
+    unlink(address.sun_path);
+    vdisk_disk_close();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,349 @@
+/**
+Import a directory tree from the host into the OU File System.
+
+The host tree is walked once, in name order.  A pool of threads (-j, one per
+processor by default) reads the host files ahead of the import, while the main
+thread creates the directories and files in batches: each batch of up to
+IMPORT_BATCH entries is one transaction, so the master block and each inode and
+directory block are written once per batch and the file data goes out as one
+vectored write per run of adjacent blocks.
+
+Only the main thread uses the file system, so it may hold the batch transaction
+while it opens files (other threads must lock inodes before the transaction).
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "oufs_lib.h"
+
+// Entries created per transaction, and how far the readers may get ahead of the import
+#define IMPORT_BATCH 32
+#define IMPORT_WINDOW (IMPORT_BATCH * 2)
+
+// Most reader threads
+#define MAX_IMPORT_THREADS 16
+
+// Largest file the file system holds
+#define IMPORT_MAX_FILE_SIZE (BLOCK_SIZE * BLOCKS_PER_INODE)
+
+// One directory or file to import, in the order they are created
+typedef struct import_entry_s {
+    char type;
+    char *host;
+    char path[MAX_PATH_LENGTH];
+
+    // Files: the contents, once read (ready = 1); error is the errno of a failed read
+    unsigned char *data;
+    int len;
+    int error;
+    int ready;
+} IMPORT_ENTRY;
+
+// The whole import, shared with the readers
+typedef struct import_s {
+    IMPORT_ENTRY *entries;
+    int n_entries;
+    int max_entries;
+
+    // Next entry for a reader to take, entries the import is done with, and whether the
+    //  import has stopped
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int next;
+    int done;
+    int stopped;
+} IMPORT;
+
+/**
+ * Add an entry to the import
+ *
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int import_add(IMPORT *im, char type, char *host, char *path)
+{
+    if (im->n_entries == im->max_entries) {
+        int max = im->max_entries ? im->max_entries * 2 : 64;
+        IMPORT_ENTRY *entries = realloc(im->entries, max * sizeof(IMPORT_ENTRY));
+        if (entries == NULL)
+            return EXIT_FAILURE;
+        im->entries = entries;
+        im->max_entries = max;
+    }
+    IMPORT_ENTRY *e = &im->entries[im->n_entries++];
+    memset(e, 0, sizeof(IMPORT_ENTRY));
+    e->type = type;
+    e->host = strdup(host);
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    return (e->host != NULL) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * List a host directory into the import: its files, then each subdirectory followed by
+ * its contents.  Names are taken in sorted order; entries that cannot be stored are
+ * reported and left out.
+ *
+ * @param host the host directory.
+ * @param path where it goes in the file system.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int import_walk(IMPORT *im, char *host, char *path)
+{
+    struct dirent **names;
+    int status = EXIT_SUCCESS;
+
+    int n = scandir(host, &names, NULL, alphasort);
+    if (n < 0) {
+        fprintf(stderr, "zimport: %s: %s\n", host, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (int pass = 0; pass < 2 && status == EXIT_SUCCESS; pass++) {
+        for (int i = 0; i < n && status == EXIT_SUCCESS; i++) {
+            char hostPath[PATH_MAX], childPath[MAX_PATH_LENGTH];
+            struct stat st;
+            char *name = names[i]->d_name;
+
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+            snprintf(hostPath, sizeof(hostPath), "%s/%s", host, name);
+            if (lstat(hostPath, &st) != 0 || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))) {
+                if (pass == 0)
+                    fprintf(stderr, "zimport: %s: not a file or directory, skipped\n", hostPath);
+                continue;
+            }
+            if (S_ISDIR(st.st_mode) != pass)
+                continue;
+            if (strlen(name) >= FILE_NAME_SIZE ||
+                snprintf(childPath, sizeof(childPath), "%s/%s", path, name) >= (int) sizeof(childPath)) {
+                fprintf(stderr, "zimport: %s: name too long, skipped\n", hostPath);
+                continue;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                status = import_add(im, IT_FILE, hostPath, childPath);
+            } else if ((status = import_add(im, IT_DIRECTORY, hostPath, childPath)) == EXIT_SUCCESS) {
+                status = import_walk(im, hostPath, childPath);
+            }
+        }
+    }
+    for (int i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+    return status;
+}
+
+/**
+ * Read one host file into its entry
+ */
+static void import_read(IMPORT_ENTRY *e)
+{
+    struct stat st;
+    int fd = open(e->host, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        e->error = errno;
+    } else if (st.st_size > IMPORT_MAX_FILE_SIZE) {
+        e->error = EFBIG;
+    } else if ((e->data = malloc(st.st_size + 1)) == NULL) {
+        e->error = ENOMEM;
+    } else {
+        while (e->len < st.st_size) {
+            ssize_t got = read(fd, e->data + e->len, st.st_size - e->len);
+            if (got <= 0) {
+                e->error = (got < 0) ? errno : EIO;
+                break;
+            }
+            e->len += got;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Body of a reader thread: read the next file not taken yet, staying within
+ * IMPORT_WINDOW entries of the import.
+ */
+static void *import_reader(void *arg)
+{
+    IMPORT *im = arg;
+
+    pthread_mutex_lock(&im->lock);
+    for (;;) {
+        while (im->next < im->n_entries && im->entries[im->next].type != IT_FILE)
+            im->next++;
+        if (im->stopped || im->next >= im->n_entries)
+            break;
+        if (im->next >= im->done + IMPORT_WINDOW) {
+            pthread_cond_wait(&im->changed, &im->lock);
+            continue;
+        }
+        IMPORT_ENTRY *e = &im->entries[im->next++];
+        pthread_mutex_unlock(&im->lock);
+
+        import_read(e);
+
+        pthread_mutex_lock(&im->lock);
+        e->ready = 1;
+        pthread_cond_broadcast(&im->changed);
+    }
+    pthread_mutex_unlock(&im->lock);
+    return NULL;
+}
+
+/**
+ * Create one entry in the file system.  An existing directory is kept; an existing
+ * file is rewritten.
+ *
+ * @param cwd the working directory.
+ * @param e the entry (files must have been read).
+ * @param imported counts the entries created.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int import_create(char *cwd, IMPORT_ENTRY *e, int *imported)
+{
+    INODE_REFERENCE parent, child;
+    INODE inode;
+    char local_name[FILE_NAME_SIZE];
+
+    if (e->type == IT_DIRECTORY) {
+        if (oufs_find_file(cwd, e->path, &parent, &child, local_name) == EXIT_SUCCESS && child != UNALLOCATED_INODE
+            && oufs_read_inode_by_reference(child, &inode) == 0 && inode.type == IT_DIRECTORY)
+            return EXIT_SUCCESS;
+        if (oufs_mkdir(cwd, e->path) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    } else {
+        if (e->error != 0) {
+            // Nothing was changed for it: report it and go on
+            fprintf(stderr, "zimport: %s: %s, skipped\n", e->host, strerror(e->error));
+            return EXIT_SUCCESS;
+        }
+        OUFILE *fp = oufs_fopen(cwd, e->path, "w");
+        if (fp == NULL)
+            return EXIT_FAILURE;
+        int status = (oufs_fwrite(fp, e->data, e->len) == EXIT_SUCCESS) ? oufs_fflush(fp) : EXIT_FAILURE;
+        oufs_fclose(fp);
+        if (status != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+    (*imported)++;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Import every entry, in batches of one transaction each.  If an entry cannot be
+ * created or the batch cannot be committed, the batch is dropped as a whole and the
+ * import stops there.
+ *
+ * @param cwd the working directory.
+ * @param nThreads the number of reader threads.
+ * @param imported counts the entries created.
+ * @return the success of the program, either EXIT_FAILURE or EXIT SUCCESS
+ */
+static int import_run(IMPORT *im, char *cwd, int nThreads, int *imported)
+{
+    pthread_t readers[MAX_IMPORT_THREADS];
+    int status = EXIT_SUCCESS;
+    int batchImported = 0;
+
+    for (int t = 0; t < nThreads; t++)
+        pthread_create(&readers[t], NULL, import_reader, im);
+
+    for (int i = 0; i < im->n_entries && status == EXIT_SUCCESS; i++) {
+        IMPORT_ENTRY *e = &im->entries[i];
+
+        pthread_mutex_lock(&im->lock);
+        while (e->type == IT_FILE && !e->ready)
+            pthread_cond_wait(&im->changed, &im->lock);
+        pthread_mutex_unlock(&im->lock);
+
+        if (i % IMPORT_BATCH == 0)
+            oufs_txn_begin();
+        if (import_create(cwd, e, &batchImported) != EXIT_SUCCESS) {
+            fprintf(stderr, "zimport: unable to create %s; %d entries of its batch dropped\n", e->path, batchImported);
+            oufs_txn_abort();
+            status = EXIT_FAILURE;
+        } else if (i % IMPORT_BATCH == IMPORT_BATCH - 1 || i == im->n_entries - 1) {
+            // The commit fails if an operation of the batch aborted along the way
+            status = oufs_txn_commit();
+            if (status == EXIT_SUCCESS)
+                *imported += batchImported;
+            else
+                fprintf(stderr, "zimport: unable to commit the batch ending at %s; %d entries dropped\n", e->path,
+                        batchImported);
+            batchImported = 0;
+        }
+
+        free(e->data);
+        e->data = NULL;
+        pthread_mutex_lock(&im->lock);
+        im->done = i + 1;
+        pthread_cond_broadcast(&im->changed);
+        pthread_mutex_unlock(&im->lock);
+    }
+
+    // Let the readers finish what they hold, then stop them
+    pthread_mutex_lock(&im->lock);
+    im->stopped = 1;
+    pthread_cond_broadcast(&im->changed);
+    pthread_mutex_unlock(&im->lock);
+    for (int t = 0; t < nThreads; t++)
+        pthread_join(readers[t], NULL);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    int nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    IMPORT im = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+    int imported = 0;
+
+    // Check arguments
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        if ((nThreads = atoi(argv[2])) <= 0) {
+            fprintf(stderr, "Invalid thread count (%s)\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: zimport [-j <threads>] <hostDirectory> [<directory>]\n");
+        return EXIT_FAILURE;
+    }
+    nThreads = MAX(1, MIN(nThreads, MAX_IMPORT_THREADS));
+
+    // The destination itself comes first, then everything under it
+    char *dst = (argc == 3) ? argv[2] : ".";
+    int status = import_add(&im, IT_DIRECTORY, argv[1], dst);
+    if (status == EXIT_SUCCESS)
+        status = import_walk(&im, argv[1], dst);
+    if (status != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Open the virtual disk
+    if (vdisk_disk_open(disk_name, oufs_get_durability()) != 0)
+        return EXIT_FAILURE;
+
+    status = import_run(&im, cwd, nThreads, &imported);
+    printf("%d directories and files imported\n", imported);
+
+    // Clean up
+    vdisk_disk_close();
+    for (int i = 0; i < im.n_entries; i++) {
+        free(im.entries[i].data);
+        free(im.entries[i].host);
+    }
+    free(im.entries);
+    return status;
+}
@@ -9,7 +9,7 @@ int main(int argc, char** argv) {
 	char disk_name[MAX_PATH_LENGTH];
 	oufs_get_environment(cwd, disk_name);
 
-	if(vdisk_disk_open(disk_name) != 0) {
+	if(vdisk_disk_open_shared(disk_name, oufs_get_durability()) != 0) {
 		return(-1);
 	}
 
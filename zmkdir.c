@@ -8,7 +8,7 @@ CS3113
 #include <stdio.h>
 #include <string.h>
 
-#include "oufs_lib.h"
+#include "zcommand.h"
 
 int main(int argc, char **argv) {
     // Fetch the key environment vars
@@ -16,20 +16,6 @@ int main(int argc, char **argv) {
     char disk_name[MAX_PATH_LENGTH];
     oufs_get_environment(cwd, disk_name);
 
-    // Check arguments
-    if (argc == 2) {
-        // Open the virtual disk
-        vdisk_disk_open(disk_name);
-
-        // Make the specified directory
-        oufs_mkdir(cwd, argv[1]);
-
-        // Clean up
-        vdisk_disk_close();
-
-    } else {
-        // Wrong number of parameters
-        fprintf(stderr, "Usage: zmkdir <dirname>\n");
-    }
-
+    // Make the specified directory (see zcommand.c), through zfsd if it is running
+    return (zcommand_main("zmkdir", cwd, disk_name, argc, argv));
 }
@@ -0,0 +1,21 @@
+/**
+Rename or move a file or directory in the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "zcommand.h"
+
+int main(int argc, char **argv) {
+    // Fetch the key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+
+    // Move the entry to its new name (see zcommand.c), through zfsd if it is running
+    return (zcommand_main("zmv", cwd, disk_name, argc, argv));
+}
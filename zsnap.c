@@ -0,0 +1,61 @@
+/**
+Manage snapshots of the OU File System.
+
+CS3113
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "oufs_lib.h"
+
+int main(int argc, char **argv) {
+    // Fetch key environment vars
+    char cwd[MAX_PATH_LENGTH];
+    char disk_name[MAX_PATH_LENGTH];
+    oufs_get_environment(cwd, disk_name);
+    char names[VDISK_MAX_SNAPSHOTS][VDISK_SNAPSHOT_NAME_SIZE];
+    int status = EXIT_FAILURE;
+
+    // Check arguments
+    if (argc == 1 || (argc == 2 && strncmp(argv[1], "list", 5) == 0)) {
+        // Open the virtual disk (read-only)
+        if (vdisk_disk_open_shared(disk_name, oufs_get_durability()) != 0)
+            return EXIT_FAILURE;
+
+        // List the snapshots
+        int n = vdisk_snapshot_list(names, VDISK_MAX_SNAPSHOTS);
+        for (int i = 0; i < n; i++) {
+            printf("%s\n", names[i]);
+        }
+        status = EXIT_SUCCESS;
+
+        // Clean up
+        vdisk_disk_close();
+
+    } else if (argc == 3) {
+        // Open the virtual disk
+        if (vdisk_disk_open(disk_name, oufs_get_durability()) != 0)
+            return EXIT_FAILURE;
+
+        if (strncmp(argv[1], "create", 7) == 0) {
+            status = (vdisk_snapshot_create(argv[2]) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (strncmp(argv[1], "delete", 7) == 0) {
+            status = (vdisk_snapshot_delete(argv[2]) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (strncmp(argv[1], "rollback", 9) == 0) {
+            status = (vdisk_snapshot_rollback(argv[2]) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else {
+            fprintf(stderr, "Unknown command (%s)\n", argv[1]);
+        }
+
+        // Clean up
+        vdisk_disk_close();
+
+    } else {
+        // Wrong number of parameters
+        fprintf(stderr, "Usage: zsnap [list] | zsnap create|delete|rollback <name>\n");
+    }
+
+    return status;
+}
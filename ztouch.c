@@ -8,7 +8,7 @@ CS3113
 #include <stdio.h>
 #include <string.h>
 
-#include "oufs_lib.h"
+#include "zcommand.h"
 
 int main(int argc, char **argv) {
     // Fetch the key environment vars
@@ -16,22 +16,6 @@ int main(int argc, char **argv) {
     char disk_name[MAX_PATH_LENGTH];
     oufs_get_environment(cwd, disk_name);
 
-    char mode[2] = "a";
-
-    // Check arguments
-    if (argc == 2) {
-        // Open the virtual disk
-        vdisk_disk_open(disk_name);
-
-        // Make the specified directory
-        oufs_fopen(cwd, argv[1], &mode);
-
-        // Clean up
-        vdisk_disk_close();
-
-    } else {
-        // Wrong number of parameters
-        fprintf(stderr, "Usage: ztouch <filename>\n");
-    }
-
+    // Make the specified file (see zcommand.c), through zfsd if it is running
+    return (zcommand_main("ztouch", cwd, disk_name, argc, argv));
 }